@@ -1,9 +1,25 @@
 #ifndef __X86_64_ATOMIC_H__
 #define __X86_64_ATOMIC_H__
 
+#include "inttypes.h"
+
 // Credit to:
 // http://www.mohawksoft.org/?q=node/78
 
+/* x86 keeps loads in order with other loads and stores in order with
+ * other stores, so between processors only a store followed by a load
+ * needs a real fence. The compiler still has to be told not to move
+ * things around.
+ */
+#define barrier() __asm__ volatile("" ::: "memory")
+#define mb()  __asm__ volatile("mfence" ::: "memory")
+#define rmb() __asm__ volatile("lfence" ::: "memory")
+#define wmb() __asm__ volatile("sfence" ::: "memory")
+
+#define smp_mb() mb()
+#define smp_rmb() barrier()
+#define smp_wmb() barrier()
+
 static inline __attribute__((always_inline))
 void atomic_inc(volatile int* num)
 {
@@ -16,4 +32,89 @@ void atomic_dec(volatile int* num)
 	__asm__ volatile ("lock decl %0" : "=m"(*num));
 }
 
+/* Store new in *num if it still holds old.
+ *
+ * Returns:
+ *    What *num held before, old if the store happened
+ */
+static inline __attribute__((always_inline))
+uint32_t atomic_cmpxchg(volatile uint32_t* num, uint32_t old, uint32_t new)
+{
+	uint32_t prev;
+	__asm__ volatile ("lock cmpxchgl %2, %1"
+			: "=a"(prev), "+m"(*num)
+			: "r"(new), "0"(old)
+			: "memory");
+	return prev;
+}
+
+static inline __attribute__((always_inline))
+uint64_t atomic_cmpxchg64(volatile uint64_t* num, uint64_t old, uint64_t new)
+{
+	uint64_t prev;
+	__asm__ volatile ("lock cmpxchgq %2, %1"
+			: "=a"(prev), "+m"(*num)
+			: "r"(new), "0"(old)
+			: "memory");
+	return prev;
+}
+
+/* Add to *num.
+ *
+ * Returns:
+ *    What *num held before the add
+ */
+static inline __attribute__((always_inline))
+uint32_t atomic_fetch_add(volatile uint32_t* num, uint32_t value)
+{
+	__asm__ volatile ("lock xaddl %0, %1"
+			: "+r"(value), "+m"(*num)
+			:
+			: "memory");
+	return value;
+}
+
+static inline __attribute__((always_inline))
+uint64_t atomic_fetch_add64(volatile uint64_t* num, uint64_t value)
+{
+	__asm__ volatile ("lock xaddq %0, %1"
+			: "+r"(value), "+m"(*num)
+			:
+			: "memory");
+	return value;
+}
+
+/* Store value in *num. xchg with memory is always locked.
+ *
+ * Returns:
+ *    What *num held before
+ */
+static inline __attribute__((always_inline))
+uint32_t atomic_xchg(volatile uint32_t* num, uint32_t value)
+{
+	__asm__ volatile ("xchgl %0, %1"
+			: "+r"(value), "+m"(*num)
+			:
+			: "memory");
+	return value;
+}
+
+static inline __attribute__((always_inline))
+uint64_t atomic_xchg64(volatile uint64_t* num, uint64_t value)
+{
+	__asm__ volatile ("xchgq %0, %1"
+			: "+r"(value), "+m"(*num)
+			:
+			: "memory");
+	return value;
+}
+
+/* Tell the processor it's in a spin loop.
+ */
+static inline __attribute__((always_inline))
+void cpu_relax(void)
+{
+	__asm__ volatile ("pause" ::: "memory");
+}
+
 #endif
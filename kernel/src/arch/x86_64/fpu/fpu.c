@@ -0,0 +1,274 @@
+#include "fpu.h"
+
+#include "safety.h"
+#include "kernel/klib.h"
+#include "kernel/scheduler/scheduler.h"
+
+#include "arch/x86_64/panic.h"
+#include "arch/x86_64/cpuid.h"
+#include "arch/x86_64/kprintf.h"
+#include "arch/x86_64/interrupts/interrupts.h"
+#include "arch/x86_64/virt_memory/physical.h"
+#include "arch/x86_64/virt_memory/phys_alloc.h"
+#include "arch/x86_64/virt_memory/defines.h"
+
+#ifndef DEBUG_FPU
+#define kprintf(...)
+#endif
+
+// CPUID leaf 1
+#define CPUID_ECX_XSAVE 0x4000000
+#define CPUID_LEAF_XSAVE 0xD
+
+// Offsets into the legacy region shared by FXSAVE and XSAVE
+#define AREA_FCW   0
+#define AREA_MXCSR 24
+
+// What FNINIT and a reset leave them as, every exception masked
+#define FCW_DEFAULT   0x37F
+#define MXCSR_DEFAULT 0x1F80
+
+#define FXSAVE_SIZE 512
+
+static uint8_t use_xsave = 0;
+static uint64_t xstate_mask = 0;  // What goes in XCR0
+static uint64_t area_size = FXSAVE_SIZE;
+
+static inline __attribute__((always_inline))
+void clts(void)
+{
+	__asm__ volatile("clts");
+}
+
+static inline __attribute__((always_inline))
+void stts(void)
+{
+	uint64_t cr0;
+	__asm__ volatile("movq %%cr0, %0" : "=r"(cr0));
+	__asm__ volatile("movq %0, %%cr0" :: "r"(cr0 | CR0_TS));
+}
+
+static void save(void* area)
+{
+	if (use_xsave)
+	{
+		__asm__ volatile("xsave64 (%0)" ::
+				"r"(area), "a"((uint32_t)xstate_mask), "d"((uint32_t)(xstate_mask >> 32))
+				: "memory");
+	}
+	else
+	{
+		__asm__ volatile("fxsave64 (%0)" :: "r"(area) : "memory");
+	}
+}
+
+static void restore(const void* area)
+{
+	if (use_xsave)
+	{
+		__asm__ volatile("xrstor64 (%0)" ::
+				"r"(area), "a"((uint32_t)xstate_mask), "d"((uint32_t)(xstate_mask >> 32))
+				: "memory");
+	}
+	else
+	{
+		__asm__ volatile("fxrstor64 (%0)" :: "r"(area) : "memory");
+	}
+}
+
+/* A page holds the biggest area fpu_init() allows, and is 64 byte
+ * aligned like XSAVE wants.
+ */
+static void* area_alloc(void)
+{
+	void* area = PHYS_TO_VIRT(phys_alloc_4KIB_safe("FPU: No memory"));
+	memclr(area, area_size);
+	return area;
+}
+
+void fpu_cpu_init()
+{
+	uint64_t cr0;
+	__asm__ volatile("movq %%cr0, %0" : "=r"(cr0));
+	cr0 = (cr0 & ~(uint64_t)CR0_EM) | CR0_MP | CR0_NE | CR0_TS;
+	__asm__ volatile("movq %0, %%cr0" :: "r"(cr0));
+
+	uint64_t cr4;
+	__asm__ volatile("movq %%cr4, %0" : "=r"(cr4));
+	cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+	if (use_xsave)
+	{
+		cr4 |= CR4_OSXSAVE;
+	}
+	__asm__ volatile("movq %0, %%cr4" :: "r"(cr4));
+
+	if (use_xsave)
+	{
+		__asm__ volatile("xsetbv" ::
+				"c"(0), "a"((uint32_t)xstate_mask), "d"((uint32_t)(xstate_mask >> 32)));
+	}
+
+	Cpu* cpu = cpu_self();
+	cpu->fpu_owner = NULL;
+	cpu->fpu_live = 0;
+	cpu->kernel_fpu = 0;
+}
+
+/* #NM, the current process touched a vector register with CR0.TS set.
+ */
+static void fpu_trap(uint64_t vector, uint64_t code)
+{
+	UNUSED(vector);
+	UNUSED(code);
+
+	Cpu* cpu = cpu_self();
+	PCB* pcb = current_pcb;
+	ASSERT(!cpu->fpu_live && !cpu->kernel_fpu);
+
+	clts();
+	if (pcb->fpu == NULL)
+	{
+		// The same state as a freshly reset processor. XRSTOR takes
+		// the init state for everything missing from the header.
+		pcb->fpu = area_alloc();
+		*(uint16_t*)((uint8_t*)pcb->fpu + AREA_FCW) = FCW_DEFAULT;
+		*(uint32_t*)((uint8_t*)pcb->fpu + AREA_MXCSR) = MXCSR_DEFAULT;
+		restore(pcb->fpu);
+	}
+	else if (cpu->fpu_owner != pcb || pcb->fpu_cpu != cpu->id)
+	{
+		restore(pcb->fpu);
+	}
+
+	kprintf("FPU: %u loaded on %u\n", pcb->pid, cpu->id);
+	cpu->fpu_owner = pcb;
+	cpu->fpu_live = 1;
+	pcb->fpu_cpu = cpu->id;
+}
+
+void fpu_init()
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid_count(1, 0, &eax, &ebx, &ecx, &edx);
+	use_xsave = (ecx & CPUID_ECX_XSAVE) != 0;
+
+	if (use_xsave)
+	{
+		cpuid_count(CPUID_LEAF_XSAVE, 0, &eax, &ebx, &ecx, &edx);
+		const uint64_t supported = ((uint64_t)edx << 32) | eax;
+		xstate_mask = supported & XSTATE_USER;
+		if ((xstate_mask & XSTATE_AVX512) != XSTATE_AVX512)
+		{
+			xstate_mask &= ~(uint64_t)XSTATE_AVX512;
+		}
+	}
+
+	fpu_cpu_init();
+
+	if (use_xsave)
+	{
+		// Now that XCR0 is set, ebx is the size of what it turned on
+		cpuid_count(CPUID_LEAF_XSAVE, 0, &eax, &ebx, &ecx, &edx);
+		area_size = ebx;
+		if (area_size > PAGE_SMALL_SIZE)
+		{
+			panic("FPU: XSAVE area is bigger than a page");
+		}
+	}
+
+	kprintf("FPU: XSAVE %u, mask 0x%x, %u bytes\n", use_xsave, xstate_mask, area_size);
+	interrupts_install_isr(VEC_DEVICE_NOT_AVAILABLE, fpu_trap);
+}
+
+void fpu_switch(PCB* prev, PCB* next)
+{
+	UNUSED(next);
+
+	// The registers keep prev's state, and fpu_owner says so, in case
+	// it is the next one to use them here
+	Cpu* cpu = cpu_self();
+	ASSERT(!cpu->kernel_fpu);
+	if (cpu->fpu_live)
+	{
+		ASSERT(cpu->fpu_owner == prev);
+		save(prev->fpu);
+		stts();
+		cpu->fpu_live = 0;
+	}
+}
+
+void fpu_fork(PCB* parent, PCB* child)
+{
+	ASSERT(parent == current_pcb);
+
+	child->fpu = NULL;
+	child->fpu_cpu = FPU_NO_CPU;
+	if (parent->fpu == NULL)
+	{
+		return;
+	}
+
+	// The parent's latest state might only be in the registers
+	Cpu* cpu = cpu_self();
+	if (cpu->fpu_live)
+	{
+		save(parent->fpu);
+	}
+
+	child->fpu = area_alloc();
+	memcpy(child->fpu, parent->fpu, area_size);
+}
+
+void fpu_release(PCB* pcb)
+{
+	if (pcb->fpu == NULL)
+	{
+		return;
+	}
+
+	// The next PCB given this slot mustn't look like it's still loaded
+	for (uint32_t i = 0; i < MAX_CPUS; ++i)
+	{
+		if (cpus[i].fpu_owner == pcb)
+		{
+			cpus[i].fpu_owner = NULL;
+		}
+	}
+
+	phys_free_4KIB(VIRT_TO_PHYS(pcb->fpu));
+	pcb->fpu = NULL;
+}
+
+uint64_t fpu_xstate()
+{
+	return use_xsave ? xstate_mask : 0;
+}
+
+void kernel_fpu_begin()
+{
+	preempt_disable();
+
+	Cpu* cpu = cpu_self();
+	ASSERT(!cpu->kernel_fpu);
+	if (cpu->fpu_live)
+	{
+		save(current_pcb->fpu);
+		cpu->fpu_live = 0;
+	}
+
+	// The registers won't hold anyone's state afterwards, the next
+	// process to use them has to load its own
+	cpu->fpu_owner = NULL;
+	cpu->kernel_fpu = 1;
+	clts();
+}
+
+void kernel_fpu_end()
+{
+	Cpu* cpu = cpu_self();
+	ASSERT(cpu->kernel_fpu);
+	cpu->kernel_fpu = 0;
+	stts();
+
+	preempt_enable();
+}
@@ -0,0 +1,86 @@
+#ifndef __X86_64_FPU_FPU_H__
+#define __X86_64_FPU_FPU_H__
+
+#include "inttypes.h"
+#include "kernel/scheduler/pcb.h"
+
+/* x87, SSE and AVX state for user mode. The kernel itself is built
+ * without them.
+ *
+ * State is switched lazily. CR0.TS is set whenever a process is
+ * switched in, so the first vector instruction it runs traps with #NM.
+ * Only then is its state loaded, and its XSAVE area made if it never
+ * had one. A process that used them in its time slice has its state
+ * saved when it's switched out. Processes that never touch a vector
+ * register never pay for any of it.
+ *
+ * If a processor's registers still hold a process's state when it is
+ * switched back in, the trap doesn't bother loading it again.
+ *
+ * The kernel can borrow the registers between kernel_fpu_begin() and
+ * kernel_fpu_end(), see simd.h.
+ */
+
+#define CR0_MP 0x2
+#define CR0_EM 0x4
+#define CR0_TS 0x8
+#define CR0_NE 0x20
+
+#define CR4_OSFXSR     0x200
+#define CR4_OSXMMEXCPT 0x400
+#define CR4_OSXSAVE    0x40000
+
+// Parts of the state XSAVE knows about, in XCR0
+#define XSTATE_X87       0x1
+#define XSTATE_SSE       0x2
+#define XSTATE_AVX       0x4
+#define XSTATE_AVX512    0xE0 // Opmask, upper ZMM0-15 and ZMM16-31, all or nothing
+#define XSTATE_USER      (XSTATE_X87 | XSTATE_SSE | XSTATE_AVX | XSTATE_AVX512)
+
+// Where a PCB's state was last loaded before it has been loaded anywhere
+#define FPU_NO_CPU 0xFF
+
+#define VEC_DEVICE_NOT_AVAILABLE 7
+
+/* Find out what the processor supports, turn it on for this
+ * processor and install the #NM handler. Called once by the bootstrap
+ * processor after the IDT has been setup.
+ */
+void fpu_init(void);
+
+/* Turn on the vector registers on the other processors.
+ */
+void fpu_cpu_init(void);
+
+/* Save prev's state if it touched the vector registers, and make next
+ * trap the first time it does. Called by dispatch() before switching.
+ */
+void fpu_switch(PCB* prev, PCB* next);
+
+/* Give a forked child a copy of its parent's state.
+ *
+ * Parameters:
+ *    parent - The calling process, must be current_pcb
+ *    child - The new process, its fpu is overwritten
+ */
+void fpu_fork(PCB* parent, PCB* child);
+
+/* Free a PCB's XSAVE area. Called when the PCB is freed.
+ */
+void fpu_release(PCB* pcb);
+
+/* Returns:
+ *    The parts of the state turned on in XCR0, 0 without XSAVE
+ */
+uint64_t fpu_xstate(void);
+
+/* Let the kernel use the vector registers. The current process's
+ * state is saved first if it's in them. Preemption is disabled until
+ * kernel_fpu_end(), and nothing in between may block or be called
+ * from an interrupt handler. They don't nest.
+ */
+void kernel_fpu_begin(void);
+
+void kernel_fpu_end(void);
+
+#endif
@@ -0,0 +1,80 @@
+#include "simd.h"
+#include "fpu.h"
+
+#include "kernel/klib.h"
+
+#include "arch/x86_64/cpuid.h"
+#include "arch/x86_64/kprintf.h"
+
+#ifndef DEBUG_FPU
+#define kprintf(...)
+#endif
+
+// CPUID leaf 7
+#define CPUID_EBX_AVX2 0x20
+
+static void (*copy_impl)(void*, const void*, uint64_t) = NULL;
+static void (*clear_impl)(void*, uint64_t) = NULL;
+static void (*samples_impl)(uint16_t*, const uint8_t*, uint64_t) = NULL;
+
+void simd_init()
+{
+	// Every x86_64 processor has SSE2
+	copy_impl = page_copy_sse2;
+	clear_impl = page_clear_sse2;
+	samples_impl = samples_8_to_16_sse2;
+
+	// AVX2 also needs the upper halves of the registers turned on
+	uint32_t eax, ebx, ecx, edx;
+	cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+	if ((ebx & CPUID_EBX_AVX2) && (fpu_xstate() & XSTATE_AVX))
+	{
+		copy_impl = page_copy_avx2;
+		clear_impl = page_clear_avx2;
+		samples_impl = samples_8_to_16_avx2;
+	}
+
+	kprintf("SIMD: Using %s\n", copy_impl == page_copy_avx2 ? "AVX2" : "SSE2");
+}
+
+void page_copy(void* dst, const void* src, uint64_t size)
+{
+	if (copy_impl == NULL)
+	{
+		memcpy(dst, src, size);
+		return;
+	}
+
+	kernel_fpu_begin();
+	copy_impl(dst, src, size);
+	kernel_fpu_end();
+}
+
+void page_clear(void* dst, uint64_t size)
+{
+	if (clear_impl == NULL)
+	{
+		memclr(dst, size);
+		return;
+	}
+
+	kernel_fpu_begin();
+	clear_impl(dst, size);
+	kernel_fpu_end();
+}
+
+void samples_8_to_16(uint16_t* dst, const uint8_t* src, uint64_t count)
+{
+	if (samples_impl == NULL)
+	{
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			dst[i] = (uint16_t)src[i] << 8;
+		}
+		return;
+	}
+
+	kernel_fpu_begin();
+	samples_impl(dst, src, count);
+	kernel_fpu_end();
+}
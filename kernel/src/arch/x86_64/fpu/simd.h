@@ -0,0 +1,40 @@
+#ifndef __X86_64_FPU_SIMD_H__
+#define __X86_64_FPU_SIMD_H__
+
+#include "inttypes.h"
+
+/* Bulk loops that use the vector registers. The best version for the
+ * processor is picked by simd_init(), until then they fall back to
+ * the plain ones in klib.c. Each call is its own kernel_fpu_begin()
+ * and kernel_fpu_end(), so none of them may be used from an interrupt
+ * handler.
+ *
+ * The versions live in simd_sse2.c and simd_avx2.c, which are the only
+ * kernel files built with vector instructions turned on.
+ */
+
+/* Pick the versions to use. Called after fpu_init().
+ */
+void simd_init(void);
+
+/* Copy or clear whole pages. Everything must be 64 byte aligned, and
+ * size a multiple of 64.
+ */
+void page_copy(void* dst, const void* src, uint64_t size);
+void page_clear(void* dst, uint64_t size);
+
+/* Turn 8 bit samples into 16 bit ones, each sample in the high byte.
+ * Nothing has to be aligned.
+ */
+void samples_8_to_16(uint16_t* dst, const uint8_t* src, uint64_t count);
+
+// The versions, named after what they need
+void page_copy_sse2(void* dst, const void* src, uint64_t size);
+void page_clear_sse2(void* dst, uint64_t size);
+void samples_8_to_16_sse2(uint16_t* dst, const uint8_t* src, uint64_t count);
+
+void page_copy_avx2(void* dst, const void* src, uint64_t size);
+void page_clear_avx2(void* dst, uint64_t size);
+void samples_8_to_16_avx2(uint16_t* dst, const uint8_t* src, uint64_t count);
+
+#endif
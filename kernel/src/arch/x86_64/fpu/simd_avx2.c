@@ -0,0 +1,72 @@
+#include "simd.h"
+
+/* Built with AVX2 turned on, see the makefile. Only called through
+ * simd.c, and only if the processor has it.
+ */
+
+typedef long long v4di __attribute__((vector_size(32)));
+typedef uint8_t v32qi __attribute__((vector_size(32)));
+typedef uint8_t v16qi __attribute__((vector_size(16)));
+
+void page_copy_avx2(void* dst, const void* src, uint64_t size)
+{
+	v4di* d = (v4di*)dst;
+	const v4di* s = (const v4di*)src;
+
+	// Two at a time, a cache line per trip
+	for (uint64_t i = 0; i < size / sizeof(v4di); i += 2)
+	{
+		const v4di a = s[i];
+		const v4di b = s[i + 1];
+		d[i] = a;
+		d[i + 1] = b;
+	}
+
+	// Dirty upper halves make later SSE code slow
+	__builtin_ia32_vzeroupper();
+}
+
+void page_clear_avx2(void* dst, uint64_t size)
+{
+	v4di* d = (v4di*)dst;
+	const v4di zero = { 0, 0, 0, 0 };
+
+	for (uint64_t i = 0; i < size / sizeof(v4di); i += 2)
+	{
+		d[i] = zero;
+		d[i + 1] = zero;
+	}
+
+	__builtin_ia32_vzeroupper();
+}
+
+void samples_8_to_16_avx2(uint16_t* dst, const uint8_t* src, uint64_t count)
+{
+	const v32qi zero = { 0 };
+	const v32qi interleave =
+	{
+		0, 32, 1, 33, 2, 34, 3, 35, 4, 36, 5, 37, 6, 38, 7, 39,
+		8, 40, 9, 41, 10, 42, 11, 43, 12, 44, 13, 45, 14, 46, 15, 47
+	};
+
+	uint64_t i = 0;
+	for (; i + sizeof(v16qi) <= count; i += sizeof(v16qi))
+	{
+		// Sixteen samples become one register of output
+		v16qi in;
+		__builtin_memcpy(&in, src + i, sizeof(in));
+
+		v32qi wide = { 0 };
+		__builtin_memcpy(&wide, &in, sizeof(in));
+
+		const v32qi out = __builtin_shuffle(zero, wide, interleave);
+		__builtin_memcpy(dst + i, &out, sizeof(out));
+	}
+
+	for (; i < count; ++i)
+	{
+		dst[i] = (uint16_t)src[i] << 8;
+	}
+
+	__builtin_ia32_vzeroupper();
+}
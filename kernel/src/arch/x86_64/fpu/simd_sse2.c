@@ -0,0 +1,66 @@
+#include "simd.h"
+
+/* Built with SSE2 turned on, see the makefile. Only called through
+ * simd.c.
+ */
+
+typedef long long v2di __attribute__((vector_size(16)));
+typedef uint8_t v16qi __attribute__((vector_size(16)));
+
+void page_copy_sse2(void* dst, const void* src, uint64_t size)
+{
+	v2di* d = (v2di*)dst;
+	const v2di* s = (const v2di*)src;
+
+	// Four at a time, a cache line per trip
+	for (uint64_t i = 0; i < size / sizeof(v2di); i += 4)
+	{
+		const v2di a = s[i];
+		const v2di b = s[i + 1];
+		const v2di c = s[i + 2];
+		const v2di e = s[i + 3];
+		d[i] = a;
+		d[i + 1] = b;
+		d[i + 2] = c;
+		d[i + 3] = e;
+	}
+}
+
+void page_clear_sse2(void* dst, uint64_t size)
+{
+	v2di* d = (v2di*)dst;
+	const v2di zero = { 0, 0 };
+
+	for (uint64_t i = 0; i < size / sizeof(v2di); i += 4)
+	{
+		d[i] = zero;
+		d[i + 1] = zero;
+		d[i + 2] = zero;
+		d[i + 3] = zero;
+	}
+}
+
+void samples_8_to_16_sse2(uint16_t* dst, const uint8_t* src, uint64_t count)
+{
+	const v16qi zero = { 0 };
+	const v16qi low = { 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23 };
+	const v16qi high = { 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31 };
+
+	uint64_t i = 0;
+	for (; i + sizeof(v16qi) <= count; i += sizeof(v16qi))
+	{
+		v16qi in;
+		__builtin_memcpy(&in, src + i, sizeof(in));
+
+		// A zero low byte then the sample, punpcklbw and punpckhbw
+		const v16qi out_low = __builtin_shuffle(zero, in, low);
+		const v16qi out_high = __builtin_shuffle(zero, in, high);
+		__builtin_memcpy(dst + i, &out_low, sizeof(out_low));
+		__builtin_memcpy(dst + i + 8, &out_high, sizeof(out_high));
+	}
+
+	for (; i < count; ++i)
+	{
+		dst[i] = (uint16_t)src[i] << 8;
+	}
+}
@@ -6,6 +6,10 @@
 #include "arch/x86_64/cpuid.h"
 #include "arch/x86_64/panic.h"
 #include "arch/x86_64/kprintf.h"
+#include "arch/x86_64/smp/cpu.h"
+#include "kernel/timer/defs.h"
+#include "arch/x86_64/timer/tsc.h"
+#include "arch/x86_64/timer/hpet.h"
 
 #ifndef DEBUG_APIC
 //#define kprintf(...)
@@ -22,6 +26,15 @@
 #define CMD_SEL_CH2 0x80
 #define PC_SPEAKER 0x61
 
+// We will delay for 10ms
+// The PIT's frequency is 1.193182 MHz
+// Therefore:
+//  Value = 10ms / (1 / (1.193182MHz))
+//        = 11932 = 0x2E9C
+#define CALIBRATE_PIT_COUNT 0x2E9C
+#define CALIBRATE_PER_SEC 100
+#define CALIBRATE_RUNS 5
+
 #define APIC_BASE_MSR 0x1B
 #define APIC_EOI (0xB0/sizeof(uint32_t))
 #define APIC_VIRT_LOC 0xFFFFFFFFFFFFF000
@@ -41,12 +54,33 @@
 #define APIC_TIMER_INIT_REG (0x380/sizeof(uint32_t))
 #define APIC_TIMER_CUR_CNT (0x390/sizeof(uint32_t))
 
+// The timer LVT's mode, counting down is the default
+#define APIC_TIMER_TSC_DEADLINE 0x40000
+
+#define MSR_TSC_DEADLINE 0x6E0
+
+// CPUID leaf 1
+#define CPUID_ECX_TSC_DEADLINE 0x1000000
+
+// In TSC-deadline mode a timer tick is this many time stamp counter
+// cycles, about the same as the divide by 128 countdown
+#define DEADLINE_TICK_SHIFT 7
+
+// Some virtual machines give the local APIC a timer that doesn't count,
+// or barely does. Slower than this many ticks a millisecond it's no use.
+#define APIC_MIN_PER_MS 10
+
 #define APIC_DISABLE (0x10000)
 #define APIC_NMI (0x400)
 #define APIC_SOFT_EN (0x100)
 
 #define APIC_ESR (0x280/sizeof(uint32_t))
 
+#define APIC_ID_REG (0x20/sizeof(uint32_t))
+#define APIC_ICR_LOW (0x300/sizeof(uint32_t))
+#define APIC_ICR_HIGH (0x310/sizeof(uint32_t))
+#define APIC_ICR_PENDING 0x1000
+
 static uint8_t check_apic()
 {
 	// First check if we have a local APIC
@@ -126,28 +160,146 @@ static void pic_init()
 	_outb(PIC_SLAVE_IMR_PORT, 0x0);
 }
 
-static uint32_t tsc_per_sec = 0;
-static uint32_t timer_delay = 0;
+/* Start the PIT counting down from count on channel 2. Channel 2's
+ * output can be read back through the PC speaker port, so this works
+ * without any interrupts.
+ *
+ * Adapted from: http://wiki.osdev.org/APIC_timer
+ */
+static void pit_start(uint16_t count)
+{
+	_outb(PC_SPEAKER, (_inb(PC_SPEAKER) & 0xFD) | 1);
+	_outb(CMD_PORT, CMD_SEL_CH2 | CMD_HW_ONE_SHOT | CMD_LO_HI_BYTE);
+	_outb(CH2_DATA_PORT, count & 0xFF);
+	_outb(CH2_DATA_PORT, count >> 8);
+
+	const uint8_t tmp = _inb(PC_SPEAKER) & 0xFE;
+	_outb(PC_SPEAKER, tmp);
+	_outb(PC_SPEAKER, tmp|1);
+}
+
+static void pit_wait()
+{
+	while (!(_inb(PC_SPEAKER) & 0x20));
+}
+
+void apic_delay_us(uint32_t us)
+{
+	if (hpet_present())
+	{
+		hpet_delay_us(us);
+		return;
+	}
+
+	// The PIT's count is only 16 bits, about 54ms
+	while (us > 0)
+	{
+		const uint32_t chunk = us > 50000 ? 50000 : us;
+		const uint64_t count = ((uint64_t)chunk * TIMER_FREQ) / 1000000;
+		pit_start(count > 0 ? count : 1);
+		pit_wait();
+		us -= chunk;
+	}
+}
+
+// The bus clock is the same for every processor, so the bootstrap
+// processor's calibration is good for all of them. Counted after the
+// divide by 128, a fast bus clock overflowed 32 bits before it.
+static uint64_t apic_per_sec = 0;
+
+// The timer is armed with absolute time stamp counter values instead
+// of counting down. Elapsed time is read off the counter, so it's
+// exact however late the interrupt was handled.
+static uint8_t tsc_deadline = 0;
+
+static inline __attribute__((always_inline))
+void deadline_arm(uint64_t deadline)
+{
+	// The LVT write that picked this mode has to land first
+	__asm__ volatile("mfence" ::: "memory");
+	writemsr(MSR_TSC_DEADLINE, (uint32_t)deadline, (uint32_t)(deadline >> 32));
+}
+
+static uint64_t deadline_elapsed(void)
+{
+	const uint64_t ticks = (_rdtsc() - cpu_self()->timer_started) >> DEADLINE_TICK_SHIFT;
+	return ticks > 0xFFFFFFFF ? 0xFFFFFFFF : ticks;
+}
+
+// Without TSC-deadline mode or a working APIC timer, the HPET's
+// comparator 0 raises the timer interrupt. A timer tick is then a tick
+// of its main counter, and like TSC-deadline mode the deadlines are
+// absolute and elapsed time is read off the counter.
+static uint8_t hpet_timer = 0;
+
+// Comparator 0 comes through IRQ 0 of the PIC, not straight to the APIC
+static uint8_t hpet_legacy = 0;
+
+static uint64_t hpet_elapsed(void)
+{
+	const uint64_t ticks = hpet_since(cpu_self()->timer_started);
+	return ticks > 0xFFFFFFFF ? 0xFFFFFFFF : ticks;
+}
+
+uint8_t apic_timer_hpet()
+{
+	return hpet_timer;
+}
 
 time_t timer_one_ms()
 {
-	return tsc_per_sec / 1000 / 128;
+	if (tsc_deadline)
+	{
+		return (tsc_hz() >> DEADLINE_TICK_SHIFT) / 1000;
+	}
+
+	if (hpet_timer)
+	{
+		return FS_PER_SEC / 1000 / hpet_period_fs();
+	}
+
+	return apic_per_sec / 1000;
 }
 
 void timer_set_delay(uint32_t delay)
 {
-	timer_delay = delay;
+	cpu_self()->timer_delay = delay;
 }
 
 time_t timer_get_count()
 {
+	if (tsc_deadline || hpet_timer)
+	{
+		const uint64_t elapsed = tsc_deadline ? deadline_elapsed() : hpet_elapsed();
+		const uint32_t timer_delay = cpu_self()->timer_delay;
+		return elapsed >= timer_delay ? 0 : timer_delay - elapsed;
+	}
+
 	volatile uint32_t* lapic = (volatile uint32_t*)APIC_VIRT_LOC;
 	return lapic[APIC_TIMER_CUR_CNT];
 }
 
 time_t timer_get_elapsed()
 {
+	// Not capped at the delay, the time since the interrupt counts too
+	if (tsc_deadline)
+	{
+		Cpu* cpu = cpu_self();
+		const uint64_t elapsed = deadline_elapsed();
+		cpu->timer_counted = cpu->timer_started + (elapsed << DEADLINE_TICK_SHIFT);
+		return elapsed;
+	}
+
+	if (hpet_timer)
+	{
+		Cpu* cpu = cpu_self();
+		const uint64_t elapsed = hpet_elapsed();
+		cpu->timer_counted = cpu->timer_started + elapsed;
+		return elapsed;
+	}
+
 	volatile uint32_t* lapic = (volatile uint32_t*)APIC_VIRT_LOC;
+	const uint32_t timer_delay = cpu_self()->timer_delay;
 	const uint32_t count = lapic[APIC_TIMER_CUR_CNT];
 	if (count > timer_delay)
 	{
@@ -159,18 +311,66 @@ time_t timer_get_elapsed()
 
 void timer_start()
 {
+	Cpu* cpu = cpu_self();
+	if (tsc_deadline)
+	{
+		// Carry on from the last deadline rather than from now. The
+		// time since the elapsed count was read, and the part of a
+		// tick it left off, go towards the next one instead of being
+		// lost on every switch.
+		cpu->timer_started = cpu->timer_counted != 0 ? cpu->timer_counted : _rdtsc();
+		cpu->timer_counted = 0;
+		deadline_arm(cpu->timer_started + ((uint64_t)cpu->timer_delay << DEADLINE_TICK_SHIFT));
+		return;
+	}
+
+	if (hpet_timer)
+	{
+		// Carries on from the last count the same way
+		cpu->timer_started = cpu->timer_counted != 0 ? cpu->timer_counted : hpet_read();
+		cpu->timer_counted = 0;
+		hpet_oneshot_start(cpu->timer_started + cpu->timer_delay);
+		return;
+	}
+
 	volatile uint32_t* lapic = (volatile uint32_t*)APIC_VIRT_LOC;
-	lapic[APIC_TIMER_INIT_REG] = timer_delay;
+	lapic[APIC_TIMER_INIT_REG] = cpu->timer_delay;
 }
 
 void timer_resume()
 {
+	Cpu* cpu = cpu_self();
+	if (tsc_deadline)
+	{
+		// Same deadline as before, it's already absolute
+		deadline_arm(cpu->timer_started + ((uint64_t)cpu->timer_delay << DEADLINE_TICK_SHIFT));
+		return;
+	}
+
+	if (hpet_timer)
+	{
+		hpet_oneshot_start(cpu->timer_started + cpu->timer_delay);
+		return;
+	}
+
 	volatile uint32_t* lapic = (volatile uint32_t*)APIC_VIRT_LOC;
 	lapic[APIC_TIMER_INIT_REG] = lapic[APIC_TIMER_CUR_CNT];
 }
 
 void timer_stop()
 {
+	if (tsc_deadline)
+	{
+		deadline_arm(0);
+		return;
+	}
+
+	if (hpet_timer)
+	{
+		hpet_oneshot_stop();
+		return;
+	}
+
 	volatile uint32_t* lapic = (volatile uint32_t*)APIC_VIRT_LOC;
 	lapic[APIC_TIMER_INIT_REG] = 0;
 }
@@ -181,16 +381,142 @@ void apic_eoi(void)
 	lapic[APIC_EOI] = 0;
 }
 
+uint32_t apic_id(void)
+{
+	volatile uint32_t* lapic = (volatile uint32_t*)APIC_VIRT_LOC;
+	return lapic[APIC_ID_REG] >> 24;
+}
+
+void apic_send_ipi(uint32_t apic_id, uint32_t command)
+{
+	volatile uint32_t* lapic = (volatile uint32_t*)APIC_VIRT_LOC;
+
+	// An interrupt handler sending its own IPI halfway through
+	// would clobber the destination
+	const uint64_t flags = interrupts_save();
+
+	lapic[APIC_ICR_HIGH] = apic_id << 24;
+	lapic[APIC_ICR_LOW] = command;
+
+	// Wait for the local APIC to send it
+	while (lapic[APIC_ICR_LOW] & APIC_ICR_PENDING);
+
+	interrupts_restore(flags);
+}
+
 void timer_handler(uint64_t vector, uint64_t code)
 {
-	UNUSED(vector);
 	UNUSED(code);
 
 	extern void timer_interrupt(void);
 
+	// Acknowledge first, the scheduler might switch to another process
+	// and not come back here for a while
+	if (hpet_legacy)
+	{
+		pic_acknowledge(vector);
+	}
+	else
+	{
+		apic_eoi();
+	}
+
 	timer_interrupt();
+}
+
+static uint64_t median(uint64_t* values, uint32_t count)
+{
+	for (uint32_t i = 1; i < count; ++i)
+	{
+		const uint64_t value = values[i];
+		uint32_t j = i;
+		for (; j > 0 && values[j - 1] > value; --j)
+		{
+			values[j] = values[j - 1];
+		}
+		values[j] = value;
+	}
+
+	return values[count / 2];
+}
+
+/* Count how far the APIC timer and the time stamp counter get in
+ * 10ms, several times over. The HPET is the reference when there is
+ * one, its counter says exactly how long each run took. Otherwise it's
+ * the PIT. The medians are kept, so a run stretched by an SMI or a
+ * slow port read doesn't skew either.
+ */
+static void calibrate(uint64_t* apic_hz, uint64_t* tsc_hz)
+{
+	volatile uint32_t* apic_regs = (volatile uint32_t*)APIC_VIRT_LOC;
+	uint64_t apic_rates[CALIBRATE_RUNS];
+	uint64_t tsc_rates[CALIBRATE_RUNS];
+
+	const uint8_t use_hpet = hpet_present();
+	const uint64_t hpet_ticks = use_hpet ?
+		FS_PER_SEC / CALIBRATE_PER_SEC / hpet_period_fs() : 0;
+
+	for (uint32_t run = 0; run < CALIBRATE_RUNS; ++run)
+	{
+		uint64_t hpet_start = 0;
+		if (use_hpet)
+		{
+			hpet_start = hpet_read();
+		}
+		else
+		{
+			pit_start(CALIBRATE_PIT_COUNT);
+		}
+
+		apic_regs[APIC_TIMER_INIT_REG] = 0xFFFFFFFF;
+		const uint64_t tsc_start = _rdtsc();
+
+		// Wait until the PIT goes to 0, or the HPET has done 10ms
+		uint64_t elapsed_ns = NS_PER_SEC / CALIBRATE_PER_SEC;
+		if (use_hpet)
+		{
+			uint64_t ticks = 0;
+			while ((ticks = hpet_since(hpet_start)) < hpet_ticks);
+			elapsed_ns = ticks * hpet_period_fs() / (FS_PER_SEC / NS_PER_SEC);
+		}
+		else
+		{
+			pit_wait();
+		}
+		const uint64_t tsc_end = _rdtsc();
+
+		// Stop the APIC timer
+		const uint32_t count = apic_regs[APIC_TIMER_CUR_CNT];
+		apic_regs[APIC_TIMER_INIT_REG] = 0;
+
+		apic_rates[run] = (0xFFFFFFFF - count) * NS_PER_SEC / elapsed_ns;
+		tsc_rates[run] = (tsc_end - tsc_start) * NS_PER_SEC / elapsed_ns;
+#ifdef DEBUG_APIC
+		kprintf("Calibration %u: APIC %u - TSC %u\n", run, apic_rates[run], tsc_rates[run]);
+#endif
+	}
+
+	*apic_hz = median(apic_rates, CALIBRATE_RUNS);
+	*tsc_hz = median(tsc_rates, CALIBRATE_RUNS);
+}
+
+void apic_cpu_init()
+{
+	volatile uint32_t* apic_regs = (volatile uint32_t*)APIC_VIRT_LOC;
+
+	// Setup the APIC
+	apic_regs[APIC_TIMER_REG] = APIC_DISABLE;
+	apic_regs[APIC_PERF_CNT_REG] = APIC_NMI;
+	apic_regs[APIC_LINT0_REG] = APIC_DISABLE;
+	apic_regs[APIC_LINT1_REG] = APIC_DISABLE;
+	apic_regs[APIC_TPR] = 0;
+
+	// Enable the APIC
+	enable_apic();	
 
-	apic_eoi();
+	apic_regs[APIC_SPURIOUS_REG] = 39 | APIC_SOFT_EN;
+	apic_regs[APIC_TIMER_REG] = 32 | (tsc_deadline ? APIC_TIMER_TSC_DEADLINE : 0);
+	apic_regs[APIC_TIMER_DIV_REG] = 0xA; // Divide by 128
 }
 
 void apic_init()
@@ -236,59 +562,50 @@ void apic_init()
 	// Setup the APIC LVTs
 	kprintf("TIMER VEC: 0x%x \n", apic_regs[APIC_TIMER_REG]);
 
-	// Setup the APIC
-	apic_regs[APIC_TIMER_REG] = APIC_DISABLE;
-	apic_regs[APIC_PERF_CNT_REG] = APIC_NMI;
-	apic_regs[APIC_LINT0_REG] = APIC_DISABLE;
-	apic_regs[APIC_LINT1_REG] = APIC_DISABLE;
-	apic_regs[APIC_TPR] = 0;
-
-	// Enable the APIC
-	enable_apic();	
-
-	apic_regs[APIC_SPURIOUS_REG] = 39 | APIC_SOFT_EN;
-	apic_regs[APIC_TIMER_REG] = 32;
-	apic_regs[APIC_TIMER_DIV_REG] = 0xA; // Divide by 128
+	apic_cpu_init();
 
 	// In order to figure out how fast the APIC timer is we need a
-	// second reference. We'll use the old PIC timer for this
-
-	// Adapted from: http://wiki.osdev.org/APIC_timer
-	_outb(PC_SPEAKER, (_inb(PC_SPEAKER) & 0xFD) | 1);
-	_outb(CMD_PORT, CMD_SEL_CH2 | CMD_HW_ONE_SHOT | CMD_LO_HI_BYTE);
-	// We will delay for 10ms
-	// The PIT's frequency is 1.193182 MHz
-	// Therefore:
-	//  Value = 10ms / (1 / (1.193182MHz))
-	//        = 11932 = 0x2E9C
-	_outb(CH2_DATA_PORT, 0x9C);
-	_outb(CH2_DATA_PORT, 0x2E);
-
-	const uint8_t tmp = _inb(PC_SPEAKER) & 0xFE;
-	_outb(PC_SPEAKER, tmp);
-	_outb(PC_SPEAKER, tmp|1);
-
-	apic_regs[APIC_TIMER_INIT_REG] = 0xFFFFFFFF;
-
-	// Wait until the PIT goes to 0
-	while (!(_inb(PC_SPEAKER) & 0x20));
-	
-	// Stop the APIC timer
-	const uint32_t count = apic_regs[APIC_TIMER_CUR_CNT];
-	apic_regs[APIC_TIMER_INIT_REG] = 0;
-
-	kprintf("Timer Count: 0x%x\n", count);
-	const uint32_t diff = 0xFFFFFFFF - count;
-	tsc_per_sec = diff*100*128;
+	// second reference. We'll use the HPET, or the old PIT timer
+	// without one, and the time stamp counter gets measured over the
+	// same runs
+	hpet_init();
+
+	uint64_t tsc_per_sec;
+	calibrate(&apic_per_sec, &tsc_per_sec);
+	tsc_init(tsc_per_sec);
+
+	// Every processor is the same, the others pick the mode up in
+	// apic_cpu_init()
+	uint32_t eax, ebx, ecx, edx;
+	cpuid_count(0x1, 0, &eax, &ebx, &ecx, &edx);
+	if (ecx & CPUID_ECX_TSC_DEADLINE)
+	{
+		tsc_deadline = 1;
+		apic_regs[APIC_TIMER_REG] = 32 | APIC_TIMER_TSC_DEADLINE;
+	}
 #ifdef DEBUG_APIC
-	const uint32_t tps = tsc_per_sec / 128;
-
-	kprintf("Ticks per sec: %u - %u\n", tps, tsc_per_sec);
+	kprintf("Ticks per sec: %u\n", apic_per_sec);
 #endif
 
-	// Disable the PIC
+	// The HPET's comparator stands in for a timer that doesn't count
+	if (!tsc_deadline && apic_per_sec / 1000 < APIC_MIN_PER_MS)
+	{
+		const uint8_t route = hpet_oneshot_route();
+		if (route == HPET_ROUTE_NONE)
+		{
+			panic("The APIC timer doesn't count and there's no HPET to use\n");
+		}
+
+		kprintf("APIC timer unusable, the HPET raises the timer interrupt\n");
+		hpet_timer = 1;
+		hpet_legacy = route == HPET_ROUTE_LEGACY;
+		apic_regs[APIC_TIMER_REG] = APIC_DISABLE;
+	}
+
+	// Disable the PIC, but keep the keyboard interrupt on, and IRQ 0
+	// if that's how the HPET's comparator comes in
 	_outb(PIC_SLAVE_IMR_PORT, 0xFF);
-	_outb(PIC_MASTER_IMR_PORT, 0xFD); // But keep the keyboard interrupt on
+	_outb(PIC_MASTER_IMR_PORT, hpet_legacy ? 0xFC : 0xFD);
 	// Set the LINT0 line to take external interrupts
 	apic_regs[APIC_LINT0_REG] = 0x8700;	
 	
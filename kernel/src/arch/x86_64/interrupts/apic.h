@@ -13,8 +13,47 @@ typedef uint32_t time_t;
  */
 void apic_init(void);
 
+/* Setup the local APIC of the processor this runs on, the same way
+ * apic_init() did for the bootstrap processor. The timer is left
+ * stopped and external interrupts are only taken by the bootstrap
+ * processor.
+ */
+void apic_cpu_init(void);
+
 void apic_eoi(void);
 
+/* Returns:
+ *    The local APIC ID of the processor this runs on
+ */
+uint32_t apic_id(void);
+
+#define APIC_ICR_FIXED 0x4000   // Assert, fixed delivery, OR in the vector
+#define APIC_ICR_INIT 0x4500    // Assert, INIT
+#define APIC_ICR_STARTUP 0x4600 // Assert, start up, OR in the page number
+
+/* Send an interprocessor interrupt and wait for the local APIC to
+ * deliver it.
+ *
+ * Parameters:
+ *    apic_id - The local APIC ID of the processor to interrupt
+ *    command - What to send, one of the APIC_ICR_* values
+ */
+void apic_send_ipi(uint32_t apic_id, uint32_t command);
+
+/* Busy wait using the PIT. Only used before the scheduler is running.
+ *
+ * Parameters:
+ *    us - How many microseconds to wait
+ */
+void apic_delay_us(uint32_t us);
+
+/* Returns:
+ *    1 if the HPET's comparator raises the timer interrupt because the
+ *    APIC timer doesn't count. There's only the one comparator, so only
+ *    the bootstrap processor can have a timer.
+ */
+uint8_t apic_timer_hpet(void);
+
 void timer_set_delay(uint32_t delay);
 
 uint32_t timer_get_count(void);
@@ -27,4 +66,6 @@ void timer_start(void);
 
 void timer_stop(void);
 
+uint64_t timer_get_cycles(void);
+
 #endif
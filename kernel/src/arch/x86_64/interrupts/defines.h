@@ -6,11 +6,40 @@
 #define USER_CODE_SEG_64 0x30
 #define USER_DATA_SEG_64 0x40
 #define TSS_SEG_64  0x50
+#define CPU_NUMBER_SEG_64 0x60 // Only in the per processor GDTs, see tss.c
+
+// The stack segments SYSCALL and SYSRET load, they take them from the
+// slots next to the code segments in the GDT
+#define SYSCALL_STACK_SEG_64 0x18
+#define SYSRET_STACK_SEG_64 0x28
+
+#define MSR_EFER 0xC0000080
+#define MSR_STAR 0xC0000081
+#define MSR_LSTAR 0xC0000082
+#define MSR_SFMASK 0xC0000084
+#define EFER_SCE 0x1
 
 #define SP rsp
 #define IP rip
 #define BP rbp
 #define FLAGS rflags
+#define EFLAGS_IF 0x200
 #define DEFAULT_EFLAGS 0x202 // IF + reserved bit
 
+// Offsets the assembly code needs, checked in switch.c
+#define PCB_CONTEXT 0x0
+#define PCB_KERNEL_RSP 0x8
+#define CONTEXT_VECTOR 120
+#define CONTEXT_ERROR 128
+#define CONTEXT_RIP 136
+#define CONTEXT_CS 144
+#define CONTEXT_RFLAGS 152
+#define CONTEXT_RSP 160
+
+// Offsets into the Cpu the GS base points at, checked in smp.c
+#define CPU_SELF 0x0
+#define CPU_CURRENT 0x8
+#define CPU_USER_RSP 0x10
+#define CPU_KERNEL_STACK 0x18
+
 #endif
@@ -6,11 +6,16 @@
 #include "imports.h"
 
 #include "kernel/klib.h"
+#include "kernel/rcu/rcu.h"
 
 #include "arch/x86_64/panic.h"
+#include "arch/x86_64/cpuid.h"
 #include "arch/x86_64/kprintf.h"
 #include "arch/x86_64/virt_memory/physical.h"
 #include "arch/x86_64/virt_memory/paging.h"
+#include "arch/x86_64/smp/smp.h"
+#include "arch/x86_64/fpu/fpu.h"
+#include "arch/x86_64/fpu/simd.h"
 #include "kernel/scheduler/scheduler.h"
 #include "kernel/scheduler/pcb.h"
 
@@ -100,8 +105,6 @@ void dump_context(Context* context)
 
 static void default_handler(uint64_t vector, uint64_t code)
 {
-	extern PCB* current_pcb;
-
 	kprintf("Interrupt! vector: %u - Code: %u \n", vector, code);
 	uint64_t context_addr = (uint64_t)current_pcb->context;
 	Context* context = (Context*)context_addr;
@@ -142,14 +145,71 @@ static void spurious_handler(uint64_t vector, uint64_t code)
 
 void interrupts_install_isr(uint64_t index, void handler(uint64_t, uint64_t))
 {
-	isr_table[index] = handler;
+	// Read without the kernel lock for TLB shootdowns
+	rcu_assign_pointer(isr_table[index], handler);
+}
+
+// Called by isr_save in interrupts.S
+void interrupts_dispatch(uint64_t vector, uint64_t code)
+{
+	// Only the lookup is a read side critical section, handlers like
+	// the timer's can switch to another process
+	rcu_read_lock();
+	void (*const handler)(uint64_t, uint64_t) = rcu_dereference(isr_table[vector]);
+	rcu_read_unlock();
+
+	handler(vector, code);
 }
 
 // Used as a dummy pcb during kernel initialization
 static PCB init_pcb;
 
+typedef struct
+{
+	uint16_t limit;
+	uint64_t base;
+} __attribute__((packed)) IDT_Pointer;
+
+// Flags SYSCALL clears: IF, TF, DF, AC and NT
+#define SYSCALL_FLAGS_MASK 0x44700
+
+static void syscall_cpu_init(void)
+{
+	extern void syscall_entry(void);
+
+	uint32_t eax, edx;
+	readmsr(MSR_EFER, &eax, &edx);
+	writemsr(MSR_EFER, eax | EFER_SCE, edx);
+
+	// SYSCALL takes CS from the low selector and SS from the one after.
+	// SYSRET takes SS from 8 past the high one and CS from 16 past.
+	const uint32_t sysret_base = USER_CODE_SEG_64 - 16;
+	writemsr(MSR_STAR, 0, (sysret_base << 16) | CODE_SEG_64);
+
+	const uint64_t entry = (uint64_t)&syscall_entry;
+	writemsr(MSR_LSTAR, entry & 0xFFFFFFFF, entry >> 32);
+	writemsr(MSR_SFMASK, SYSCALL_FLAGS_MASK, 0);
+}
+
+void interrupts_cpu_init()
+{
+	syscall_cpu_init();
+	fpu_cpu_init();
+
+	// Every processor shares the same IDT
+	IDT_Pointer pointer;
+	pointer.limit = sizeof(IDT_Gate)*256 - 1;
+	pointer.base = (uint64_t)idt;
+
+	__asm__ volatile("lidt %0" :: "m"(pointer));
+}
+
 void interrupts_init()
 {
+	// current_pcb lives in the per-CPU data, which has to be there
+	// before anything can look at it
+	smp_bsp_init();
+
 	// Create a dummy process in case we receive an exception during the rest of kernel
 	// initialization. The interrupts won't work unless we have something in current_pcb
 	memclr(&init_pcb, sizeof(PCB));
@@ -158,7 +218,8 @@ void interrupts_init()
 
 	idt = PHYS_TO_VIRT(&start_idt_64[0]);
 
-	setup_tss_descriptor();
+	setup_tss_descriptor(0);
+	syscall_cpu_init();
 
 	extern interrupt_handler isr_stub_table[256];
 
@@ -170,6 +231,8 @@ void interrupts_init()
 
 	interrupts_install_isr(36, serial_handler);
 	interrupts_install_isr(39, spurious_handler);
+	fpu_init();
+	simd_init();
 
 	// Initialize the APIC
 	apic_init();
@@ -3,9 +3,14 @@
 
 #include "inttypes.h"
 #include "arch/x86_64/support.h"
+#include "arch/x86_64/interrupts/defines.h"
 
 void interrupts_init(void);
 
+/* Load the IDT on a processor other than the bootstrap one.
+ */
+void interrupts_cpu_init(void);
+
 #define PIC_MASTER_CMD_PORT 0x20
 #define PIC_MASTER_IMR_PORT 0x21
 #define PIC_SLAVE_CMD_PORT 0xA0
@@ -18,9 +23,78 @@ void interrupts_init(void);
 #define PIC_EOI 0x20
 
 #define VEC_TIMER 0x20
+#define VEC_RESCHEDULE 0xFD
+#define VEC_TLB_SHOOTDOWN 0xFE
 
 void interrupts_install_isr(uint64_t index, void handler(uint64_t, uint64_t));
 
+#ifdef BIKESHED_SIM
+// The host simulator provides its own versions
+void interrupts_enable(void);
+void interrupts_disable(void);
+void interrupts_window(void);
+void interrupts_halt(void);
+uint64_t interrupts_save(void);
+void interrupts_restore(uint64_t flags);
+#else
+static inline __attribute__((always_inline))
+void interrupts_enable(void)
+{
+	__asm__ volatile("sti" ::: "memory");
+}
+
+static inline __attribute__((always_inline))
+void interrupts_disable(void)
+{
+	__asm__ volatile("cli" ::: "memory");
+}
+
+/* Briefly enable interrupts so any pending ones get handled. The
+ * nop is needed because sti only takes effect after the next
+ * instruction.
+ */
+static inline __attribute__((always_inline))
+void interrupts_window(void)
+{
+	__asm__ volatile("sti; nop; cli" ::: "memory");
+}
+
+/* Enable interrupts and wait for the next one. Nothing can sneak in
+ * between the two instructions, so a pending interrupt always ends
+ * the wait.
+ */
+static inline __attribute__((always_inline))
+void interrupts_halt(void)
+{
+	__asm__ volatile("sti; hlt" ::: "memory");
+}
+
+/* Disable interrupts, remembering whether they were enabled.
+ *
+ * Returns:
+ *    The flags to give interrupts_restore()
+ */
+static inline __attribute__((always_inline))
+uint64_t interrupts_save(void)
+{
+	uint64_t flags;
+	__asm__ volatile("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
+	return flags;
+}
+
+/* Enable interrupts again if they were enabled before the matching
+ * interrupts_save().
+ */
+static inline __attribute__((always_inline))
+void interrupts_restore(uint64_t flags)
+{
+	if (flags & EFLAGS_IF)
+	{
+		interrupts_enable();
+	}
+}
+#endif
+
 static inline __attribute__((always_inline))
 void pic_acknowledge(const uint64_t vector)
 {
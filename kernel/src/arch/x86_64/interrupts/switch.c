@@ -0,0 +1,89 @@
+#include "switch.h"
+
+#include "safety.h"
+#include "kernel/klib.h"
+#include "kernel/virt_memory/defs.h"
+
+#include "arch/x86_64/cpuid.h"
+#include "arch/x86_64/virt_memory/paging.h"
+
+COMPILE_ASSERT(__builtin_offsetof(PCB, context) == PCB_CONTEXT);
+COMPILE_ASSERT(__builtin_offsetof(PCB, kernel_rsp) == PCB_KERNEL_RSP);
+COMPILE_ASSERT(__builtin_offsetof(Context, vector) == CONTEXT_VECTOR);
+COMPILE_ASSERT(__builtin_offsetof(Context, error_code) == CONTEXT_ERROR);
+COMPILE_ASSERT(__builtin_offsetof(Context, rip) == CONTEXT_RIP);
+COMPILE_ASSERT(__builtin_offsetof(Context, cs) == CONTEXT_CS);
+COMPILE_ASSERT(__builtin_offsetof(Context, rflags) == CONTEXT_RFLAGS);
+COMPILE_ASSERT(__builtin_offsetof(Context, rsp) == CONTEXT_RSP);
+
+// The Context has to leave the stack 16 byte aligned for the handlers
+COMPILE_ASSERT(sizeof(Context) % 16 == 0);
+
+#define SLOT_SIZE (KERNEL_STACK_SIZE + KERNEL_STACK_GUARD)
+
+// Defined in context_switch.S
+extern void task_entry(void);
+
+// 1024 slots, one bit each
+static uint64_t mapped_slots[16];
+
+uint64_t kernel_stack_get(uint64_t slot)
+{
+	ASSERT(slot < sizeof(mapped_slots)*8);
+
+	const uint64_t bottom = KERNEL_STACK_REGION + slot*SLOT_SIZE + KERNEL_STACK_GUARD;
+	const uint64_t top = bottom + KERNEL_STACK_SIZE;
+
+	if ((mapped_slots[slot / 64] & (1UL << (slot % 64))) == 0)
+	{
+		for (uint64_t page = bottom; page < top; page += PAGE_SMALL_SIZE)
+		{
+			if (!virt_map_page(kernel_table, page, PG_FLAG_RW, PAGE_SMALL, NULL))
+			{
+				panic("Kernel stack: Out of memory");
+			}
+		}
+
+		mapped_slots[slot / 64] |= 1UL << (slot % 64);
+	}
+
+	return top;
+}
+
+void kernel_stack_prepare(PCB* pcb, void (*entry)(void))
+{
+	ASSERT((uint64_t)pcb->context == pcb->kernel_stack - sizeof(Context));
+
+	// What switch_to() pops, right underneath the Context:
+	// r15, r14, r13, r12, rbp, rbx and the return address.
+	// task_entry calls whatever is in rbx.
+	uint64_t* frame = (uint64_t*)pcb->context - 7;
+	memclr(frame, 5*sizeof(uint64_t));
+	frame[5] = (uint64_t)entry;
+	frame[6] = (uint64_t)task_entry;
+
+	pcb->kernel_rsp = (uint64_t)frame;
+}
+
+void kernel_thread_prepare(PCB* pcb, void (*start)(kthread_fn, void*),
+		kthread_fn fn, void* arg)
+{
+	Context* context = pcb->context;
+	memclr(context, sizeof(Context));
+
+	// Leave room for a return address, start() never uses it
+	context->IP = (uint64_t)start;
+	context->SP = (uint64_t)context - sizeof(uint64_t);
+	context->FLAGS = DEFAULT_EFLAGS;
+	context->cs = CODE_SEG_64;
+	context->ss = DATA_SEG_64;
+	context->rdi = (uint64_t)fn;
+	context->rsi = (uint64_t)arg;
+
+	kernel_stack_prepare(pcb, NULL);
+}
+
+void fs_base_set(uint64_t base)
+{
+	writemsr(MSR_FS_BASE, base & 0xFFFFFFFF, base >> 32);
+}
@@ -0,0 +1,75 @@
+#ifndef __X86_64_INTERRUPTS_SWITCH_H__
+#define __X86_64_INTERRUPTS_SWITCH_H__
+
+#include "inttypes.h"
+#include "kernel/scheduler/pcb.h"
+#include "kernel/scheduler/kthread.h"
+
+/* Every PCB gets its own kernel stack. Interrupts and system calls
+ * from user mode land on it (through the TSS), with the user's Context
+ * sitting at the very top. Switching processes is just switching
+ * kernel stacks.
+ *
+ * The stacks live in the kernel's half of the address space, so they
+ * are mapped in every process. Each PCB slot has a fixed stack, with
+ * an unmapped guard page underneath it to catch overflows. Stacks are
+ * mapped the first time their slot is used and kept after that.
+ */
+
+#define KERNEL_STACK_REGION 0xFFFFFFFF80000000
+#define KERNEL_STACK_SIZE 0x4000
+#define KERNEL_STACK_GUARD PAGE_SMALL_SIZE
+
+#define MSR_FS_BASE 0xC0000100
+
+/* Get the kernel stack for a PCB slot, mapping it if needed.
+ *
+ * Parameters:
+ *    slot - The PCB's slot number
+ *
+ * Returns:
+ *    The address of the top of the stack
+ */
+uint64_t kernel_stack_get(uint64_t slot);
+
+/* Setup a PCB's kernel stack so the first switch_to() into it runs
+ * entry() and then returns to user mode using the PCB's Context.
+ *
+ * Parameters:
+ *    pcb - The new PCB, its kernel_stack and context must be setup
+ *    entry - Called before returning to user mode for the first time,
+ *            may be NULL
+ */
+void kernel_stack_prepare(PCB* pcb, void (*entry)(void));
+
+/* Setup a PCB's Context and kernel stack to run start(fn, arg) in
+ * ring 0 with interrupts enabled. The thread's stack is whatever is
+ * left of its kernel stack below the Context.
+ *
+ * Parameters:
+ *    pcb - The new PCB, its kernel_stack and context must be setup
+ *    start - Where the thread starts, must never return
+ *    fn - First argument to start
+ *    arg - Second argument to start
+ */
+void kernel_thread_prepare(PCB* pcb, void (*start)(kthread_fn, void*),
+		kthread_fn fn, void* arg);
+
+/* Load the FS segment base used for thread local storage.
+ *
+ * Parameters:
+ *    base - The new base address
+ */
+void fs_base_set(uint64_t base);
+
+/* Save the callee saved registers on prev's kernel stack and continue
+ * running on next's. Returns when something switches back to prev.
+ * The caller is responsible for the page table and the TSS.
+ *
+ * Parameters:
+ *    prev - The PCB that is running now
+ *    next - The PCB to run
+ */
+void switch_to(PCB* prev, PCB* next);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "safety.h"
 #include "kernel/klib.h" // memclr
+#include "arch/x86_64/smp/cpu.h"
 #include "arch/x86_64/virt_memory/physical.h"
 
 typedef struct
@@ -31,7 +32,20 @@ typedef struct
 
 COMPILE_ASSERT(sizeof(TSS) == 104);
 
-static TSS kernel_TSS;
+// Every processor has its own TSS, and its own copy of the GDT to
+// describe it. ltr marks the descriptor busy, so they can't share one.
+static TSS kernel_TSS[MAX_CPUS];
+
+#define BOOT_GDT_SIZE (TSS_SEG_64 + sizeof(TSS_Descriptor))
+#define GDT_SIZE (CPU_NUMBER_SEG_64 + sizeof(uint64_t))
+
+static uint8_t cpu_gdt[MAX_CPUS][GDT_SIZE] __attribute__((aligned(16)));
+
+typedef struct
+{
+	uint16_t limit;
+	uint64_t base;
+} __attribute__((packed)) GDT_Pointer;
 
 #define TSS_DESC_DPL0 (0x00 << 1)
 #define TSS_DESC_DPL1 (0x01 << 1)
@@ -41,17 +55,25 @@ static TSS kernel_TSS;
 #define TSS_DESC_P 0x80
 #define TSS_DESC_TYPE_AVAIL 0x9
 
-extern TSS_Descriptor tss_seg_64;
-TSS_Descriptor* tss;
+extern uint8_t start_gdt_64[BOOT_GDT_SIZE];
+
+// A user mode data segment that is never loaded, its limit is the
+// processor's id so lsl can tell user mode where it is running
+#define CPU_NUMBER_DESC(ID) \
+	(((uint64_t)(ID) & 0xFFFF) | ((uint64_t)0xF0 << 40))
 
 static
-void setup_kernel_tss()
+void setup_kernel_tss(uint32_t cpu)
 {
+	// Start from the boot GDT, only the TSS descriptor is different
+	memcpy(cpu_gdt[cpu], PHYS_TO_VIRT(start_gdt_64), BOOT_GDT_SIZE);
+	*(uint64_t*)&cpu_gdt[cpu][CPU_NUMBER_SEG_64] = CPU_NUMBER_DESC(cpu);
+
 	// Setup the kernel TSS
-	const uint64_t tss_base = (uint64_t)&kernel_TSS;
+	const uint64_t tss_base = (uint64_t)&kernel_TSS[cpu];
 	const uint64_t tss_limit = sizeof(TSS);
 
-	tss = PHYS_TO_VIRT(&tss_seg_64);
+	TSS_Descriptor* tss = (TSS_Descriptor*)&cpu_gdt[cpu][TSS_SEG_64];
 
 	tss->limit = tss_limit & 0xFF;
 	tss->base1 = tss_base & 0xFFFF;
@@ -62,20 +84,30 @@ void setup_kernel_tss()
 	tss->base4 = (tss_base & 0xFFFFFFFF00000000) >> 32;
 	tss->reserved = 0;
 
-	memclr(&kernel_TSS, sizeof(kernel_TSS));
-	kernel_TSS.io_map_base = 104;
-	kernel_TSS.rsp[0] = KERNEL_STACK_LOCATION;
-	kernel_TSS.ist[0] = KERNEL_STACK_LOCATION;
+	memclr(&kernel_TSS[cpu], sizeof(TSS));
+	kernel_TSS[cpu].io_map_base = 104;
+	kernel_TSS[cpu].rsp[0] = KERNEL_STACK_LOCATION;
+	cpus[cpu].kernel_stack = KERNEL_STACK_LOCATION;
+	kernel_TSS[cpu].ist[0] = KERNEL_STACK_LOCATION;
 }
 
 void tss_set_context_stack(const uint64_t location)
 {
-	kernel_TSS.rsp[0] = location;
+	kernel_TSS[smp_cpu_id()].rsp[0] = location;
+	cpu_self()->kernel_stack = location;
 }
 
-void setup_tss_descriptor()
+void setup_tss_descriptor(uint32_t cpu)
 {
-	setup_kernel_tss();
+	ASSERT(cpu < MAX_CPUS);
+	setup_kernel_tss(cpu);
+
+	// The segments are at the same place as in the boot GDT, so the
+	// segment registers don't have to be reloaded
+	GDT_Pointer pointer;
+	pointer.limit = GDT_SIZE - 1;
+	pointer.base = (uint64_t)cpu_gdt[cpu];
+	__asm__ volatile("lgdt %0" :: "m"(pointer));
 
 	// Load this new TSS
 	__asm__ volatile ("movw $" SX(TSS_SEG_64)  ", %ax");
@@ -4,8 +4,18 @@
 #include "defines.h"
 #include "inttypes.h"
 
-void setup_tss_descriptor(void);
+/* Give a processor its own GDT and TSS, and load them.
+ *
+ * Parameters:
+ *    cpu - The processor's index into cpus[]
+ */
+void setup_tss_descriptor(uint32_t cpu);
 
+/* Set where interrupts from user mode land on this processor.
+ *
+ * Parameters:
+ *    location - The top of the running process's kernel stack
+ */
 void tss_set_context_stack(const uint64_t location);
 
 #endif
@@ -6,6 +6,14 @@
 #include "arch/x86_64/interrupts/apic.h"
 #include "arch/x86_64/interrupts/interrupts.h"
 
+#include "kernel/interrupts/softirq.h"
+#include "kernel/scheduler/workqueue.h"
+#include "kernel/scheduler/waitqueue.h"
+#include "kernel/scheduler/scheduler.h"
+#include "kernel/scheduler/thread.h"
+#include "kernel/scheduler/events.h"
+#include "kernel/vdso/vdso.h"
+
 static uint8_t scan_code_table[2][128] =
 {
 	{
@@ -52,6 +60,24 @@ static uint32_t next_index = 0;
 static uint32_t last_index = 0;
 static uint32_t buffer_size = 0;
 
+// Characters ever buffered, for the vdso snapshot
+static uint32_t keys_in = 0;
+
+// Processes blocked in keyboard_read_char()
+static WaitQueue readers;
+
+// Scan codes the interrupt handler hasn't decoded yet
+#define SCAN_BUFFER_SIZE 16
+static uint8_t scan_buffer[SCAN_BUFFER_SIZE];
+static uint32_t scan_next = 0;
+static uint32_t scan_last = 0;
+
+// Lets key_available() skip the system call
+static void publish_keys(void)
+{
+	vdso_set_keys(keys_in, keys_in - buffer_size);
+}
+
 uint8_t keyboard_char_available()
 {
 	return buffer_size > 0;
@@ -66,6 +92,7 @@ uint8_t keyboard_get_char()
 
 	uint8_t val = buffer[last_index];
 	--buffer_size;
+	publish_keys();
 	++last_index;
 	if (last_index >= BUFFER_SIZE)
 	{
@@ -75,6 +102,36 @@ uint8_t keyboard_get_char()
 	return val;
 }
 
+uint8_t keyboard_read_char()
+{
+	// Another reader can take the character before we run
+	while (!keyboard_char_available())
+	{
+		// The process is going, see thread_exit_group()
+		if (thread_exiting(current_pcb))
+		{
+			return 0;
+		}
+
+		wait_queue_wait(&readers, 0);
+	}
+
+	return keyboard_get_char();
+}
+
+static
+void scroll_work(void* arg)
+{
+	if ((uint64_t)arg == '1')
+	{
+		page_up();
+	}
+	else
+	{
+		page_down();
+	}
+}
+
 static
 void check_scan_code(uint8_t code)
 {
@@ -106,6 +163,7 @@ void check_scan_code(uint8_t code)
 				{
 					buffer[next_index] = code;
 					++buffer_size;
+					++keys_in;
 
 					++next_index;
 					if (next_index >= BUFFER_SIZE)
@@ -117,14 +175,20 @@ void check_scan_code(uint8_t code)
 						}
 					}
 
-					// For debugging, will be removed
-					if (code == '1')
-					{
-						page_up();
-					}
-					else if (code == '2')
+					// One character only needs one reader
+					interrupts_disable();
+					publish_keys();
+					wait_queue_wake_one(&readers);
+					events_raise(EVENT_KEYBOARD, EVENT_ANYONE);
+					interrupts_enable();
+
+					// For debugging, will be removed. Repainting the
+					// screen is slow, so it's left to the work queue.
+					if (code == '1' || code == '2')
 					{
-						page_down();
+						interrupts_disable();
+						queue_work(scroll_work, (void*)(uint64_t)code);
+						interrupts_enable();
 					}
 
 				}
@@ -146,14 +210,43 @@ void keyboard_handler(uint64_t vector, uint64_t code)
 
 	//kprintf("KEY\n");
 
-	uint8_t scan_code = _inb(KEYBOARD_DATA);
-	check_scan_code(scan_code);
+	// Just grab the scan code, it's decoded in keyboard_softirq().
+	// If the softirq falls behind the oldest scan codes are lost.
+	scan_buffer[scan_next] = _inb(KEYBOARD_DATA);
+	scan_next = (scan_next + 1) % SCAN_BUFFER_SIZE;
+	if (scan_next == scan_last)
+	{
+		scan_last = (scan_last + 1) % SCAN_BUFFER_SIZE;
+	}
+	softirq_raise(SOFTIRQ_KEYBOARD);
 
 //	apic_eoi();
 	pic_acknowledge(vector);
 }
 
+static
+void keyboard_softirq()
+{
+	while (1)
+	{
+		interrupts_disable();
+		if (scan_last == scan_next)
+		{
+			interrupts_enable();
+			break;
+		}
+
+		const uint8_t scan_code = scan_buffer[scan_last];
+		scan_last = (scan_last + 1) % SCAN_BUFFER_SIZE;
+		interrupts_enable();
+
+		check_scan_code(scan_code);
+	}
+}
+
 void keyboard_init()
 {
+	wait_queue_init(&readers);
+	softirq_register(SOFTIRQ_KEYBOARD, keyboard_softirq);
 	interrupts_install_isr(33, keyboard_handler);
 }
@@ -13,6 +13,17 @@ static int64_t  convert_radix(char buf[static BUFFER_LEN], uint8_t radix, uint64
 static int64_t  convert_decimal(char buf[static BUFFER_LEN], int64_t value);
 static uint64_t string_length(const char* str);
 
+static void console_char(char c)
+{
+#ifdef QEMU
+	serial_char(c);
+#endif
+	text_mode_char(c);
+}
+
+// Where the formatted output goes
+static void (*write_char)(char c) = console_char;
+
 void kprintf(const char* format, ...)
 {
 	va_list ap;
@@ -21,12 +32,14 @@ void kprintf(const char* format, ...)
 	va_end(ap);
 }
 
-static void write_char(char c)
+void serial_printf(const char* format, ...)
 {
-#ifdef QEMU
-	serial_char(c);
-#endif
-	text_mode_char(c);
+	va_list ap;
+	va_start(ap, format);
+	write_char = serial_char;
+	_kprintf(format, ap);
+	write_char = console_char;
+	va_end(ap);
 }
 
 static void _kprintf(const char* fmt, va_list ap)
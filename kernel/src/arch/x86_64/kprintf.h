@@ -24,4 +24,9 @@
  */
 void kprintf(const char* format, ...);
 
+/* Same as kprintf() except the output only goes to the serial port,
+ * useful for dumping large amounts of debugging information.
+ */
+void serial_printf(const char* format, ...);
+
 #endif
@@ -32,8 +32,15 @@ code_seg_64:
 	.byte 0b10011000 # DPL 0
 	.byte 0b00100000
 	.byte 0
-	# Align to 16-bytes
-	.quad 0
+
+# SYSCALL loads SS with the selector after the kernel code segment
+syscall_stack_seg_64:
+	.hword 0xFFFF
+	.hword 0
+	.byte 0
+	.byte 0b10010010 # DPL 0
+	.byte 0b00000000
+	.byte 0
 
 data_seg_64:
 	.hword 0xFFFF
@@ -42,8 +49,15 @@ data_seg_64:
 	.byte 0b10010010 # DPL 0
 	.byte 0b00000000
 	.byte 0
-	# Align to 16 bytes
-	.quad 0
+
+# SYSRET loads SS with the selector before the user code segment
+sysret_stack_seg_64:
+	.hword 0xFFFF
+	.hword 0
+	.byte 0
+	.byte 0b11110010 # DPL 3
+	.byte 0b00000000
+	.byte 0
 
 user_code_seg_64:
 	.hword 0
@@ -0,0 +1,277 @@
+#include "acpi.h"
+
+#include "safety.h"
+#include "kernel/virt_memory/defs.h"
+#include "arch/x86_64/kprintf.h"
+#include "arch/x86_64/virt_memory/physical.h"
+
+#ifndef DEBUG_ACPI
+#define kprintf(...)
+#endif
+
+#define EBDA_SEGMENT 0x40E
+#define BIOS_AREA_START 0xE0000
+#define BIOS_AREA_END 0x100000
+
+#define MADT_LOCAL_APIC 0
+#define MADT_LAPIC_ENABLED 0x1
+
+// Generic address structure, the registers are memory mapped
+#define ACPI_SPACE_MEMORY 0
+
+typedef struct
+{
+	char signature[8];
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t revision;
+	uint32_t rsdt_address;
+
+	// Revision 2 and up
+	uint32_t length;
+	uint64_t xsdt_address;
+	uint8_t extended_checksum;
+	uint8_t reserved[3];
+} __attribute__((packed)) RSDP;
+
+COMPILE_ASSERT(sizeof(RSDP) == 36);
+
+typedef struct
+{
+	char signature[4];
+	uint32_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__((packed)) SDT_Header;
+
+COMPILE_ASSERT(sizeof(SDT_Header) == 36);
+
+typedef struct
+{
+	SDT_Header header;
+	uint32_t lapic_address;
+	uint32_t flags;
+} __attribute__((packed)) MADT;
+
+typedef struct
+{
+	uint8_t type;
+	uint8_t length;
+} __attribute__((packed)) MADT_Entry;
+
+typedef struct
+{
+	MADT_Entry entry;
+	uint8_t processor_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __attribute__((packed)) MADT_LocalAPIC;
+
+typedef struct
+{
+	SDT_Header header;
+	uint32_t event_timer_block_id;
+
+	// Where the registers are
+	uint8_t space_id;
+	uint8_t bit_width;
+	uint8_t bit_offset;
+	uint8_t access_size;
+	uint64_t address;
+
+	uint8_t hpet_number;
+	uint16_t min_tick;
+	uint8_t page_protection;
+} __attribute__((packed)) HPET_Table;
+
+COMPILE_ASSERT(sizeof(HPET_Table) == 56);
+
+/* Get a kernel address for a table, making sure all of it is mapped.
+ * The tables are usually near the top of RAM, but nothing says they
+ * have to be.
+ */
+static const void* acpi_map(uint64_t phys, uint64_t length)
+{
+	const uint64_t virt = (uint64_t)PHYS_TO_VIRT(phys);
+	uint64_t unused;
+	if (!virt_lookup_phys(kernel_table, virt, &unused) ||
+		!virt_lookup_phys(kernel_table, virt + length - 1, &unused))
+	{
+		kprintf("ACPI: 0x%x isn't mapped\n", phys);
+		return NULL;
+	}
+
+	return (const void*)virt;
+}
+
+static uint8_t checksum_ok(const void* table, uint64_t length)
+{
+	const uint8_t* bytes = (const uint8_t*)table;
+	uint8_t sum = 0;
+	for (uint64_t i = 0; i < length; ++i)
+	{
+		sum += bytes[i];
+	}
+
+	return sum == 0;
+}
+
+static uint8_t signature_is(const char* signature, const char* expected, uint64_t length)
+{
+	for (uint64_t i = 0; i < length; ++i)
+	{
+		if (signature[i] != expected[i])
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static const RSDP* find_rsdp_in(uint64_t start, uint64_t end)
+{
+	// Always on a 16 byte boundary
+	for (uint64_t phys = start; phys + 20 <= end; phys += 16)
+	{
+		const RSDP* rsdp = (const RSDP*)PHYS_TO_VIRT(phys);
+		if (signature_is(rsdp->signature, "RSD PTR ", 8) && checksum_ok(rsdp, 20))
+		{
+			return rsdp;
+		}
+	}
+
+	return NULL;
+}
+
+static const RSDP* find_rsdp()
+{
+	// The first KiB of the EBDA, its segment is kept in the BIOS data area
+	const uint64_t ebda = (uint64_t)(*(const uint16_t*)PHYS_TO_VIRT(EBDA_SEGMENT)) << 4;
+	if (ebda != 0)
+	{
+		const RSDP* rsdp = find_rsdp_in(ebda, ebda + 1024);
+		if (rsdp != NULL)
+		{
+			return rsdp;
+		}
+	}
+
+	return find_rsdp_in(BIOS_AREA_START, BIOS_AREA_END);
+}
+
+static const SDT_Header* map_table(uint64_t phys)
+{
+	const SDT_Header* header = (const SDT_Header*)acpi_map(phys, sizeof(SDT_Header));
+	if (header == NULL || acpi_map(phys, header->length) == NULL)
+	{
+		return NULL;
+	}
+
+	if (!checksum_ok(header, header->length))
+	{
+		kprintf("ACPI: Bad checksum for 0x%x\n", phys);
+		return NULL;
+	}
+
+	return header;
+}
+
+static const SDT_Header* find_table(const char* signature)
+{
+	const RSDP* rsdp = find_rsdp();
+	if (rsdp == NULL)
+	{
+		kprintf("ACPI: No RSDP\n");
+		return NULL;
+	}
+
+	// The XSDT has 8 byte entries, the RSDT has 4 byte ones
+	const uint8_t extended = rsdp->revision >= 2 && rsdp->xsdt_address != 0;
+	const SDT_Header* root = map_table(extended ? rsdp->xsdt_address : rsdp->rsdt_address);
+	if (root == NULL)
+	{
+		return NULL;
+	}
+
+	const uint64_t entry_size = extended ? 8 : 4;
+	const uint64_t num_entries = (root->length - sizeof(SDT_Header)) / entry_size;
+	const uint8_t* entries = (const uint8_t*)root + sizeof(SDT_Header);
+	for (uint64_t i = 0; i < num_entries; ++i)
+	{
+		// Entries aren't always aligned
+		uint64_t phys = 0;
+		for (uint64_t b = 0; b < entry_size; ++b)
+		{
+			phys |= (uint64_t)entries[i*entry_size + b] << (b*8);
+		}
+
+		const SDT_Header* table = map_table(phys);
+		if (table != NULL && signature_is(table->signature, signature, 4))
+		{
+			return table;
+		}
+	}
+
+	kprintf("ACPI: No %c%c%c%c\n", signature[0], signature[1], signature[2], signature[3]);
+	return NULL;
+}
+
+uint32_t acpi_find_cpus(uint8_t* apic_ids, uint32_t max)
+{
+	const MADT* madt = (const MADT*)find_table("APIC");
+	if (madt == NULL)
+	{
+		return 0;
+	}
+
+	uint32_t found = 0;
+	const uint8_t* entry = (const uint8_t*)madt + sizeof(MADT);
+	const uint8_t* const end = (const uint8_t*)madt + madt->header.length;
+	while (entry + sizeof(MADT_Entry) <= end && found < max)
+	{
+		const MADT_Entry* header = (const MADT_Entry*)entry;
+		if (header->length < sizeof(MADT_Entry))
+		{
+			break;
+		}
+
+		if (header->type == MADT_LOCAL_APIC)
+		{
+			const MADT_LocalAPIC* lapic = (const MADT_LocalAPIC*)entry;
+			kprintf("ACPI: CPU %u - APIC ID %u - Flags 0x%x\n",
+					lapic->processor_id, lapic->apic_id, lapic->flags);
+			if (lapic->flags & MADT_LAPIC_ENABLED)
+			{
+				apic_ids[found++] = lapic->apic_id;
+			}
+		}
+
+		entry += header->length;
+	}
+
+	return found;
+}
+
+uint8_t acpi_find_hpet(uint64_t* address)
+{
+	const HPET_Table* hpet = (const HPET_Table*)find_table("HPET");
+	if (hpet == NULL || hpet->header.length < sizeof(HPET_Table))
+	{
+		return 0;
+	}
+
+	kprintf("ACPI: HPET %u at 0x%x, space %u\n", hpet->hpet_number, hpet->address, hpet->space_id);
+	if (hpet->space_id != ACPI_SPACE_MEMORY || hpet->address == 0)
+	{
+		return 0;
+	}
+
+	*address = hpet->address;
+	return 1;
+}
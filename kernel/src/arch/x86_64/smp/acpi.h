@@ -0,0 +1,33 @@
+#ifndef __X86_64_SMP_ACPI_H__
+#define __X86_64_SMP_ACPI_H__
+
+#include "inttypes.h"
+
+/* Just enough ACPI to find the processors and the HPET. The tables
+ * are found through the RSDP, which the BIOS leaves in the EBDA or the
+ * 0xE0000 to 0xFFFFF area. The processors are listed in the MADT, the
+ * HPET in a table of its own.
+ */
+
+/* Get the local APIC IDs of every enabled processor.
+ *
+ * Parameters:
+ *    apic_ids - Filled in with the IDs
+ *    max - How many IDs fit in apic_ids
+ *
+ * Returns:
+ *    How many IDs were found, 0 if there's no usable MADT
+ */
+uint32_t acpi_find_cpus(uint8_t* apic_ids, uint32_t max);
+
+/* Find the first HPET's registers.
+ *
+ * Parameters:
+ *    address - Where to put the physical address of the registers
+ *
+ * Returns:
+ *    1 if there's an HPET in memory space, 0 otherwise
+ */
+uint8_t acpi_find_hpet(uint64_t* address);
+
+#endif
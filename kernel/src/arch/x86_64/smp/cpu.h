@@ -0,0 +1,62 @@
+#ifndef __X86_64_SMP_CPU_H__
+#define __X86_64_SMP_CPU_H__
+
+#include "inttypes.h"
+#include "kernel/smp/defs.h"
+
+/* Everything a processor keeps for itself. The GS base points at its
+ * Cpu while it is in the kernel, user mode gets its own GS base back
+ * through swapgs.
+ */
+
+#define MSR_GS_BASE 0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+struct _PCB;
+
+typedef struct _Cpu
+{
+	struct _Cpu* self;       // So cpu_self() is a single load
+	struct _PCB* current;    // The PCB running on this processor
+	uint64_t user_rsp;       // Stashed by the SYSCALL entry while it finds the kernel stack
+	uint64_t kernel_stack;   // Same as the TSS's rsp0, SYSCALL doesn't switch stacks
+	uint32_t id;             // Index into cpus[]
+	uint32_t apic_id;        // From the ACPI MADT
+	uint32_t timer_delay;    // Last value given to timer_set_delay()
+	uint64_t timer_started;  // Counter value elapsed time counts from, TSC-deadline and HPET modes only
+	uint64_t timer_counted;  // Where timer_get_elapsed() stopped counting, 0 if not since timer_start()
+	volatile uint32_t online; // Set once the processor is running, see start_cpu()
+	volatile uint8_t tlb_pending; // A TLB shootdown is waiting on us
+	volatile uint64_t tlb_addr;   // What to flush, TLB_FLUSH_ALL for all
+	struct _PCB* fpu_owner;  // Whose state the vector registers hold, see fpu.h
+	uint8_t fpu_live;        // CR0.TS is clear, fpu_owner is running and using them
+	uint8_t kernel_fpu;      // Between kernel_fpu_begin() and kernel_fpu_end()
+} Cpu;
+
+// Never a page aligned address
+#define TLB_FLUSH_ALL 0x1
+
+extern Cpu cpus[MAX_CPUS];
+
+#ifdef BIKESHED_SIM
+// The host simulator only has the one processor
+Cpu* cpu_self(void);
+#else
+static inline __attribute__((always_inline))
+Cpu* cpu_self(void)
+{
+	// Volatile so the compiler doesn't keep the result around while
+	// the process moves to another processor
+	Cpu* cpu;
+	__asm__ volatile("movq %%gs:0, %0" : "=r"(cpu));
+	return cpu;
+}
+#endif
+
+static inline __attribute__((always_inline))
+uint32_t smp_cpu_id(void)
+{
+	return cpu_self()->id;
+}
+
+#endif
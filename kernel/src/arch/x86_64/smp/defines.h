@@ -0,0 +1,9 @@
+#ifndef __X86_64_SMP_DEFINES_H__
+#define __X86_64_SMP_DEFINES_H__
+
+/* Where the application processors start, it has to be a page below
+ * 1MiB. The start up IPI only carries the page number.
+ */
+#define TRAMPOLINE_BASE 0x8000
+
+#endif
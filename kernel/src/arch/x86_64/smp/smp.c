@@ -0,0 +1,388 @@
+#include "smp.h"
+#include "acpi.h"
+
+#include "safety.h"
+#include "kernel/klib.h"
+#include "kernel/rcu/rcu.h"
+#include "kernel/lock/spinlock.h"
+#include "kernel/scheduler/idle.h"
+#include "kernel/scheduler/scheduler.h"
+
+#include "arch/x86_64/cpuid.h"
+#include "arch/x86_64/panic.h"
+#include "arch/x86_64/atomic.h"
+#include "arch/x86_64/kprintf.h"
+#include "arch/x86_64/interrupts/tss.h"
+#include "arch/x86_64/interrupts/apic.h"
+#include "arch/x86_64/interrupts/defines.h"
+#include "arch/x86_64/interrupts/interrupts.h"
+#include "arch/x86_64/virt_memory/paging.h"
+#include "arch/x86_64/virt_memory/physical.h"
+
+#ifndef DEBUG_SMP
+#define kprintf(...)
+#endif
+
+COMPILE_ASSERT(__builtin_offsetof(Cpu, self) == CPU_SELF);
+COMPILE_ASSERT(__builtin_offsetof(Cpu, current) == CPU_CURRENT);
+COMPILE_ASSERT(__builtin_offsetof(Cpu, user_rsp) == CPU_USER_RSP);
+COMPILE_ASSERT(__builtin_offsetof(Cpu, kernel_stack) == CPU_KERNEL_STACK);
+
+Cpu cpus[MAX_CPUS];
+static uint32_t num_cpus = 1;
+
+// A ticket lock, so a processor coming back from user mode over and
+// over can't keep the others out
+static TicketLock big_lock;
+
+// Which processor has the kernel lock, its id + 1, or 0 if nobody does
+static volatile uint32_t kernel_lock_owner = 0;
+
+// Defined in trampoline.S
+extern uint8_t trampoline_start[];
+extern uint8_t trampoline_end[];
+extern uint64_t trampoline_cr3;
+extern uint64_t trampoline_stack;
+extern uint64_t trampoline_entry;
+extern uint64_t trampoline_arg;
+
+// Where one of the trampoline's data slots ended up in the copy
+#define TRAMPOLINE_SLOT(X) \
+	((uint64_t*)((uint8_t*)PHYS_TO_VIRT(TRAMPOLINE_BASE) + \
+		((uint8_t*)&(X) - trampoline_start)))
+
+// How long to wait for a processor to answer the start up IPI
+#define AP_TIMEOUT_MS 1000
+
+// Cpu::online while a processor is being started. It takes its slot by
+// moving it from STARTING to ONLINE, unless start_cpu() gave up first.
+#define CPU_STARTING  0
+#define CPU_ONLINE    1
+#define CPU_ABANDONED 2
+
+static void cpu_setup(uint32_t id)
+{
+	Cpu* cpu = &cpus[id];
+	cpu->self = cpu;
+	cpu->id = id;
+
+	// User mode starts with a GS base of 0, swapgs keeps it in the
+	// other MSR while the kernel runs
+	const uint64_t base = (uint64_t)cpu;
+	writemsr(MSR_GS_BASE, base & 0xFFFFFFFF, base >> 32);
+	writemsr(MSR_KERNEL_GS_BASE, 0, 0);
+}
+
+void smp_bsp_init()
+{
+	cpu_setup(0);
+	cpus[0].online = CPU_ONLINE;
+
+	ticket_init(&big_lock, "kernel");
+
+	// Given up when init first goes to user mode
+	kernel_lock();
+}
+
+uint32_t smp_num_cpus()
+{
+	return num_cpus;
+}
+
+//=============================================================================
+// The kernel lock
+//=============================================================================
+
+/* Flush whatever a TLB shootdown asked for, if one is waiting.
+ */
+static void tlb_poll(Cpu* cpu)
+{
+	if (!cpu->tlb_pending)
+	{
+		return;
+	}
+
+	const uint64_t addr = cpu->tlb_addr;
+	if (addr == TLB_FLUSH_ALL)
+	{
+		virt_flush_all();
+	}
+	else
+	{
+		virt_flush_page(addr);
+	}
+
+	cpu->tlb_pending = 0;
+}
+
+// Interrupts are off while waiting, the holder might be waiting on
+// us to flush our TLB before it lets go
+static void kernel_lock_wait()
+{
+	tlb_poll(cpu_self());
+}
+
+void kernel_lock()
+{
+	const uint32_t me = smp_cpu_id() + 1;
+	if (kernel_lock_owner == me)
+	{
+		return;
+	}
+
+	ticket_lock_wait(&big_lock, kernel_lock_wait);
+	kernel_lock_owner = me;
+}
+
+void kernel_unlock()
+{
+	ASSERT(kernel_lock_held());
+
+	kernel_lock_owner = 0;
+	ticket_unlock(&big_lock);
+}
+
+uint8_t kernel_lock_held()
+{
+	return kernel_lock_owner == smp_cpu_id() + 1;
+}
+
+void kernel_lock_enter(uint64_t vector)
+{
+	// Every handler is looked up through isr_table
+	rcu_idle_exit();
+
+	// The processor sending a shootdown holds the lock and is
+	// waiting on this one
+	if (vector != VEC_TLB_SHOOTDOWN)
+	{
+		kernel_lock();
+	}
+}
+
+void kernel_lock_leave()
+{
+	// A shootdown from user mode never took it
+	if (kernel_lock_held())
+	{
+		kernel_unlock();
+	}
+}
+
+//=============================================================================
+// Interprocessor interrupts
+//=============================================================================
+
+static void reschedule_handler(uint64_t vector, uint64_t code)
+{
+	UNUSED(vector);
+	UNUSED(code);
+
+	apic_eoi();
+	resched_interrupt();
+}
+
+static void tlb_shootdown_handler(uint64_t vector, uint64_t code)
+{
+	UNUSED(vector);
+	UNUSED(code);
+
+	tlb_poll(cpu_self());
+	apic_eoi();
+}
+
+void smp_reschedule(uint32_t cpu)
+{
+	ASSERT(cpu < num_cpus);
+	apic_send_ipi(cpus[cpu].apic_id, APIC_ICR_FIXED | VEC_RESCHEDULE);
+}
+
+static void shootdown(void* table, uint64_t addr)
+{
+	if (num_cpus == 1)
+	{
+		return;
+	}
+
+	// Only the kernel lock's holder changes mappings, so nobody
+	// else can be in here
+	ASSERT(kernel_lock_held());
+
+	// The kernel's half is in every page table, but a processor
+	// running something else doesn't have any of table's entries.
+	// CR3 always matches current_pcb while the lock is held.
+	const uint32_t self = smp_cpu_id();
+	const uint8_t everyone = table == kernel_table || addr >= KERNEL_BASE;
+
+	uint8_t sent[MAX_CPUS];
+	for (uint32_t i = 0; i < num_cpus; ++i)
+	{
+		sent[i] = 0;
+		if (i == self)
+		{
+			continue;
+		}
+
+		if (!everyone && (cpus[i].current == NULL ||
+					cpus[i].current->page_table != table))
+		{
+			continue;
+		}
+
+		cpus[i].tlb_addr = addr;
+		cpus[i].tlb_pending = 1;
+		apic_send_ipi(cpus[i].apic_id, APIC_ICR_FIXED | VEC_TLB_SHOOTDOWN);
+		sent[i] = 1;
+	}
+
+	for (uint32_t i = 0; i < num_cpus; ++i)
+	{
+		while (sent[i] && cpus[i].tlb_pending)
+		{
+			cpu_relax();
+		}
+	}
+}
+
+void tlb_shootdown(void* table, uint64_t virt_addr)
+{
+	shootdown(table, virt_addr);
+}
+
+void tlb_shootdown_all(void* table)
+{
+	shootdown(table, TLB_FLUSH_ALL);
+}
+
+//=============================================================================
+// Starting the application processors
+//=============================================================================
+
+static void ap_main(uint64_t id)
+{
+	Cpu* cpu = &cpus[id];
+	const uint64_t base = (uint64_t)cpu;
+	writemsr(MSR_GS_BASE, base & 0xFFFFFFFF, base >> 32);
+	writemsr(MSR_KERNEL_GS_BASE, 0, 0);
+
+	setup_tss_descriptor(id);
+	interrupts_cpu_init();
+	apic_cpu_init();
+
+	// Too slow, the slot and this stack might already be someone else's
+	if (atomic_cmpxchg(&cpu->online, CPU_STARTING, CPU_ONLINE) != CPU_STARTING)
+	{
+		while (1)
+		{
+			__asm__ volatile("cli; hlt");
+		}
+	}
+
+	// Wait for the bootstrap processor to finish starting everyone
+	kernel_lock();
+	scheduler_cpu_start();
+
+	panic("SMP: Idle thread returned");
+}
+
+static uint8_t start_cpu(uint32_t id, uint8_t apic)
+{
+	cpus[id].self = &cpus[id];
+	cpus[id].id = id;
+	cpus[id].apic_id = apic;
+	cpus[id].online = CPU_STARTING;
+
+	// The processor starts out on its idle thread's kernel stack
+	PCB* idle = idle_init(id);
+
+	*TRAMPOLINE_SLOT(trampoline_cr3) = (uint64_t)kernel_table;
+	*TRAMPOLINE_SLOT(trampoline_stack) = (uint64_t)idle->context;
+	*TRAMPOLINE_SLOT(trampoline_entry) = (uint64_t)&ap_main;
+	*TRAMPOLINE_SLOT(trampoline_arg) = id;
+
+	// The INIT, SIPI, SIPI dance from the Intel MP specification
+	apic_send_ipi(apic, APIC_ICR_INIT);
+	apic_delay_us(10000);
+	for (uint32_t i = 0; i < 2 && cpus[id].online == CPU_STARTING; ++i)
+	{
+		apic_send_ipi(apic, APIC_ICR_STARTUP | (TRAMPOLINE_BASE >> 12));
+		apic_delay_us(200);
+	}
+
+	for (uint32_t ms = 0; ms < AP_TIMEOUT_MS && cpus[id].online == CPU_STARTING; ++ms)
+	{
+		apic_delay_us(1000);
+	}
+
+	if (atomic_cmpxchg(&cpus[id].online, CPU_STARTING, CPU_ABANDONED) == CPU_STARTING)
+	{
+		// Back to waiting for a start up IPI, which it won't get again.
+		// Otherwise it could still come up later on the trampoline and
+		// stack the next processor gets.
+		apic_send_ipi(apic, APIC_ICR_INIT);
+		apic_delay_us(10000);
+
+		// The next processor gets the slot, and an idle thread of its own
+		scheduler_set_idle(id, NULL);
+		free_pcb(idle);
+		return 0;
+	}
+
+	return 1;
+}
+
+void smp_init()
+{
+	interrupts_install_isr(VEC_RESCHEDULE, reschedule_handler);
+	interrupts_install_isr(VEC_TLB_SHOOTDOWN, tlb_shootdown_handler);
+
+	cpus[0].apic_id = apic_id();
+	idle_init(0);
+
+	uint8_t apic_ids[MAX_CPUS];
+	const uint32_t found = acpi_find_cpus(apic_ids, MAX_CPUS);
+	if (found <= 1)
+	{
+		kprintf("SMP: Only one processor\n");
+		return;
+	}
+
+	if (apic_timer_hpet())
+	{
+		kprintf("SMP: Only the bootstrap processor has a timer\n");
+		return;
+	}
+
+	memcpy(PHYS_TO_VIRT(TRAMPOLINE_BASE), trampoline_start,
+			trampoline_end - trampoline_start);
+
+	// The trampoline turns paging on while running from low memory,
+	// so the kernel's page table needs that mapped for a while
+	PML4_Table* pml4_table = (PML4_Table*)PHYS_TO_VIRT(kernel_table);
+	pml4_table->entries[0] = pml4_table->entries[256];
+
+	for (uint32_t i = 0; i < found && num_cpus < MAX_CPUS; ++i)
+	{
+		if (apic_ids[i] == cpus[0].apic_id)
+		{
+			continue;
+		}
+
+		if (start_cpu(num_cpus, apic_ids[i]))
+		{
+			++num_cpus;
+		}
+		else
+		{
+			kprintf("SMP: APIC %u didn't start\n", apic_ids[i]);
+		}
+	}
+
+	// Processes get a copy of the kernel table's lower half,
+	// so this has to be gone before any are made
+	pml4_table->entries[0] = 0;
+	virt_flush_all();
+	tlb_shootdown_all(kernel_table);
+
+	kprintf("SMP: %u processors\n", num_cpus);
+}
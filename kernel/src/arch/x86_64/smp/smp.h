@@ -0,0 +1,25 @@
+#ifndef __X86_64_SMP_SMP_H__
+#define __X86_64_SMP_SMP_H__
+
+#include "inttypes.h"
+#include "cpu.h"
+#include "defines.h"
+
+/* Setup the bootstrap processor's Cpu and take the kernel lock. Has to
+ * run before anything looks at current_pcb.
+ */
+void smp_bsp_init(void);
+
+/* Called by the interrupt stubs on every kernel entry, takes the kernel
+ * lock unless the interrupt is a TLB shootdown.
+ *
+ * Parameters:
+ *    vector - The interrupt being handled
+ */
+void kernel_lock_enter(uint64_t vector);
+
+/* Called by the interrupt stubs just before going back to user mode.
+ */
+void kernel_lock_leave(void);
+
+#endif
@@ -7,6 +7,7 @@
 #include "arch/x86_64/support.h"
 #include "arch/x86_64/kprintf.h"
 #include "arch/x86_64/pci/pci.h"
+#include "arch/x86_64/fpu/simd.h"
 #include "arch/x86_64/virt_memory/paging.h"
 #include "arch/x86_64/interrupts/interrupts.h"
 
@@ -1154,13 +1155,9 @@ static void hda_test_sound()
 			volatile StreamReg* s_reg = stream_get_sreg(stream, 1);
 			s_reg->SDLVI = 1;
 
-			uint8_t* music = (uint8_t*)stream->bdl_info.data_address;
-			uint32_t m_i = 0;
-			for (uint32_t i = 0; i < small_wav_len; ++i)
-			{
-				music[m_i++] = 0;
-				music[m_i++] = small_wav[i];
-			}
+			// Each 8 bit sample goes in the high byte of a 16 bit one
+			uint16_t* music = (uint16_t*)stream->bdl_info.data_address;
+			samples_8_to_16(music, small_wav, small_wav_len);
 
 			// Need at least two entries
 			bdl[1] = bdl[0];
@@ -45,4 +45,14 @@ void _outl(uint16_t port, uint32_t val)
 	__asm__ volatile("outl %0, %1" : : "a"(val), "d"(port));
 }
 
+/* Read the processor's time stamp counter
+ */
+static inline __attribute__((always_inline))
+uint64_t _rdtsc(void)
+{
+	uint32_t low, high;
+	__asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
 #endif
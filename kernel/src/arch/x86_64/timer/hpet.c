@@ -0,0 +1,184 @@
+#include "hpet.h"
+
+#include "safety.h"
+#include "kernel/timer/defs.h"
+
+#include "arch/x86_64/kprintf.h"
+#include "arch/x86_64/smp/acpi.h"
+#include "arch/x86_64/interrupts/apic.h"
+#include "arch/x86_64/virt_memory/paging.h"
+
+#ifndef DEBUG_HPET
+#define kprintf(...)
+#endif
+
+// The page below the local APIC's
+#define HPET_VIRT_LOC 0xFFFFFFFFFFFFE000
+
+#define REG_CAPS    (0x000/sizeof(uint64_t))
+#define REG_CONFIG  (0x010/sizeof(uint64_t))
+#define REG_COUNTER (0x0F0/sizeof(uint64_t))
+#define REG_TIMER_CONFIG(N)  ((0x100 + 0x20*(N))/sizeof(uint64_t))
+#define REG_TIMER_COMPARE(N) ((0x108 + 0x20*(N))/sizeof(uint64_t))
+#define REG_TIMER_FSB(N)     ((0x110 + 0x20*(N))/sizeof(uint64_t))
+
+#define CAPS_COUNTER_64 0x2000
+#define CAPS_LEGACY     0x8000
+#define CAPS_PERIOD(X)  ((X) >> 32)
+
+#define CONFIG_ENABLE 0x1
+#define CONFIG_LEGACY 0x2 // Comparator 0 goes to IRQ 0, 1 to IRQ 8
+
+#define TIMER_LEVEL      0x2
+#define TIMER_INT_ENABLE 0x4
+#define TIMER_PERIODIC   0x8
+#define TIMER_FSB_ENABLE 0x4000
+#define TIMER_FSB_CAP    0x8000
+
+// The spec doesn't allow a slower counter than 10MHz
+#define MAX_PERIOD_FS 100000000UL
+
+#define TIMER_VECTOR 32
+#define MSI_ADDRESS 0xFEE00000
+
+static volatile uint64_t* regs = NULL;
+static uint64_t period_fs = 0;
+static uint64_t counter_mask = 0;
+
+uint8_t hpet_init()
+{
+	uint64_t phys = 0;
+	if (!acpi_find_hpet(&phys))
+	{
+		return 0;
+	}
+
+	// The registers are only 1KiB aligned
+	if (!virt_map_phys(kernel_table, HPET_VIRT_LOC, phys & ~(uint64_t)(PAGE_SMALL_SIZE - 1),
+				PG_FLAG_RW | PG_FLAG_PWT | PG_FLAG_PCD, PAGE_SMALL))
+	{
+		kprintf("HPET: Failed to map 0x%x\n", phys);
+		return 0;
+	}
+
+	volatile uint64_t* found = (volatile uint64_t*)(HPET_VIRT_LOC + (phys & (PAGE_SMALL_SIZE - 1)));
+	const uint64_t caps = found[REG_CAPS];
+	if (CAPS_PERIOD(caps) == 0 || CAPS_PERIOD(caps) > MAX_PERIOD_FS)
+	{
+		kprintf("HPET: Bad period %u\n", CAPS_PERIOD(caps));
+		return 0;
+	}
+
+	period_fs = CAPS_PERIOD(caps);
+	counter_mask = (caps & CAPS_COUNTER_64) ? 0xFFFFFFFFFFFFFFFF : 0xFFFFFFFF;
+
+	// Comparator 0 stays quiet until hpet_oneshot_start()
+	found[REG_TIMER_CONFIG(0)] &= ~(uint64_t)TIMER_INT_ENABLE;
+	found[REG_CONFIG] = (found[REG_CONFIG] & ~(uint64_t)CONFIG_LEGACY) | CONFIG_ENABLE;
+	regs = found;
+
+	kprintf("HPET: %u fs per tick, %u timers, 64 bit %u\n", period_fs,
+			((caps >> 8) & 0x1F) + 1, (caps & CAPS_COUNTER_64) != 0);
+	return 1;
+}
+
+uint8_t hpet_present()
+{
+	return regs != NULL;
+}
+
+uint64_t hpet_read()
+{
+	return regs[REG_COUNTER] & counter_mask;
+}
+
+uint64_t hpet_since(uint64_t start)
+{
+	return (hpet_read() - start) & counter_mask;
+}
+
+uint64_t hpet_period_fs()
+{
+	return period_fs;
+}
+
+static uint64_t ns_to_ticks(uint64_t ns)
+{
+	// In picoseconds, nanoseconds in femtoseconds would overflow after
+	// five hours. There's no 128 bit division without libgcc.
+	const uint64_t ticks = ns * 1000 / (period_fs / 1000);
+	return ticks > 0 ? ticks : 1;
+}
+
+void hpet_delay_us(uint32_t us)
+{
+	ASSERT(hpet_present());
+
+	const uint64_t start = hpet_read();
+	const uint64_t ticks = ns_to_ticks((uint64_t)us * 1000);
+	while (hpet_since(start) < ticks);
+}
+
+uint8_t hpet_oneshot_route()
+{
+	if (!hpet_present())
+	{
+		return HPET_ROUTE_NONE;
+	}
+
+	if (regs[REG_TIMER_CONFIG(0)] & TIMER_FSB_CAP)
+	{
+		return HPET_ROUTE_MSI;
+	}
+
+	return (regs[REG_CAPS] & CAPS_LEGACY) ? HPET_ROUTE_LEGACY : HPET_ROUTE_NONE;
+}
+
+void hpet_oneshot_start(uint64_t deadline)
+{
+	ASSERT(hpet_present());
+
+	uint64_t config = regs[REG_TIMER_CONFIG(0)];
+	config &= ~(uint64_t)(TIMER_LEVEL | TIMER_PERIODIC);
+	if (config & TIMER_FSB_CAP)
+	{
+		// An MSI, the address picks the local APIC
+		regs[REG_TIMER_FSB(0)] = ((uint64_t)(MSI_ADDRESS | (apic_id() << 12)) << 32) | TIMER_VECTOR;
+		config |= TIMER_FSB_ENABLE;
+	}
+	else
+	{
+		ASSERT(regs[REG_CAPS] & CAPS_LEGACY);
+		regs[REG_CONFIG] |= CONFIG_LEGACY;
+	}
+	regs[REG_TIMER_CONFIG(0)] = config | TIMER_INT_ENABLE;
+
+	// The comparator only fires when the counter equals it. If the
+	// deadline has gone, or the counter got past before it was
+	// written, try again a little further out each time.
+	uint64_t retry = 1;
+	uint64_t now = hpet_read();
+	while (1)
+	{
+		uint64_t ahead = (deadline - now) & counter_mask;
+		if (ahead == 0 || ahead > counter_mask / 2)
+		{
+			ahead = retry;
+			retry *= 2;
+		}
+
+		regs[REG_TIMER_COMPARE(0)] = (now + ahead) & counter_mask;
+		if (hpet_since(now) < ahead)
+		{
+			break;
+		}
+
+		now = hpet_read();
+	}
+}
+
+void hpet_oneshot_stop()
+{
+	ASSERT(hpet_present());
+	regs[REG_TIMER_CONFIG(0)] &= ~(uint64_t)TIMER_INT_ENABLE;
+}
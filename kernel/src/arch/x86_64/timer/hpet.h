@@ -0,0 +1,81 @@
+#ifndef __X86_64_TIMER_HPET_H__
+#define __X86_64_TIMER_HPET_H__
+
+#include "inttypes.h"
+
+/* The high precision event timer, found through ACPI. Its main counter
+ * is the reference the APIC timer and the time stamp counter are
+ * calibrated against, it's exact where the PIT needs a busy wait on a
+ * port. Its first comparator can stand in for the APIC timer.
+ */
+
+#define FS_PER_SEC 1000000000000000UL
+
+// How comparator 0 can reach a processor, see hpet_oneshot_route()
+#define HPET_ROUTE_NONE 0
+#define HPET_ROUTE_MSI 1    // Straight to a local APIC
+#define HPET_ROUTE_LEGACY 2 // IRQ 0 of the PIC, the bootstrap processor only
+
+/* Find the HPET, map its registers and start its main counter. Must be
+ * called after the kernel's page table is setup.
+ *
+ * Returns:
+ *    1 if there's an HPET to use, 0 otherwise
+ */
+uint8_t hpet_init(void);
+
+/* Returns:
+ *    1 if hpet_init() found one
+ */
+uint8_t hpet_present(void);
+
+/* Returns:
+ *    The main counter
+ */
+uint64_t hpet_read(void);
+
+/* How far the main counter has got, allowing for a 32 bit one having
+ * wrapped.
+ *
+ * Parameters:
+ *    start - An earlier hpet_read()
+ *
+ * Returns:
+ *    Ticks since start
+ */
+uint64_t hpet_since(uint64_t start);
+
+/* Returns:
+ *    Femtoseconds per tick of the main counter
+ */
+uint64_t hpet_period_fs(void);
+
+/* Busy wait on the main counter.
+ *
+ * Parameters:
+ *    us - How many microseconds to wait
+ */
+void hpet_delay_us(uint32_t us);
+
+/* Returns:
+ *    How hpet_oneshot_start() would raise the interrupt, one of the
+ *    HPET_ROUTE_* values
+ */
+uint8_t hpet_oneshot_route(void);
+
+/* Raise the timer interrupt (vector 32, same as the APIC timer) once,
+ * from comparator 0. Delivered straight to the calling processor's
+ * local APIC if the comparator can, otherwise through IRQ 0 of the PIC
+ * to the bootstrap processor. A deadline that has already passed fires
+ * as soon as it can.
+ *
+ * Parameters:
+ *    deadline - When, in main counter ticks like hpet_read()
+ */
+void hpet_oneshot_start(uint64_t deadline);
+
+/* Disarm comparator 0.
+ */
+void hpet_oneshot_stop(void);
+
+#endif
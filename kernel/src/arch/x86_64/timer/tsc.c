@@ -0,0 +1,108 @@
+#include "tsc.h"
+
+#include "kernel/timer/defs.h"
+#include "kernel/vdso/vdso.h"
+
+#include "arch/x86_64/cpuid.h"
+#include "arch/x86_64/support.h"
+#include "arch/x86_64/kprintf.h"
+
+#ifndef DEBUG_TSC
+#define kprintf(...)
+#endif
+
+// CPUID leaf 0x80000007
+#define CPUID_LEAF_POWER 0x80000007
+#define CPUID_EDX_INVARIANT_TSC 0x100
+
+// CPUID leaf 0x15, the counter's rate relative to the crystal clock
+#define CPUID_LEAF_TSC 0x15
+
+// Nanoseconds per time stamp counter cycle, as a fixed point number
+// with NS_SHIFT bits after the point
+#define NS_SHIFT 32
+
+static uint64_t tsc_boot = 0;
+static uint64_t ns_mult = 0;
+static uint64_t hz = 0;
+static uint8_t invariant = 0;
+
+static uint32_t max_leaf(uint32_t base)
+{
+	uint32_t eax, edx;
+	cpuid(base, &eax, &edx);
+	return eax;
+}
+
+/* The rate the processor says its counter runs at, exact where the
+ * measurement isn't.
+ *
+ * Returns:
+ *    Cycles per second, 0 if it doesn't say
+ */
+static uint64_t cpuid_hz(void)
+{
+	if (max_leaf(0) < CPUID_LEAF_TSC)
+	{
+		return 0;
+	}
+
+	// eax/ebx is the ratio to the crystal, ecx its frequency if known
+	uint32_t eax, ebx, ecx, edx;
+	cpuid_count(CPUID_LEAF_TSC, 0, &eax, &ebx, &ecx, &edx);
+	if (eax == 0 || ebx == 0 || ecx == 0)
+	{
+		return 0;
+	}
+
+	return (uint64_t)ecx * ebx / eax;
+}
+
+void tsc_init(uint64_t measured_hz)
+{
+	if (max_leaf(0x80000000) >= CPUID_LEAF_POWER)
+	{
+		uint32_t eax, edx;
+		cpuid(CPUID_LEAF_POWER, &eax, &edx);
+		invariant = (edx & CPUID_EDX_INVARIANT_TSC) != 0;
+	}
+
+	hz = cpuid_hz();
+	if (hz == 0)
+	{
+		hz = measured_hz;
+	}
+
+	kprintf("TSC: %u Hz (measured %u), invariant %u\n", hz, measured_hz, invariant);
+	if (!invariant)
+	{
+		kprintf("TSC: Not invariant, the clock drifts with the processor's frequency\n");
+	}
+
+	tsc_boot = _rdtsc();
+	ns_mult = (NS_PER_SEC << NS_SHIFT) / hz;
+	vdso_set_clock(tsc_boot, ns_mult, NS_SHIFT);
+}
+
+uint64_t tsc_hz()
+{
+	return hz;
+}
+
+uint8_t tsc_invariant()
+{
+	return invariant;
+}
+
+uint64_t timer_get_cycles()
+{
+	return _rdtsc();
+}
+
+uint64_t timer_get_ns()
+{
+	// 128 bits so it doesn't overflow after a few seconds
+	__extension__ typedef unsigned __int128 uint128_t;
+	const uint64_t cycles = _rdtsc() - tsc_boot;
+	return (uint64_t)(((uint128_t)cycles * ns_mult) >> NS_SHIFT);
+}
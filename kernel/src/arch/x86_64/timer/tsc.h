@@ -0,0 +1,30 @@
+#ifndef __X86_64_TIMER_TSC_H__
+#define __X86_64_TIMER_TSC_H__
+
+#include "inttypes.h"
+
+/* The time stamp counter is the kernel's clock, timer_get_ns() and
+ * timer_get_cycles() read it.
+ */
+
+/* Work out how fast the time stamp counter runs and start the clock
+ * from 0. The rate comes from CPUID when the processor gives it,
+ * otherwise measured_hz is used.
+ *
+ * Parameters:
+ *    measured_hz - Cycles per second, measured against another timer
+ */
+void tsc_init(uint64_t measured_hz);
+
+/* Returns:
+ *    Cycles per second, 0 before tsc_init()
+ */
+uint64_t tsc_hz(void);
+
+/* Returns:
+ *    1 if the counter runs at the same rate whatever the processor's
+ *    frequency or sleep state, so it can be trusted as a clock
+ */
+uint8_t tsc_invariant(void);
+
+#endif
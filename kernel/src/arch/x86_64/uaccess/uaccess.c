@@ -0,0 +1,86 @@
+#include "uaccess.h"
+
+#include "kernel/syscalls/uaccess.h"
+#include "kernel/scheduler/scheduler.h"
+
+typedef struct
+{
+	uint64_t fault;
+	uint64_t fixup;
+} Fixup;
+
+// The .fixups section, see kernel.ld
+extern const Fixup start_of_fixups[];
+extern const Fixup end_of_fixups[];
+
+// Defined in copy_user.S
+extern uint64_t copy_user_raw(void* dst, const void* src, uint64_t size);
+extern int64_t strncpy_user_raw(char* dst, const char* src, uint64_t size);
+
+static uint8_t user_range(const void* addr, uint64_t size)
+{
+	const uint64_t start = (uint64_t)addr;
+	return start < USER_ADDRESS_END && size <= USER_ADDRESS_END - start;
+}
+
+uint8_t uaccess_fixup(Context* frame)
+{
+	// Page faults, and general protection faults for a bad address
+	if (frame->vector != 14 && frame->vector != 13)
+	{
+		return 0;
+	}
+
+	// Only a handful of entries, a linear search is fine
+	for (const Fixup* f = start_of_fixups; f < end_of_fixups; ++f)
+	{
+		if (f->fault == frame->rip)
+		{
+			frame->rip = f->fixup;
+			if (frame->vector == 14)
+			{
+				++current_pcb->usage.page_faults;
+			}
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+Status copy_from_user(void* dst, const void* user_src, uint64_t size)
+{
+	if (!user_range(user_src, size))
+	{
+		return BAD_ADDRESS;
+	}
+
+	return copy_user_raw(dst, user_src, size) == 0 ? SUCCESS : BAD_ADDRESS;
+}
+
+Status copy_to_user(void* user_dst, const void* src, uint64_t size)
+{
+	if (!user_range(user_dst, size))
+	{
+		return BAD_ADDRESS;
+	}
+
+	return copy_user_raw(user_dst, src, size) == 0 ? SUCCESS : BAD_ADDRESS;
+}
+
+int64_t strncpy_from_user(char* dst, const char* user_src, uint64_t size)
+{
+	// Only what's left of the user half can be read
+	const uint64_t start = (uint64_t)user_src;
+	if (start >= USER_ADDRESS_END)
+	{
+		return -1;
+	}
+
+	if (size > USER_ADDRESS_END - start)
+	{
+		size = USER_ADDRESS_END - start;
+	}
+
+	return strncpy_user_raw(dst, user_src, size);
+}
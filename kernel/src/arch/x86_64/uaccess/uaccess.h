@@ -0,0 +1,19 @@
+#ifndef __X86_64_UACCESS_UACCESS_H__
+#define __X86_64_UACCESS_UACCESS_H__
+
+#include "inttypes.h"
+#include "arch/x86_64/interrupts/imports.h"
+
+// Where the user half of the address space ends
+#define USER_ADDRESS_END 0x800000000000
+
+/* Called by the interrupt stubs for faults taken in kernel mode. If
+ * the faulting instruction is one of the user copies in copy_user.S,
+ * the frame is changed to carry on at its fixup.
+ *
+ * Returns:
+ *    1 if the fault was handled and the frame can just be resumed
+ */
+uint8_t uaccess_fixup(Context* frame);
+
+#endif
@@ -4,11 +4,14 @@
 #include "imports.h"
 
 #include "kernel/klib.h" // memclr
+#include "kernel/smp/defs.h"
+#include "kernel/scheduler/scheduler.h" // preempt_point
 
 #include "arch/x86_64/panic.h"
 #include "arch/x86_64/serial.h"
 #include "arch/x86_64/kprintf.h"
 #include "arch/x86_64/textmode.h"
+#include "arch/x86_64/fpu/simd.h"
 
 #define ENTRY_TO_ADDR(X) ((X) & 0x7FFFFFFFFFFFF000)
 
@@ -308,7 +311,57 @@ void virt_unmap_page(void* _table, uint64_t virt_addr)
 	}
 
 	// TODO could check if table is completely empty and then free the whole thing
-	// TODO invlpg
+	virt_flush_page(virt_addr);
+	tlb_shootdown(_table, virt_addr);
+}
+
+//=============================================================================
+//
+//=============================================================================
+
+uint8_t virt_detach_page(void* _table, uint64_t virt_addr, uint64_t* out_phys)
+{
+	PML4_Table* table = (PML4_Table*) PHYS_TO_VIRT(_table);
+
+	// Index 256 marks the start of the kernel's address space
+	const uint64_t pml4_index = PML4_INDEX(virt_addr);
+	const uint64_t pdpt_index = PDPT_INDEX(virt_addr);
+	const uint64_t pdt_index  = PDT_INDEX(virt_addr);
+	const uint64_t pt_index   = PT_INDEX(virt_addr);
+
+	if (pml4_index >= 256 || (table->entries[pml4_index] & PML4_PRESENT) == 0)
+	{
+		return 0;
+	}
+
+	PDP_Table* pdp_table = PHYS_TO_VIRT(PML4E_TO_PDPT(table->entries[pml4_index]));
+	if ((pdp_table->entries[pdpt_index] & PDPT_PRESENT) == 0)
+	{
+		return 0;
+	}
+
+	// 2MiB pages can't be handed around one 4KiB frame at a time
+	PD_Table* pd_table = PHYS_TO_VIRT(PDPTE_TO_PDT(pdp_table->entries[pdpt_index]));
+	const uint64_t pdt_entry = pd_table->entries[pdt_index];
+	if ((pdt_entry & PDT_PRESENT) == 0 || (pdt_entry & PDT_PAGE_SIZE) > 0)
+	{
+		return 0;
+	}
+
+	P_Table* p_table = PHYS_TO_VIRT(PDTE_TO_PT(pdt_entry));
+	const uint64_t pt_entry = p_table->entries[pt_index];
+	const uint64_t needed = PT_PRESENT | PG_FLAG_RW | PG_FLAG_USER;
+	if ((pt_entry & needed) != needed)
+	{
+		return 0;
+	}
+
+	*out_phys = ENTRY_TO_ADDR(pt_entry);
+	p_table->entries[pt_index] = 0;
+
+	virt_flush_page(virt_addr);
+	tlb_shootdown(_table, virt_addr);
+	return 1;
 }
 
 //=============================================================================
@@ -423,6 +476,10 @@ void virt_reset_table(void* table)
 		}
 		pml4_table->entries[pml4_index] = 0;
 	}
+
+	// The table is usually loaded, exec() resets its own address space
+	virt_flush_all();
+	tlb_shootdown_all(table);
 }
 
 //=============================================================================
@@ -500,6 +557,63 @@ uint8_t virt_lookup_phys(void* table, uint64_t virt_addr, uint64_t* out_phys)
 //
 //=============================================================================
 
+uint64_t virt_count_pages(void* table)
+{
+	uint64_t count = 0;
+
+	// Only the user half of the address space, the kernel's is shared
+	PML4_Table* pml4_table = (PML4_Table*) PHYS_TO_VIRT(table);
+	for (uint64_t pml4_index = 0; pml4_index < 256; ++pml4_index)
+	{
+		const uint64_t pml4_entry = pml4_table->entries[pml4_index];
+		if ((pml4_entry & PML4_PRESENT) == 0)
+		{
+			continue;
+		}
+
+		PDP_Table* pdp_table = PHYS_TO_VIRT(PML4E_TO_PDPT(pml4_entry));
+		for (uint64_t pdpt_index = 0; pdpt_index < 512; ++pdpt_index)
+		{
+			const uint64_t pdpt_entry = pdp_table->entries[pdpt_index];
+			if ((pdpt_entry & PDPT_PRESENT) == 0)
+			{
+				continue;
+			}
+
+			PD_Table* pd_table = PHYS_TO_VIRT(PDPTE_TO_PDT(pdpt_entry));
+			for (uint64_t pdt_index = 0; pdt_index < 512; ++pdt_index)
+			{
+				const uint64_t pdt_entry = pd_table->entries[pdt_index];
+				if ((pdt_entry & PDT_PRESENT) == 0)
+				{
+					continue;
+				}
+
+				if ((pdt_entry & PDT_PAGE_SIZE) > 0)
+				{
+					count += PAGE_LARGE_SIZE / PAGE_SMALL_SIZE;
+					continue;
+				}
+
+				P_Table* p_table = PHYS_TO_VIRT(PDTE_TO_PT(pdt_entry));
+				for (uint64_t pt_index = 0; pt_index < 512; ++pt_index)
+				{
+					if ((p_table->entries[pt_index] & PT_PRESENT) > 0)
+					{
+						++count;
+					}
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+//=============================================================================
+//
+//=============================================================================
+
 static uint64_t clone_page_table(P_Table* p_table)
 {
 	const char* error = "clone_page_table: No memory";
@@ -516,7 +630,7 @@ static uint64_t clone_page_table(P_Table* p_table)
 
 			kprintf("PT Cloning Entry: 0x%x - IDX: %u - 0x%x - 0x%x\n", entry, i, dst, src);
 
-			memcpy(dst, src, PAGE_SMALL_SIZE);
+			page_copy(dst, src, PAGE_SMALL_SIZE);
 
 			new_table->entries[i] = (uint64_t)VIRT_TO_PHYS(dst) | (entry & PAGE_COPY_FLAGS);
 		}
@@ -552,7 +666,9 @@ static uint64_t clone_page_directory(PD_Table* pd_table)
 				void* dst = PHYS_TO_VIRT(phys_alloc_2MIB_safe(error_2MIB));
 				void* src = PHYS_TO_VIRT(ENTRY_TO_ADDR(entry));
 
-				memcpy(dst, src, PAGE_LARGE_SIZE);
+				// Bigger than the caches, going through them would
+				// only push out what the parent is using
+				memcpy_nt(dst, src, PAGE_LARGE_SIZE);
 
 				new_table->entries[i] = 
 					(uint64_t)VIRT_TO_PHYS(dst) | 
@@ -565,6 +681,9 @@ static uint64_t clone_page_directory(PD_Table* pd_table)
 								PDTE_TO_PT(entry)));
 				new_table->entries[i] |= (entry & PAGE_COPY_FLAGS);
 			}
+
+			// Copying up to 2MIB is long enough to let others run
+			preempt_point();
 		}
 		else
 		{
@@ -39,14 +39,38 @@
 
 #define PG_SAFE_FLAGS (PG_FLAG_RW | PG_FLAG_USER | PG_FLAG_PWT | PG_FLAG_PCD | PG_FLAG_XD)
 
+#ifdef BIKESHED_SIM
+// The host simulator can't touch CR3, it provides its own version
+void virt_switch_page_table(void* page_table);
+#else
 static inline
 void virt_switch_page_table(void* page_table)
 {
 	__asm__ volatile("movq %%rax, %%cr3" : : "a"((uint64_t)page_table));
 }
+#endif
 
 #define invlpg(X) __asm__ volatile("invlpg %0" :: "m" (X))
 
+/* Drop this processor's TLB entry for a virtual address.
+ */
+static inline __attribute__((always_inline))
+void virt_flush_page(uint64_t virt_addr)
+{
+	__asm__ volatile("invlpg (%0)" :: "r"(virt_addr) : "memory");
+}
+
+/* Drop every TLB entry for the loaded page table, except the kernel's
+ * global ones.
+ */
+static inline __attribute__((always_inline))
+void virt_flush_all(void)
+{
+	uint64_t cr3;
+	__asm__ volatile("movq %%cr3, %0" : "=r"(cr3));
+	__asm__ volatile("movq %0, %%cr3" :: "r"(cr3) : "memory");
+}
+
 /* This is defined in prekernel.s
  *
  * It's really a PML4_Table not a void*
@@ -112,6 +136,20 @@ uint8_t virt_map_page(void* table, const uint64_t virt_addr,
  */
 void virt_unmap_page(void* table, uint64_t virt_addr);
 
+/* Unmap a page without freeing it, so its frame can be mapped
+ * somewhere else.
+ *
+ * Parameters:
+ *    table - The PML4 table, the top most paging structure
+ *    virt_addr - The virtual address to unmap
+ *    out_phys - The frame that was mapped there
+ *
+ * Returns:
+ *    1 if it was unmapped, 0 without changing anything unless it is a
+ *    writable 4KiB user page
+ */
+uint8_t virt_detach_page(void* table, uint64_t virt_addr, uint64_t* out_phys);
+
 /* Completely deletes all paging structures in the given hierarchy.
  *
  * Parameters:
@@ -144,6 +182,17 @@ void virt_reset_table(void* table);
  */
 uint8_t virt_lookup_phys(void* table, uint64_t virt_addr, uint64_t* out_phys);
 
+/* Count how many pages are mapped in the user half of a page table.
+ * Large pages count as the number of small pages they cover.
+ *
+ * Parameters:
+ *    table - The page table to count the pages of
+ *
+ * Returns:
+ *    The number of PAGE_SMALL_SIZE pages mapped
+ */
+uint64_t virt_count_pages(void* table);
+
 /* Clones a PML4 mapping. This does a copy-on-write clone. So
  * only the entry values are copied, but not the pages that are
  * pointed to by the entries. Once an entry is written to then
@@ -33,6 +33,9 @@ static Pool* pool_4KIB;
 //static void test_2MIB_alloc(void);
 //static void test_4KIB_alloc(void);
 
+// Number of 2MiB chunks currently split into 4KiB pools
+static uint64_t pools_in_use = 0;
+
 /* 
  */
 void setup_physical_allocator()
@@ -44,17 +47,13 @@ void setup_physical_allocator()
 	const uint32_t mmap_size = *((uint32_t*) MMAP_COUNT);
 	MMapEntry* mmap_array = (MMapEntry*) MMAP_ADDRESS;
 
-	// All of physical memory is mapped starting at the kernels half of the
-	// address space. Therefore in order to get a physical address the kernel's
-	// base address needs to be added to it.
-	
 	stack_init(&stack_2MIB);
 	pool_4KIB = NULL;
+	pools_in_use = 0;
 
 	uint64_t wasted_ram = 0;
 	uint64_t allocatable_ram = 0;
 
-	uint32_t usable = 0;
 	for (uint32_t i = 0; i < mmap_size; ++i)
 	{
 		if (mmap_array[i].type != TYPE_USABLE)
@@ -62,43 +61,63 @@ void setup_physical_allocator()
 			continue;
 		}
 
-		const uint64_t base_orig = mmap_array[i].base;	
-		const uint64_t length_orig = mmap_array[i].length;
+		const uint64_t added = phys_alloc_add_region(mmap_array[i].base, mmap_array[i].length);
+		allocatable_ram += added;
+		wasted_ram += mmap_array[i].length - added;
+	}
 
-		if (length_orig < _2_MiB)
-		{
-			wasted_ram += length_orig;
-			continue;
-		}
+	kprintf("Physical RAM: %u allocatable - %u wasted\n", allocatable_ram, wasted_ram);
 
-		uint64_t base = ALIGN_2MIB(base_orig);
-		uint64_t length = length_orig - (base - base_orig);
+	//test_2MIB_alloc();
+	//test_4KIB_alloc();
+}
 
-		if (length < _2_MiB)
-		{
-			wasted_ram += length_orig;
-			continue;
-		}
+uint64_t phys_alloc_add_region(const uint64_t base_orig, const uint64_t length_orig)
+{
+	if (length_orig < _2_MiB)
+	{
+		return 0;
+	}
 
-		// Okay we can place something here
-		uint64_t count = 0;
-		do
-		{
-			StackNode* node = (StackNode*) (base + KERNEL_BASE);
-			stack_push(&stack_2MIB, node);
-			++count;
-			allocatable_ram += _2_MiB;
+	uint64_t base = ALIGN_2MIB(base_orig);
+	if (base - base_orig > length_orig - _2_MiB)
+	{
+		return 0;
+	}
+	uint64_t length = length_orig - (base - base_orig);
 
-			base += _2_MiB;
-			length -= _2_MiB;
-		} while (length >= _2_MiB);
+	// All of physical memory is mapped starting at the kernels half of the
+	// address space. Therefore in order to get a physical address the kernel's
+	// base address needs to be added to it.
+	uint64_t added = 0;
+	while (length >= _2_MiB)
+	{
+		StackNode* node = (StackNode*) (base + KERNEL_BASE);
+		stack_push(&stack_2MIB, node);
+		added += _2_MiB;
 
-		++usable;
-		wasted_ram += length;
+		base += _2_MiB;
+		length -= _2_MiB;
 	}
 
-	//test_2MIB_alloc();
-	//test_4KIB_alloc();
+	return added;
+}
+
+void phys_alloc_get_stats(PhysAllocStats* stats)
+{
+	stats->free_2MIB = stack_size(&stack_2MIB);
+	stats->pools = pools_in_use;
+	stats->partial_pools = 0;
+	stats->free_4KIB = 0;
+
+	for (const Pool* pool = pool_4KIB; pool != NULL; pool = pool->next)
+	{
+		const uint64_t untouched = 
+			((uint64_t)pool->max_address - (uint64_t)pool->implicit_next) / _4_KIB;
+
+		++stats->partial_pools;
+		stats->free_4KIB += stack_size(&pool->free_stack) + untouched;
+	}
 }
 
 /*
@@ -257,6 +276,7 @@ void* phys_alloc_4KIB()
 		pool_4KIB = (Pool*) PHYS_TO_VIRT(pool_4KIB);
 
 		pool_init(pool_4KIB);
+		++pools_in_use;
 		pool_4KIB->on_list = 1;
 	}
 
@@ -269,6 +289,10 @@ void* phys_alloc_4KIB()
 		pool_4KIB->prev = NULL;
 
 		pool_4KIB = p_next;
+		if (pool_4KIB != NULL)
+		{
+			pool_4KIB->prev = NULL;
+		}
 	}
 
 	void* final_value = VIRT_TO_PHYS(retVal);
@@ -295,11 +319,6 @@ void phys_free_4KIB(void* ptr)
 
 	pool_free(pool, (void*)address);
 
-	if (pool_4KIB == NULL)
-	{
-		panic("phys_free_4KIB bad free");
-	}
-
 	// Check if this pool is already in the pool list	
 	if (pool->on_list && pool_full(pool))
 	{
@@ -334,12 +353,17 @@ void phys_free_4KIB(void* ptr)
 
 		// Reset the pool just in case
 		pool_init(pool);
-		phys_free_2MIB(pool);
+		phys_free_2MIB(VIRT_TO_PHYS(pool));
+		--pools_in_use;
 	}
 	else if (!pool->on_list)
 	{
-		// Add to the head of the list
-		pool_4KIB->prev = pool;
+		// Add to the head of the list, which may be empty if
+		// every pool was used up
+		if (pool_4KIB != NULL)
+		{
+			pool_4KIB->prev = pool;
+		}
 		pool->next = pool_4KIB;
 		pool->prev = NULL;
 
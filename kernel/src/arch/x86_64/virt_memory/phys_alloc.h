@@ -1,8 +1,40 @@
 #ifndef __X86_64_VIRT_MEMORY_PHYS_ALLOC_H__
 #define __X86_64_VIRT_MEMORY_PHYS_ALLOC_H__
 
+#include "inttypes.h"
+
+/* A snapshot of the physical allocator, used to measure how
+ * fragmented memory is.
+ */
+typedef struct
+{
+	uint64_t free_2MIB;     // Whole 2MiB chunks available
+	uint64_t pools;         // 2MiB chunks split into 4KiB pages
+	uint64_t partial_pools; // Pools that still have free 4KiB pages
+	uint64_t free_4KIB;     // Free 4KiB pages inside of those pools
+} PhysAllocStats;
+
 void setup_physical_allocator(void);
 
+/* Give a region of physical memory to the allocator. Only the 2MiB
+ * aligned chunks that fit completely inside the region are used.
+ *
+ * Parameters:
+ *    base - The physical address of the region
+ *    length - The size of the region in bytes
+ *
+ * Returns:
+ *    The number of bytes that can be allocated from the region
+ */
+uint64_t phys_alloc_add_region(const uint64_t base, const uint64_t length);
+
+/* Get the current state of the allocator.
+ *
+ * Parameters:
+ *    stats - Filled in with the allocator's statistics
+ */
+void phys_alloc_get_stats(PhysAllocStats* stats);
+
 void* phys_alloc_2MIB(void);
 
 void* phys_alloc_2MIB_safe(const char* error);
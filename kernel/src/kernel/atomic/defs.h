@@ -1,8 +1,26 @@
 #ifndef __KERNEL_ATOMIC_H__
 #define __KERNEL_ATOMIC_H__
 
-extern inline atomic_inc(volatile int* num);
+/* Atomic operations and memory barriers, all of them inlined from the
+ * architecture's header:
+ *
+ *    atomic_cmpxchg(num, old, new)  - 32 bit compare and swap
+ *    atomic_cmpxchg64(num, old, new)
+ *    atomic_fetch_add(num, value)   - Returns the old value
+ *    atomic_fetch_add64(num, value)
+ *    atomic_xchg(num, value)        - Returns the old value
+ *    atomic_xchg64(num, value)
+ *    atomic_inc(num), atomic_dec(num)
+ *    cpu_relax()                    - Call in every spin loop
+ *
+ *    barrier()                      - Compiler only
+ *    mb(), rmb(), wmb()             - Full, read and write fences
+ *    smp_mb(), smp_rmb(), smp_wmb() - Only as strong as other
+ *                                     processors need
+ */
 
-extern inline atomic_dec(volatile int* num);
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/atomic.h"
+#endif
 
 #endif
@@ -34,9 +34,11 @@ void queue_enqueue_prio(Queue* queue, QueueNode* node,
 	else
 	{
 		const void* node_data = node->data;
+		QueueNode* prev = NULL;
 		QueueNode* other = queue->head;
 		while (other != NULL && cmp(node_data, other->data) > 0)
 		{
+			prev = other;
 			other = other->next;
 		}
 
@@ -54,8 +56,9 @@ void queue_enqueue_prio(Queue* queue, QueueNode* node,
 		}
 		else
 		{
-			node->next = other->next;
-			other->next = node;
+			// Goes between prev and other
+			node->next = other;
+			prev->next = node;
 		}
 
 		++queue->size;
@@ -77,6 +80,39 @@ QueueNode* queue_dequeue(Queue* q)
 	return returnVal;
 }
 
+QueueNode* queue_remove(Queue* q, const void* data)
+{
+	QueueNode* prev = NULL;
+	QueueNode* node = q->head;
+	for (uint64_t i = 0; i < q->size; ++i)
+	{
+		if (node->data == data)
+		{
+			if (prev == NULL)
+			{
+				q->head = node->next;
+			}
+			else
+			{
+				prev->next = node->next;
+			}
+
+			if (node == q->tail)
+			{
+				q->tail = prev;
+			}
+
+			--q->size;
+			return node;
+		}
+
+		prev = node;
+		node = node->next;
+	}
+
+	return NULL;
+}
+
 uint8_t queue_empty(const Queue* q)
 {
 	return q->size == 0;
@@ -61,6 +61,18 @@ void queue_enqueue_prio(Queue* queue, QueueNode* node,
  */
 QueueNode* queue_dequeue(Queue* queue);
 
+/* Take a node out of the queue, wherever it is. The node's next
+ * pointer is left alone, so the caller can still see what followed it.
+ *
+ * Parameters:
+ *    queue - The Queue object to search
+ *    data - The data of the node to take out
+ *
+ * Returns:
+ *    The node that held data, or NULL if it isn't in the queue
+ */
+QueueNode* queue_remove(Queue* queue, const void* data);
+
 /* Check if the queue is empty.
  *
  * Parameters:
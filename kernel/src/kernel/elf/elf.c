@@ -12,6 +12,7 @@
 #include "arch/x86_64/virt_memory/physical.h"
 #include "arch/x86_64/interrupts/imports.h"
 #include "arch/x86_64/interrupts/tss.h"
+#include "arch/x86_64/fpu/simd.h"
 #endif
 
 ELF_Error elf_create_process(PCB* pcb, void* elf_file, void* page_table)
@@ -136,7 +137,7 @@ ELF_Error elf_create_process(PCB* pcb, void* elf_file, void* page_table)
 			}
 			else
 			{
-				memclr(PHYS_TO_VIRT(memory_address), page_size);
+				page_clear(PHYS_TO_VIRT(memory_address), page_size);
 			}
 
 			load_offset += copy_amount;
@@ -158,19 +159,13 @@ ELF_Error elf_create_process(PCB* pcb, void* elf_file, void* page_table)
 			panic("ELF: Failed to allocate stack");
 		}
 
-		memclr(PHYS_TO_VIRT(memory_address), PAGE_SMALL_SIZE);
+		page_clear(PHYS_TO_VIRT(memory_address), PAGE_SMALL_SIZE);
 		address += PAGE_SMALL_SIZE;
 	}
 
-	// Allocate a place for the user context
-	virt_map_page(page_table, CONTEXT_STACK_LOCATION, PG_FLAG_RW, PAGE_SMALL, &memory_address);
-
-	pcb->context = (Context*)(CONTEXT_STACK_LOCATION + CONTEXT_STACK_SIZE - sizeof(Context));
-	
-	// The last memory_address will be the top of the stack!
-	kprintf("Memory address: 0x%x\n", memory_address);
-	kprintf("Virt address: 0x%x\n", PHYS_TO_VIRT(memory_address));
-	Context* context = (Context*)PHYS_TO_VIRT(memory_address+CONTEXT_STACK_SIZE-sizeof(Context));
+	// The user context lives at the top of the process's kernel stack
+	Context* context = pcb->context;
+	memclr(context, sizeof(Context));
 	kprintf("Context address: 0x%x\n", context);
 	context->IP = elf_hdr->e_entry;
 	context->SP = USER_STACK_LOCATION;//-0x10;
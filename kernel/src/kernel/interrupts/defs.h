@@ -10,7 +10,11 @@ typedef void (*interrupt_handler)(uint64_t vector, uint64_t error_code);
  */
 extern void interrupts_init(void);
 
-/* Install an interrupt handler at the specified vector number.
+/* Install an interrupt handler at the specified vector number. It can
+ * be replaced while interrupts are arriving, the handler is looked up
+ * inside rcu_read_lock(). The old one might still be running on
+ * another processor until synchronize_rcu() returns, unless it
+ * switched processes itself.
  */
 extern void interrupts_install_isr(uint64_t vector, interrupt_handler handler);
 
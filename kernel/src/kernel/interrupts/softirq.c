@@ -0,0 +1,67 @@
+#include "softirq.h"
+#include "defs.h"
+
+#include "safety.h"
+#include "kernel/panic.h"
+#include "kernel/smp/defs.h"
+#include "kernel/scheduler/scheduler.h"
+
+static softirq_handler handlers[NUM_SOFTIRQS];
+static uint64_t pending = 0;
+static uint8_t running = 0;
+
+void softirq_register(SoftIrq softirq, softirq_handler handler)
+{
+	ASSERT(softirq < NUM_SOFTIRQS);
+	handlers[softirq] = handler;
+}
+
+void softirq_raise(SoftIrq softirq)
+{
+	ASSERT(softirq < NUM_SOFTIRQS);
+	pending |= 1UL << softirq;
+}
+
+void softirq_run()
+{
+	if (running || pending == 0)
+	{
+		return;
+	}
+
+	running = 1;
+	preempt_disable();
+
+	for (uint64_t restart = 0; pending != 0 && restart < SOFTIRQ_MAX_RESTART; ++restart)
+	{
+		// Handlers can be raised again while these run
+		const uint64_t now = pending;
+		pending = 0;
+
+		interrupts_enable();
+		for (uint64_t i = 0; i < NUM_SOFTIRQS; ++i)
+		{
+			if ((now & (1UL << i)) != 0 && handlers[i] != NULL)
+			{
+				handlers[i]();
+			}
+		}
+		interrupts_disable();
+	}
+
+	preempt_enable();
+	running = 0;
+}
+
+void interrupts_exit()
+{
+	// TLB shootdowns don't take the kernel lock, if that's all that
+	// woke an idle processor it doesn't own anything here
+	if (!kernel_lock_held())
+	{
+		return;
+	}
+
+	softirq_run();
+	schedule_pending();
+}
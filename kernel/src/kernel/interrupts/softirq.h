@@ -0,0 +1,54 @@
+#ifndef __INTERRUPTS_SOFTIRQ_H__
+#define __INTERRUPTS_SOFTIRQ_H__
+
+#include "inttypes.h"
+
+/* Deferred interrupt processing. An interrupt handler only does what
+ * can't wait (talking to the device, acknowledging it) and raises a
+ * softirq for the rest. Softirqs run on the way out of the interrupt,
+ * with interrupts enabled but preemption disabled, so they can't race
+ * with system calls but don't hold off other interrupts either.
+ */
+
+typedef enum
+{
+	SOFTIRQ_KEYBOARD = 0,
+	SOFTIRQ_RCU,
+	NUM_SOFTIRQS
+} SoftIrq;
+
+typedef void (*softirq_handler)(void);
+
+/* How many times pending softirqs are rerun if more get raised while
+ * they run. Anything left after that waits for the next interrupt.
+ */
+#define SOFTIRQ_MAX_RESTART 4
+
+/* Set the handler for a softirq.
+ *
+ * Parameters:
+ *    softirq - The softirq to handle
+ *    handler - Called with interrupts enabled each time it is raised
+ */
+void softirq_register(SoftIrq softirq, softirq_handler handler);
+
+/* Mark a softirq as pending. Interrupts must be disabled.
+ *
+ * Parameters:
+ *    softirq - The softirq to run
+ */
+void softirq_raise(SoftIrq softirq);
+
+/* Run the pending softirqs, unless this interrupted one that is
+ * already running. Interrupts must be disabled, and are disabled
+ * again when this returns.
+ */
+void softirq_run(void);
+
+/* Called by the interrupt stubs after the handler returns, if the
+ * interrupted code had interrupts enabled. Runs the softirqs and then
+ * the scheduler if the handler asked for it.
+ */
+void interrupts_exit(void);
+
+#endif
@@ -0,0 +1,621 @@
+#include "channel.h"
+
+#include "safety.h"
+#include "kernel/klib.h"
+#include "kernel/kprintf.h"
+#include "kernel/alloc/alloc.h"
+#include "kernel/data_structures/block.h"
+#include "kernel/scheduler/events.h"
+#include "kernel/scheduler/scheduler.h"
+#include "kernel/scheduler/thread.h"
+#include "kernel/scheduler/waitqueue.h"
+#include "kernel/syscalls/uaccess.h"
+#include "kernel/virt_memory/defs.h"
+
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/uaccess/uaccess.h"
+#include "arch/x86_64/virt_memory/phys_alloc.h"
+#endif
+
+#ifndef DEBUG_CHANNEL
+#define kprintf(...)
+#endif
+
+COMPILE_ASSERT((CHANNEL_SLOTS & (CHANNEL_SLOTS - 1)) == 0);
+COMPILE_ASSERT(CHANNEL_MAX*2 < 0xFF);
+
+// An end's id is its channel's index and which end it is
+#define END_ID(INDEX, END) (((INDEX) << 1) | (END))
+#define END_INDEX(ID) ((ID) >> 1)
+#define END_PEER(ID)  ((ID) ^ 1)
+
+// The ends a process can use, its handles index this. Each entry is an
+// end's id + 1, 0 if the handle is free.
+typedef struct ChannelTable
+{
+	uint32_t refs; // Threads that haven't exited
+	uint8_t ends[CHANNEL_HANDLES];
+} ChannelTable;
+
+typedef struct
+{
+	uint64_t size;
+	uint64_t page_count;
+	uint8_t data[IPC_INLINE_SIZE];
+	uint64_t frames[IPC_MAX_PAGES]; // Physical addresses, mapped nowhere
+} Message;
+
+// Someone blocked in channel_recv(), lives on its kernel stack
+typedef struct Receiver
+{
+	struct Receiver* next;
+	PCB* pcb;
+	Message* msg;  // Filled in by the sender
+	uint8_t done;
+} Receiver;
+
+typedef struct
+{
+	Message slots[CHANNEL_SLOTS]; // Sent to this end, not received yet
+	uint32_t head;
+	uint32_t tail;
+	Receiver* receivers;      // Oldest first, only while slots is empty
+	Receiver* receivers_tail;
+	WaitQueue senders;        // Waiting for room in slots
+	uint32_t refs;            // Handles to it in every process's table
+	uint8_t open;             // Until refs drops to 0
+} Endpoint;
+
+typedef struct
+{
+	Endpoint ends[2];
+	uint8_t used;
+} Channel;
+
+static Channel* channels = NULL;
+static BlockAllocator* ba_tables = NULL;
+
+void channel_init()
+{
+	const uint64_t size_needed = sizeof(Channel)*CHANNEL_MAX;
+	channels = (Channel*)water_mark_alloc(&kernel_WaterMark, size_needed);
+	memclr(channels, size_needed);
+
+	const uint64_t tables_size = sizeof(ChannelTable)*CHANNEL_TABLES + sizeof(BlockAllocator);
+	const void* address = water_mark_alloc(&kernel_WaterMark, tables_size);
+	ba_tables = block_init(address, tables_size, sizeof(ChannelTable));
+}
+
+static Endpoint* end_of(uint32_t id)
+{
+	return &channels[END_INDEX(id)].ends[id & 1];
+}
+
+/* Where pcb's table is kept, threads share their ThreadGroup's.
+ */
+static ChannelTable** table_of(PCB* pcb)
+{
+	return pcb->group != NULL ? &pcb->group->channels : &pcb->channels;
+}
+
+/* Find the end one of pcb's handles refers to. It stays open for as
+ * long as the handle does, only pcb's process can close that.
+ *
+ * Returns:
+ *    1 with its id in id_out, 0 if the handle isn't in use
+ */
+static uint8_t lookup(PCB* pcb, uint32_t handle, uint32_t* id_out)
+{
+	ChannelTable* table = *table_of(pcb);
+	if (table == NULL || handle >= CHANNEL_HANDLES || table->ends[handle] == 0)
+	{
+		return 0;
+	}
+
+	*id_out = table->ends[handle] - 1;
+	ASSERT(end_of(*id_out)->open);
+	return 1;
+}
+
+static ChannelTable* table_get(PCB* pcb)
+{
+	ChannelTable** slot = table_of(pcb);
+	if (*slot != NULL)
+	{
+		return *slot;
+	}
+
+	ChannelTable* table = (ChannelTable*)block_alloc(ba_tables);
+	if (table == NULL)
+	{
+		return NULL;
+	}
+
+	// Every thread still running shares it, see channel_release()
+	memclr(table, sizeof(ChannelTable));
+	table->refs = pcb->group != NULL ? pcb->group->live : 1;
+	*slot = table;
+	return table;
+}
+
+static uint32_t table_free_slots(const ChannelTable* table)
+{
+	uint32_t count = 0;
+	for (uint32_t handle = 0; handle < CHANNEL_HANDLES; ++handle)
+	{
+		count += table->ends[handle] == 0;
+	}
+
+	return count;
+}
+
+// The table must have a free handle
+static uint32_t table_add(ChannelTable* table, uint32_t id)
+{
+	uint32_t handle = 0;
+	while (handle < CHANNEL_HANDLES && table->ends[handle] != 0)
+	{
+		++handle;
+	}
+	ASSERT(handle < CHANNEL_HANDLES);
+
+	table->ends[handle] = id + 1;
+	++end_of(id)->refs;
+	return handle;
+}
+
+static void free_frames(const Message* msg)
+{
+	for (uint64_t i = 0; i < msg->page_count; ++i)
+	{
+		phys_free_4KIB((void*)msg->frames[i]);
+	}
+}
+
+static void receiver_remove(Endpoint* end, Receiver* receiver)
+{
+	Receiver* prev = NULL;
+	for (Receiver* r = end->receivers; r != NULL; prev = r, r = r->next)
+	{
+		if (r != receiver)
+		{
+			continue;
+		}
+
+		if (prev == NULL) { end->receivers = r->next; }
+		else { prev->next = r->next; }
+
+		if (end->receivers_tail == r) { end->receivers_tail = prev; }
+		return;
+	}
+}
+
+static void wake_receivers(Endpoint* end)
+{
+	Receiver* r = end->receivers;
+	end->receivers = NULL;
+	end->receivers_tail = NULL;
+
+	for (; r != NULL; r = r->next)
+	{
+		wake_pcb(r->pcb);
+	}
+}
+
+// Anyone blocked on the endpoint gets to look at it again
+static void wake_everyone(Endpoint* end)
+{
+	wake_receivers(end);
+	wait_queue_wake_all(&end->senders);
+}
+
+Status channel_create(PCB* pcb, uint32_t ends[2])
+{
+	ChannelTable* table = table_get(pcb);
+	if (table == NULL || table_free_slots(table) < 2)
+	{
+		return FAILURE;
+	}
+
+	for (uint32_t index = 0; index < CHANNEL_MAX; ++index)
+	{
+		Channel* channel = &channels[index];
+		if (channel->used)
+		{
+			continue;
+		}
+
+		memclr(channel->ends, sizeof(channel->ends));
+		for (uint32_t end = 0; end < 2; ++end)
+		{
+			wait_queue_init(&channel->ends[end].senders);
+			channel->ends[end].open = 1;
+		}
+
+		channel->used = 1;
+		ends[0] = table_add(table, END_ID(index, 0));
+		ends[1] = table_add(table, END_ID(index, 1));
+
+		kprintf("Channel: %u made %u\n", pcb->pid, index);
+		return SUCCESS;
+	}
+
+	return FAILURE;
+}
+
+Status channel_fork(PCB* parent, PCB* child)
+{
+	ASSERT(child->group == NULL);
+	child->channels = NULL;
+	const ChannelTable* from = *table_of(parent);
+	if (from == NULL)
+	{
+		return SUCCESS;
+	}
+
+	ChannelTable* table = table_get(child);
+	if (table == NULL)
+	{
+		return FAILURE;
+	}
+
+	memcpy(table->ends, from->ends, sizeof(table->ends));
+	for (uint32_t handle = 0; handle < CHANNEL_HANDLES; ++handle)
+	{
+		if (table->ends[handle] != 0)
+		{
+			++end_of(table->ends[handle] - 1)->refs;
+		}
+	}
+
+	return SUCCESS;
+}
+
+void channel_share(PCB* pcb, PCB* thread)
+{
+	ThreadGroup* group = pcb->group;
+	ASSERT(group != NULL && thread->group == group);
+
+	// The process's first extra thread, its table goes to the group
+	if (pcb->channels != NULL)
+	{
+		ASSERT(group->channels == NULL);
+		group->channels = pcb->channels;
+		pcb->channels = NULL;
+	}
+
+	thread->channels = NULL;
+	if (group->channels != NULL)
+	{
+		++group->channels->refs;
+	}
+}
+
+/* Unmap the pages being sent. All or nothing, if one of them can't be
+ * taken the ones before it are put back.
+ */
+static Status take_pages(PCB* pcb, const IpcMessage* msg, Message* out)
+{
+	const uint64_t base = (uint64_t)msg->pages;
+	for (uint64_t i = 0; i < msg->page_count; ++i)
+	{
+		if (virt_detach_page(pcb->page_table, base + i*PAGE_SMALL_SIZE, &out->frames[i]))
+		{
+			continue;
+		}
+
+		while (i-- > 0)
+		{
+			// The tables for them are still there, so this can't fail
+			virt_map_phys(pcb->page_table, base + i*PAGE_SMALL_SIZE, out->frames[i],
+					PG_FLAG_RW | PG_FLAG_USER, PAGE_SMALL);
+		}
+
+		return BAD_ADDRESS;
+	}
+
+	out->page_count = msg->page_count;
+	return SUCCESS;
+}
+
+Status channel_send(PCB* pcb, uint32_t handle, const IpcMessage* msg)
+{
+	ASSERT(pcb == current_pcb);
+
+	uint32_t id = 0;
+	if (!lookup(pcb, handle, &id) || msg->size > IPC_INLINE_SIZE ||
+		msg->page_count > IPC_MAX_PAGES ||
+		((uint64_t)msg->pages & (PAGE_SMALL_SIZE - 1)) != 0)
+	{
+		return BAD_PARAM;
+	}
+
+	Message out;
+	out.size = msg->size;
+	out.page_count = 0;
+	if (copy_from_user(out.data, msg->data, msg->size) != SUCCESS)
+	{
+		return BAD_ADDRESS;
+	}
+
+	Endpoint* const to = end_of(END_PEER(id));
+	Receiver* receiver = NULL;
+	while (1)
+	{
+		// The other end could have been closed while we slept, or
+		// the process could be exiting
+		if (!to->open || thread_exiting(pcb))
+		{
+			return FAILURE;
+		}
+
+		receiver = to->receivers;
+		if (receiver != NULL || to->tail - to->head < CHANNEL_SLOTS)
+		{
+			break;
+		}
+
+		wait_queue_wait(&to->senders, 0);
+	}
+
+	// Nothing can block from here on, so nothing can change under us
+	const Status status = take_pages(pcb, msg, &out);
+	if (status != SUCCESS)
+	{
+		return status;
+	}
+
+	if (receiver != NULL)
+	{
+		// If it doesn't fit the receiver gets what does
+		kprintf("Channel: %u handed to %u\n", pcb->pid, receiver->pcb->pid);
+		receiver_remove(to, receiver);
+		memcpy(receiver->msg, &out, sizeof(Message));
+		receiver->done = 1;
+		wake_pcb(receiver->pcb);
+		return SUCCESS;
+	}
+
+	memcpy(&to->slots[to->tail & (CHANNEL_SLOTS - 1)], &out, sizeof(Message));
+	++to->tail;
+	events_raise_source(EVENT_CHANNEL, END_PEER(id));
+	return SUCCESS;
+}
+
+/* Put a received message in the caller's address space. Whatever
+ * doesn't fit in msg is thrown away.
+ */
+static Status deliver(PCB* pcb, const Message* in, IpcMessage* msg)
+{
+	Status status = SUCCESS;
+	uint64_t size = in->size;
+	uint64_t page_count = in->page_count;
+	if (size > msg->size || page_count > msg->page_count)
+	{
+		size = size > msg->size ? msg->size : size;
+		page_count = page_count > msg->page_count ? msg->page_count : page_count;
+		status = TRUNCATED;
+	}
+
+	for (uint64_t i = page_count; i < in->page_count; ++i)
+	{
+		phys_free_4KIB((void*)in->frames[i]);
+	}
+
+	const uint64_t base = (uint64_t)msg->pages;
+	for (uint64_t i = 0; i < page_count; ++i)
+	{
+		// Another thread could have put something there while we slept
+		uint64_t phys = 0;
+		const uint64_t virt = base + i*PAGE_SMALL_SIZE;
+		if ((virt_lookup_phys(pcb->page_table, virt, &phys) && phys != 0) ||
+			!virt_map_phys(pcb->page_table, virt, in->frames[i],
+				PG_FLAG_RW | PG_FLAG_USER, PAGE_SMALL))
+		{
+			phys_free_4KIB((void*)in->frames[i]);
+			status = BAD_ADDRESS;
+		}
+	}
+
+	if (copy_to_user(msg->data, in->data, size) != SUCCESS)
+	{
+		status = BAD_ADDRESS;
+	}
+
+	msg->size = size;
+	msg->page_count = page_count;
+	return status;
+}
+
+// Where the pages of a message can go, they all have to be unmapped
+static uint8_t pages_usable(PCB* pcb, const IpcMessage* msg)
+{
+	const uint64_t base = (uint64_t)msg->pages;
+	if (msg->page_count == 0)
+	{
+		return 1;
+	}
+
+	if ((base & (PAGE_SMALL_SIZE - 1)) != 0 || msg->page_count > IPC_MAX_PAGES ||
+		base >= USER_ADDRESS_END ||
+		msg->page_count > (USER_ADDRESS_END - base) / PAGE_SMALL_SIZE)
+	{
+		return 0;
+	}
+
+	for (uint64_t i = 0; i < msg->page_count; ++i)
+	{
+		uint64_t phys = 0;
+		if (virt_lookup_phys(pcb->page_table, base + i*PAGE_SMALL_SIZE, &phys) &&
+			phys != 0)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+Status channel_recv(PCB* pcb, uint32_t handle, IpcMessage* msg)
+{
+	ASSERT(pcb == current_pcb);
+
+	uint32_t id = 0;
+	if (!lookup(pcb, handle, &id))
+	{
+		return BAD_PARAM;
+	}
+
+	if (!pages_usable(pcb, msg))
+	{
+		return BAD_ADDRESS;
+	}
+
+	Endpoint* const at = end_of(id);
+	Message in;
+	while (1)
+	{
+		if (at->head != at->tail)
+		{
+			memcpy(&in, &at->slots[at->head & (CHANNEL_SLOTS - 1)], sizeof(Message));
+			++at->head;
+			wait_queue_wake_one(&at->senders);
+			break;
+		}
+
+		// Whatever was sent before it closed has been received
+		if (!end_of(END_PEER(id))->open || thread_exiting(pcb))
+		{
+			return FAILURE;
+		}
+
+		Receiver receiver;
+		receiver.next = NULL;
+		receiver.pcb = pcb;
+		receiver.msg = &in;
+		receiver.done = 0;
+
+		if (at->receivers_tail == NULL) { at->receivers = &receiver; }
+		else { at->receivers_tail->next = &receiver; }
+		at->receivers_tail = &receiver;
+
+		pcb->state = BLOCKED;
+		dispatch();
+
+		if (receiver.done)
+		{
+			break;
+		}
+
+		// Woken without a message, the other end closed and took us off
+		// already
+		receiver_remove(at, &receiver);
+	}
+
+	return deliver(pcb, &in, msg);
+}
+
+/* Drop one reference to an end, and close it if that was the last.
+ */
+static void end_put(uint32_t id)
+{
+	Endpoint* end = end_of(id);
+	ASSERT(end->refs > 0);
+	if (--end->refs > 0)
+	{
+		return;
+	}
+
+	// Nobody can receive these any more
+	for (; end->head != end->tail; ++end->head)
+	{
+		free_frames(&end->slots[end->head & (CHANNEL_SLOTS - 1)]);
+	}
+
+	end->open = 0;
+	Endpoint* peer = end_of(END_PEER(id));
+	wake_everyone(end);
+	wake_everyone(peer);
+
+	if (!peer->open)
+	{
+		channels[END_INDEX(id)].used = 0;
+		kprintf("Channel: freed %u\n", END_INDEX(id));
+	}
+	else
+	{
+		// Receiving on the other end won't block any more
+		events_raise_source(EVENT_CHANNEL, END_PEER(id));
+	}
+}
+
+Status channel_close(PCB* pcb, uint32_t handle)
+{
+	uint32_t id = 0;
+	if (!lookup(pcb, handle, &id))
+	{
+		return BAD_PARAM;
+	}
+
+	(*table_of(pcb))->ends[handle] = 0;
+
+	// Any of the process's threads could have registered for it
+	if (pcb->group == NULL)
+	{
+		events_remove_source(pcb, EVENT_CHANNEL, id);
+	}
+	else
+	{
+		uint64_t cursor = 0;
+		PCB* thread = NULL;
+		while ((thread = find_pcb(&cursor)) != NULL)
+		{
+			if (thread->group == pcb->group)
+			{
+				events_remove_source(thread, EVENT_CHANNEL, id);
+			}
+		}
+	}
+
+	end_put(id);
+	return SUCCESS;
+}
+
+void channel_release(PCB* pcb)
+{
+	ChannelTable** slot = table_of(pcb);
+	ChannelTable* table = *slot;
+	if (table == NULL)
+	{
+		return;
+	}
+
+	// The other threads can still use them
+	ASSERT(table->refs > 0);
+	if (--table->refs > 0)
+	{
+		return;
+	}
+
+	for (uint32_t handle = 0; handle < CHANNEL_HANDLES; ++handle)
+	{
+		if (table->ends[handle] != 0)
+		{
+			channel_close(pcb, handle);
+		}
+	}
+
+	block_free(ba_tables, table);
+	*slot = NULL;
+}
+
+Status channel_event_source(PCB* pcb, uint32_t handle, uint32_t* source)
+{
+	return lookup(pcb, handle, source) ? SUCCESS : BAD_PARAM;
+}
+
+uint8_t channel_ready(uint32_t source)
+{
+	const Endpoint* end = end_of(source);
+	return end->head != end->tail || !end_of(END_PEER(source))->open;
+}
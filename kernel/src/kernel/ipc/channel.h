@@ -0,0 +1,122 @@
+#ifndef __IPC_CHANNEL_H__
+#define __IPC_CHANNEL_H__
+
+#include "inttypes.h"
+#include "kernel/scheduler/pcb.h"
+#include "kernel/syscalls/types.h"
+
+/* Message channels between processes. A channel has two ends, what is
+ * sent on one is received on the other. Handles index the calling
+ * process's own table of ends, so they can't be guessed or used by
+ * anyone else. The threads of a process share the table through their
+ * ThreadGroup. fork() copies it, which is how a channel made before a
+ * fork() connects parent and child. An end is closed once every handle
+ * to it is.
+ *
+ * Up to IPC_INLINE_SIZE bytes of a message are copied, into a ring of
+ * CHANNEL_SLOTS messages at the receiving end. Bigger payloads are
+ * moved as pages, the frames are unmapped from the sender and mapped
+ * into the receiver without being copied.
+ *
+ * A sender that finds a receiver already waiting hands the message
+ * straight to it, skipping the ring.
+ *
+ * Everything here must be called with interrupts disabled.
+ */
+
+#define CHANNEL_MAX 32
+#define CHANNEL_SLOTS 8 // Must be a power of two
+#define CHANNEL_HANDLES 16 // In each process's table
+#define CHANNEL_TABLES 64
+
+/* Setup the channel table. Must be called after the kernel's
+ * allocators have been setup.
+ */
+void channel_init(void);
+
+/* Make a new channel.
+ *
+ * Parameters:
+ *    pcb - Who gets the handles to both ends
+ *    ends - Where to put them
+ *
+ * Returns:
+ *    SUCCESS, or FAILURE if there are CHANNEL_MAX channels already or
+ *    pcb doesn't have two free handles
+ */
+Status channel_create(PCB* pcb, uint32_t ends[2]);
+
+/* Give a new process copies of its parent's handles.
+ *
+ * Returns:
+ *    SUCCESS, or FAILURE if there are no tables left
+ */
+Status channel_fork(PCB* parent, PCB* child);
+
+/* Let a new thread use its process's handles. The first thread made
+ * hands the process's table over to the ThreadGroup.
+ *
+ * Parameters:
+ *    pcb - The thread that made it
+ *    thread - The new thread, already in pcb's group
+ */
+void channel_share(PCB* pcb, PCB* thread);
+
+/* Send a message to the other end, blocking while its ring is full.
+ *
+ * Parameters:
+ *    pcb - The caller, must be current_pcb
+ *    handle - The end to send from
+ *    msg - What to send, its pointers are in pcb's address space
+ *
+ * Returns:
+ *    SUCCESS, BAD_PARAM for a bad handle or a message that is too
+ *    big, BAD_ADDRESS if anything to send isn't mapped, or FAILURE if
+ *    either end is closed
+ */
+Status channel_send(PCB* pcb, uint32_t handle, const IpcMessage* msg);
+
+/* Receive the oldest message sent to this end, blocking until there
+ * is one.
+ *
+ * Parameters:
+ *    pcb - The caller, must be current_pcb
+ *    handle - The end to receive on
+ *    msg - Where to put it, size and page_count are set to what came
+ *
+ * Returns:
+ *    SUCCESS, TRUNCATED if the message didn't fit and the rest of it
+ *    was thrown away, BAD_PARAM for a bad handle, BAD_ADDRESS if the
+ *    buffer or pages can't be used, or FAILURE once the other end is
+ *    closed and nothing is left
+ */
+Status channel_recv(PCB* pcb, uint32_t handle, IpcMessage* msg);
+
+/* Close one of pcb's handles, and any EVENT_CHANNEL any of its
+ * process's threads registered for it.
+ * Once the end has no handles left, messages still waiting there are
+ * thrown away and anyone blocked on the channel wakes up. The channel
+ * is gone once both ends are closed.
+ */
+Status channel_close(PCB* pcb, uint32_t handle);
+
+/* Drop a thread's use of its process's handles, and close them all
+ * once no thread is left using them. Called when it exits.
+ */
+void channel_release(PCB* pcb);
+
+/* Find what an EVENT_CHANNEL registration for one of pcb's handles
+ * waits on, the same for every handle to that end.
+ *
+ * Returns:
+ *    SUCCESS, or BAD_PARAM for a bad handle
+ */
+Status channel_event_source(PCB* pcb, uint32_t handle, uint32_t* source);
+
+/* Returns:
+ *    1 if receiving on source wouldn't block, there's a message or
+ *    the other end is closed
+ */
+uint8_t channel_ready(uint32_t source);
+
+#endif
@@ -7,4 +7,9 @@ uint8_t keyboard_char_available(void);
 
 uint8_t keyboard_get_char(void);
 
+/* Like keyboard_get_char(), but blocks current_pcb until there is a
+ * character instead of returning '\0'. Interrupts must be disabled.
+ */
+uint8_t keyboard_read_char(void);
+
 #endif
@@ -1,15 +1,88 @@
 #include "klib.h"
 
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/cpuid.h"
+
+// CPUID leaf 7
+#define CPUID_EBX_ERMS 0x200 // Enhanced rep movsb and stosb
+#define CPUID_EDX_FSRM 0x10  // Fast short rep movsb
+
+// Without FSRM, rep movsb takes a while to get going and the loops win
+// below this
+#define ERMS_MIN_SIZE 256
+
+static uint8_t erms = 0;
+static uint8_t fsrm = 0;
+static uint8_t use_strings = 0;
+#endif
+
+void klib_init()
+{
+#ifdef BIKESHED_X86_64
+	uint32_t eax, ebx, ecx, edx;
+	cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+	erms = (ebx & CPUID_EBX_ERMS) != 0;
+	fsrm = (edx & CPUID_EDX_FSRM) != 0;
+
+	// rep stosq is fast on everything, it's only the byte versions
+	// that need checking
+	use_strings = 1;
+#endif
+}
+
+#ifdef BIKESHED_X86_64
+static inline __attribute__((always_inline))
+void rep_movsb(void* dst, const void* src, uint64_t size)
+{
+	__asm__ volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(size) :: "memory");
+}
+
+static inline __attribute__((always_inline))
+void rep_stosb(void* dst, uint8_t val, uint64_t size)
+{
+	__asm__ volatile("rep stosb" : "+D"(dst), "+c"(size) : "a"(val) : "memory");
+}
+
+static inline __attribute__((always_inline))
+void rep_stosq(void* dst, uint64_t val, uint64_t count)
+{
+	__asm__ volatile("rep stosq" : "+D"(dst), "+c"(count) : "a"(val) : "memory");
+}
+
+// Whether the byte versions are worth it for this size
+static inline __attribute__((always_inline))
+uint8_t fast_bytes(uint64_t size)
+{
+	return fsrm || (erms && size >= ERMS_MIN_SIZE);
+}
+#endif
+
 void memclr(void* ptr, uint64_t size)
 {
+#ifdef BIKESHED_X86_64
+	if (use_strings && fast_bytes(size))
+	{
+		rep_stosb(ptr, 0, size);
+		return;
+	}
+#endif
+
 	uint8_t* p8 = (uint8_t*)ptr;
-	while (((uint64_t)p8 & 0x7) != 0)
+	while (size > 0 && ((uint64_t)p8 & 0x7) != 0)
 	{
 		*p8++ = 0;
 		--size;
 	}
 
 	uint64_t* p64 = (uint64_t*)p8;
+#ifdef BIKESHED_X86_64
+	if (use_strings)
+	{
+		rep_stosq(p64, 0, size / 8);
+		p64 += size / 8;
+		size &= 7;
+	}
+#endif
 	while (size >= 8)
 	{
 		*p64++ = 0;
@@ -29,8 +102,16 @@ void memclr(void* ptr, uint64_t size)
 
 void memset(void* ptr, const uint8_t val, uint64_t size)
 {
+#ifdef BIKESHED_X86_64
+	if (use_strings && fast_bytes(size))
+	{
+		rep_stosb(ptr, val, size);
+		return;
+	}
+#endif
+
 	uint8_t* p8 = (uint8_t*)ptr;
-	while (((uint64_t)p8 & 0x7) != 0)
+	while (size > 0 && ((uint64_t)p8 & 0x7) != 0)
 	{
 		*p8++ = val;
 		--size;
@@ -59,9 +140,17 @@ void memset(void* ptr, const uint8_t val, uint64_t size)
 
 void* memcpy(void* dst, const void* src, uint64_t size)
 {
+#ifdef BIKESHED_X86_64
+	if (use_strings && fast_bytes(size))
+	{
+		rep_movsb(dst, src, size);
+		return dst;
+	}
+#endif
+
 	uint8_t* d8 = (uint8_t*)dst;
 	const uint8_t* s8 = (const uint8_t*)src;
-	while (((uint64_t)d8 & 0x7) != 0)
+	while (size > 0 && ((uint64_t)d8 & 0x7) != 0)
 	{
 		*d8++ = *s8++;
 		--size;
@@ -88,3 +177,72 @@ void* memcpy(void* dst, const void* src, uint64_t size)
 
 	return dst;
 }
+
+void memclr_nt(void* ptr, uint64_t size)
+{
+#ifdef BIKESHED_X86_64
+	if (size == 0)
+	{
+		return;
+	}
+
+	// A cache line per trip, the stores are combined on their way out
+	uint64_t* p = (uint64_t*)ptr;
+	__asm__ volatile(
+			"1:\n\t"
+			"movnti %2, 0(%0)\n\t"
+			"movnti %2, 8(%0)\n\t"
+			"movnti %2, 16(%0)\n\t"
+			"movnti %2, 24(%0)\n\t"
+			"movnti %2, 32(%0)\n\t"
+			"movnti %2, 40(%0)\n\t"
+			"movnti %2, 48(%0)\n\t"
+			"movnti %2, 56(%0)\n\t"
+			"addq $64, %0\n\t"
+			"subq $64, %1\n\t"
+			"jnz 1b\n\t"
+			"sfence"
+			: "+r"(p), "+r"(size) : "r"((uint64_t)0) : "memory", "cc");
+#else
+	memclr(ptr, size);
+#endif
+}
+
+void memcpy_nt(void* dst, const void* src, uint64_t size)
+{
+#ifdef BIKESHED_X86_64
+	if (size == 0)
+	{
+		return;
+	}
+
+	uint64_t* d = (uint64_t*)dst;
+	const uint64_t* s = (const uint64_t*)src;
+	__asm__ volatile(
+			"1:\n\t"
+			"movq 0(%1), %%rax\n\t"
+			"movq 8(%1), %%rdx\n\t"
+			"movq 16(%1), %%r8\n\t"
+			"movq 24(%1), %%r9\n\t"
+			"movnti %%rax, 0(%0)\n\t"
+			"movnti %%rdx, 8(%0)\n\t"
+			"movnti %%r8, 16(%0)\n\t"
+			"movnti %%r9, 24(%0)\n\t"
+			"movq 32(%1), %%rax\n\t"
+			"movq 40(%1), %%rdx\n\t"
+			"movq 48(%1), %%r8\n\t"
+			"movq 56(%1), %%r9\n\t"
+			"movnti %%rax, 32(%0)\n\t"
+			"movnti %%rdx, 40(%0)\n\t"
+			"movnti %%r8, 48(%0)\n\t"
+			"movnti %%r9, 56(%0)\n\t"
+			"addq $64, %0\n\t"
+			"addq $64, %1\n\t"
+			"subq $64, %2\n\t"
+			"jnz 1b\n\t"
+			"sfence"
+			: "+r"(d), "+r"(s), "+r"(size) :: "rax", "rdx", "r8", "r9", "memory", "cc");
+#else
+	memcpy(dst, src, size);
+#endif
+}
@@ -22,6 +22,12 @@ uint64_t clamp(uint64_t val, uint64_t min, uint64_t max)
 	return val;
 }
 
+/* Pick how the functions below are done from what the processor has,
+ * they use plain loops until this is called. Every processor is
+ * assumed to have what the first one does.
+ */
+void klib_init(void);
+
 /* Zero out a region of memory
  *
  * Parameters:
@@ -52,4 +58,12 @@ void memset(void* ptr, uint8_t val, uint64_t size);
  */
 void* memcpy(void* dst, const void* src, uint64_t size);
 
+/* memclr() and memcpy() for whole pages that won't be read again soon,
+ * the stores go around the caches instead of pushing everything else
+ * out of them. Everything must be 8 byte aligned, and size a multiple
+ * of 64.
+ */
+void memclr_nt(void* ptr, uint64_t size);
+void memcpy_nt(void* dst, const void* src, uint64_t size);
+
 #endif
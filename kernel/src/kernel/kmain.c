@@ -1,22 +1,33 @@
+#include "kernel/klib.h"
 #include "kernel/elf/elf.h"
 #include "kernel/kprintf.h"
 #include "kernel/sound/defs.h"
 #include "kernel/timer/defs.h"
 #include "kernel/alloc/alloc.h"
 #include "kernel/keyboard/defs.h"
+#include "kernel/smp/defs.h"
+#include "kernel/rcu/rcu.h"
 #include "kernel/interrupts/defs.h"
 #include "kernel/virt_memory/defs.h"
 #include "kernel/syscalls/syscalls.h"
 #include "kernel/scheduler/scheduler.h"
+#include "kernel/scheduler/workqueue.h"
+#include "kernel/vdso/vdso.h"
 
 void kmain(void)
 {
+	/* Pick how memcpy and friends are done */
+	klib_init();
+
 	/* Initialize the memory sub-system */
 	virt_memory_init();
 
 	/* Initialize the kernel's memory allocators */
 	alloc_init();
 
+	/* Map the page processes read the kernel's data from */
+	vdso_init();
+
 	/* Initialize the interupt sub-system */
 	interrupts_init();
 
@@ -26,12 +37,21 @@ void kmain(void)
 	/* Initialize the scheduler */
 	scheduler_init();
 
+	/* Start the work queue's kernel thread */
+	workqueue_init();
+
+	/* Setup read-copy-update's grace periods */
+	rcu_init();
+
 	/* Initialize the timer */
 //	timer_init();
 
 	/* Initialize the system calls */
 	syscalls_init();
 
+	/* Start the other processors */
+	smp_init();
+
 	/* Initialize the sound driver */
 //	sound_init();
 
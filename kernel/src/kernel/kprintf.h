@@ -24,4 +24,9 @@
  */
 extern void kprintf(const char* fmt, ...);
 
+/* Same as kprintf() except the output only goes to the serial port,
+ * useful for dumping large amounts of debugging information.
+ */
+extern void serial_printf(const char* fmt, ...);
+
 #endif
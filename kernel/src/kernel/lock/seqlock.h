@@ -0,0 +1,71 @@
+#ifndef __KERNEL_LOCK_SEQLOCK_H__
+#define __KERNEL_LOCK_SEQLOCK_H__
+
+#include "inttypes.h"
+#include "kernel/atomic/defs.h"
+
+/* A sequence count, for data that is written rarely by one writer and
+ * read often by anyone. Readers never block the writer, they retry if
+ * it changed the data while they were looking:
+ *
+ *    uint32_t seq;
+ *    do {
+ *        seq = seq_read_begin(&count);
+ *        ... copy the data ...
+ *    } while (seq_read_retry(&count, seq));
+ *
+ * Writers have to be serialised some other way, the kernel lock is
+ * usually enough. Everything is inline so user programs can read data
+ * the kernel publishes this way.
+ */
+
+typedef struct
+{
+	volatile uint32_t seq; // Odd while a write is in progress
+} SeqCount;
+
+static inline __attribute__((always_inline))
+void seq_init(SeqCount* count)
+{
+	count->seq = 0;
+}
+
+static inline __attribute__((always_inline))
+void seq_write_begin(SeqCount* count)
+{
+	++count->seq;
+	smp_wmb();
+}
+
+static inline __attribute__((always_inline))
+void seq_write_end(SeqCount* count)
+{
+	smp_wmb();
+	++count->seq;
+}
+
+static inline __attribute__((always_inline))
+uint32_t seq_read_begin(const volatile SeqCount* count)
+{
+	uint32_t seq;
+	while ((seq = count->seq) & 1)
+	{
+		cpu_relax();
+	}
+
+	smp_rmb();
+	return seq;
+}
+
+/* Returns:
+ *    Non-zero if a write happened since seq_read_begin(), and what was
+ *    read has to be thrown away
+ */
+static inline __attribute__((always_inline))
+uint8_t seq_read_retry(const volatile SeqCount* count, uint32_t seq)
+{
+	smp_rmb();
+	return count->seq != seq;
+}
+
+#endif
@@ -0,0 +1,295 @@
+#include "spinlock.h"
+
+#include "safety.h"
+#include "kernel/kprintf.h"
+#include "kernel/atomic/defs.h"
+#include "kernel/timer/defs.h"
+#include "kernel/interrupts/defs.h"
+
+#ifdef DEBUG_LOCKS
+
+#define MAX_TRACKED_LOCKS 64
+
+static LockStats* tracked[MAX_TRACKED_LOCKS];
+static volatile uint32_t num_tracked = 0;
+
+static void stats_init(LockStats* stats, const char* name)
+{
+	stats->name = name;
+	stats->acquisitions = 0;
+	stats->contended = 0;
+	stats->spin_cycles = 0;
+	stats->max_spin = 0;
+
+	const uint32_t slot = atomic_fetch_add(&num_tracked, 1);
+	if (slot < MAX_TRACKED_LOCKS)
+	{
+		tracked[slot] = stats;
+	}
+}
+
+// Only called while holding the lock, so nothing else writes these
+static void stats_acquired(LockStats* stats, uint64_t spin_start)
+{
+	++stats->acquisitions;
+	if (spin_start != 0)
+	{
+		const uint64_t spun = timer_get_cycles() - spin_start;
+		++stats->contended;
+		stats->spin_cycles += spun;
+		if (spun > stats->max_spin)
+		{
+			stats->max_spin = spun;
+		}
+	}
+}
+
+#define STATS_INIT(LOCK, NAME) stats_init(&(LOCK)->stats, NAME)
+#define SPIN_START() timer_get_cycles()
+#define STATS_ACQUIRED(LOCK, START) stats_acquired(&(LOCK)->stats, START)
+
+void lock_stats_dump()
+{
+	const uint32_t count = num_tracked < MAX_TRACKED_LOCKS ? num_tracked : MAX_TRACKED_LOCKS;
+	kprintf("Lock: taken contended spin_cycles max_spin\n");
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const LockStats* stats = tracked[i];
+		kprintf("%s: %u %u %u %u\n", stats->name, stats->acquisitions,
+				stats->contended, stats->spin_cycles, stats->max_spin);
+	}
+}
+
+#else
+
+#define STATS_INIT(LOCK, NAME) UNUSED(NAME)
+#define SPIN_START() 1
+#define STATS_ACQUIRED(LOCK, START) UNUSED(START)
+
+void lock_stats_dump()
+{
+}
+
+#endif
+
+//=============================================================================
+// Spinlock
+//=============================================================================
+
+void spin_init(Spinlock* lock, const char* name)
+{
+	lock->locked = 0;
+	STATS_INIT(lock, name);
+}
+
+void spin_lock(Spinlock* lock)
+{
+	if (atomic_xchg(&lock->locked, 1) == 0)
+	{
+		STATS_ACQUIRED(lock, 0);
+		return;
+	}
+
+	// Only read while it's taken, so the cache line isn't bounced
+	// around by the locked instruction
+	const uint64_t start = SPIN_START();
+	do
+	{
+		while (lock->locked)
+		{
+			cpu_relax();
+		}
+	}
+	while (atomic_xchg(&lock->locked, 1) != 0);
+
+	STATS_ACQUIRED(lock, start);
+}
+
+uint8_t spin_trylock(Spinlock* lock)
+{
+	if (lock->locked || atomic_xchg(&lock->locked, 1) != 0)
+	{
+		return 0;
+	}
+
+	STATS_ACQUIRED(lock, 0);
+	return 1;
+}
+
+void spin_unlock(Spinlock* lock)
+{
+	ASSERT(lock->locked);
+
+	// A plain store is enough on x86, it can't pass the earlier ones
+	barrier();
+	lock->locked = 0;
+}
+
+uint64_t spin_lock_irqsave(Spinlock* lock)
+{
+	const uint64_t flags = interrupts_save();
+	spin_lock(lock);
+
+	return flags;
+}
+
+void spin_unlock_irqrestore(Spinlock* lock, uint64_t flags)
+{
+	spin_unlock(lock);
+	interrupts_restore(flags);
+}
+
+//=============================================================================
+// TicketLock
+//=============================================================================
+
+void ticket_init(TicketLock* lock, const char* name)
+{
+	lock->next = 0;
+	lock->serving = 0;
+	STATS_INIT(lock, name);
+}
+
+void ticket_lock(TicketLock* lock)
+{
+	ticket_lock_wait(lock, NULL);
+}
+
+void ticket_lock_wait(TicketLock* lock, void (*wait)(void))
+{
+	const uint32_t ticket = atomic_fetch_add(&lock->next, 1);
+	if (lock->serving == ticket)
+	{
+		STATS_ACQUIRED(lock, 0);
+		return;
+	}
+
+	const uint64_t start = SPIN_START();
+	while (lock->serving != ticket)
+	{
+		if (wait != NULL)
+		{
+			wait();
+		}
+		cpu_relax();
+	}
+
+	STATS_ACQUIRED(lock, start);
+}
+
+uint8_t ticket_trylock(TicketLock* lock)
+{
+	// Only works if nobody is holding or waiting for it
+	const uint32_t serving = lock->serving;
+	if (atomic_cmpxchg(&lock->next, serving, serving + 1) != serving)
+	{
+		return 0;
+	}
+
+	STATS_ACQUIRED(lock, 0);
+	return 1;
+}
+
+void ticket_unlock(TicketLock* lock)
+{
+	ASSERT(lock->next != lock->serving);
+
+	// Only the holder writes serving
+	barrier();
+	lock->serving = lock->serving + 1;
+}
+
+uint64_t ticket_lock_irqsave(TicketLock* lock)
+{
+	const uint64_t flags = interrupts_save();
+	ticket_lock(lock);
+
+	return flags;
+}
+
+void ticket_unlock_irqrestore(TicketLock* lock, uint64_t flags)
+{
+	ticket_unlock(lock);
+	interrupts_restore(flags);
+}
+
+//=============================================================================
+// RWLock
+//=============================================================================
+
+void rw_init(RWLock* lock, const char* name)
+{
+	lock->state = 0;
+	STATS_INIT(lock, name);
+}
+
+void read_lock(RWLock* lock)
+{
+	uint64_t start = 0;
+	while (1)
+	{
+		const uint32_t state = lock->state;
+		if ((state & RW_WRITER) == 0 &&
+			atomic_cmpxchg(&lock->state, state, state + 1) == state)
+		{
+			break;
+		}
+
+		if (start == 0)
+		{
+			start = SPIN_START();
+		}
+		cpu_relax();
+	}
+
+	// Readers share the stats, they're only a rough count
+	STATS_ACQUIRED(lock, start);
+}
+
+void read_unlock(RWLock* lock)
+{
+	ASSERT((lock->state & RW_READERS) > 0);
+	atomic_fetch_add(&lock->state, (uint32_t)-1);
+}
+
+void write_lock(RWLock* lock)
+{
+	uint64_t start = 0;
+
+	// Claim it first so no new readers get in
+	while (1)
+	{
+		const uint32_t state = lock->state;
+		if ((state & RW_WRITER) == 0 &&
+			atomic_cmpxchg(&lock->state, state, state | RW_WRITER) == state)
+		{
+			break;
+		}
+
+		if (start == 0)
+		{
+			start = SPIN_START();
+		}
+		cpu_relax();
+	}
+
+	// Then wait for the readers already inside to leave
+	while (lock->state & RW_READERS)
+	{
+		if (start == 0)
+		{
+			start = SPIN_START();
+		}
+		cpu_relax();
+	}
+
+	STATS_ACQUIRED(lock, start);
+}
+
+void write_unlock(RWLock* lock)
+{
+	ASSERT(lock->state == RW_WRITER);
+
+	barrier();
+	lock->state = 0;
+}
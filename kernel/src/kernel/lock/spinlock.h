@@ -0,0 +1,121 @@
+#ifndef __KERNEL_LOCK_SPINLOCK_H__
+#define __KERNEL_LOCK_SPINLOCK_H__
+
+#include "inttypes.h"
+
+/* Busy waiting locks for data shared between processors.
+ *
+ *    Spinlock   - Test and test-and-set, cheapest when uncontended
+ *    TicketLock - Taken in the order processors asked for it
+ *    RWLock     - Any number of readers or one writer. A waiting
+ *                 writer keeps new readers out so it can't starve
+ *
+ * None of them disable interrupts. Use the _irqsave versions if an
+ * interrupt handler can take the same lock, or it will deadlock
+ * against the code it interrupted.
+ *
+ * Building with DEBUG_LOCKS counts every acquisition and how many
+ * cycles were spent spinning on each lock, see lock_stats_dump().
+ */
+
+#ifdef DEBUG_LOCKS
+typedef struct
+{
+	const char* name;
+	uint64_t acquisitions;
+	uint64_t contended;   // Acquisitions that had to spin
+	uint64_t spin_cycles; // Total time spent spinning
+	uint64_t max_spin;    // Longest single spin
+} LockStats;
+#endif
+
+typedef struct
+{
+	volatile uint32_t locked;
+#ifdef DEBUG_LOCKS
+	LockStats stats;
+#endif
+} Spinlock;
+
+typedef struct
+{
+	volatile uint32_t next;    // The next ticket to hand out
+	volatile uint32_t serving; // Whose turn it is
+#ifdef DEBUG_LOCKS
+	LockStats stats;
+#endif
+} TicketLock;
+
+typedef struct
+{
+	volatile uint32_t state;   // RW_WRITER and the number of readers
+#ifdef DEBUG_LOCKS
+	LockStats stats;
+#endif
+} RWLock;
+
+#define RW_WRITER 0x80000000
+#define RW_READERS 0x7FFFFFFF
+
+/* Setup a lock. The name is only used by lock_stats_dump().
+ *
+ * Parameters:
+ *    lock - The lock to setup
+ *    name - What to call it
+ */
+void spin_init(Spinlock* lock, const char* name);
+
+void spin_lock(Spinlock* lock);
+
+/* Returns:
+ *    1 if the lock was taken, 0 if someone else has it
+ */
+uint8_t spin_trylock(Spinlock* lock);
+
+void spin_unlock(Spinlock* lock);
+
+/* Disable interrupts and take the lock.
+ *
+ * Returns:
+ *    The flags to give spin_unlock_irqrestore()
+ */
+uint64_t spin_lock_irqsave(Spinlock* lock);
+
+void spin_unlock_irqrestore(Spinlock* lock, uint64_t flags);
+
+void ticket_init(TicketLock* lock, const char* name);
+
+void ticket_lock(TicketLock* lock);
+
+/* Like ticket_lock(), with something to do while waiting.
+ *
+ * Parameters:
+ *    lock - The lock to take
+ *    wait - Called every time around the spin loop, may be NULL
+ */
+void ticket_lock_wait(TicketLock* lock, void (*wait)(void));
+
+uint8_t ticket_trylock(TicketLock* lock);
+
+void ticket_unlock(TicketLock* lock);
+
+uint64_t ticket_lock_irqsave(TicketLock* lock);
+
+void ticket_unlock_irqrestore(TicketLock* lock, uint64_t flags);
+
+void rw_init(RWLock* lock, const char* name);
+
+void read_lock(RWLock* lock);
+
+void read_unlock(RWLock* lock);
+
+void write_lock(RWLock* lock);
+
+void write_unlock(RWLock* lock);
+
+/* Print the statistics of every lock that has been setup. Does nothing
+ * unless built with DEBUG_LOCKS.
+ */
+void lock_stats_dump(void);
+
+#endif
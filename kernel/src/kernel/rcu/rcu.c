@@ -0,0 +1,222 @@
+#include "rcu.h"
+
+#include "safety.h"
+#include "kernel/kprintf.h"
+#include "kernel/smp/defs.h"
+#include "kernel/interrupts/defs.h"
+#include "kernel/interrupts/softirq.h"
+
+#ifndef DEBUG_RCU
+#define kprintf(...)
+#endif
+
+typedef struct
+{
+	RcuHead* head;
+	RcuHead** tail;
+} RcuList;
+
+// Each processor only writes its own, everyone reads them
+static volatile uint64_t quiescent_count[MAX_CPUS];
+static volatile uint8_t idle[MAX_CPUS];
+
+// Callbacks that haven't been given a grace period yet, ones waiting
+// on the current one, and ones whose grace period is over
+static RcuList pending;
+static RcuList waiting;
+static RcuList done;
+
+// The current grace period, only touched with the kernel lock held
+static uint8_t gp_active = 0;
+static uint64_t gp_snapshot[MAX_CPUS];
+static uint8_t gp_passed[MAX_CPUS];
+static uint64_t gp_completed = 0;
+
+typedef struct
+{
+	RcuHead head;
+	PCB* pcb;
+	volatile uint8_t finished;
+} RcuWaiter;
+
+static void list_reset(RcuList* list)
+{
+	list->head = NULL;
+	list->tail = &list->head;
+}
+
+static void list_append(RcuList* list, RcuList* other)
+{
+	if (other->head == NULL)
+	{
+		return;
+	}
+
+	*list->tail = other->head;
+	list->tail = other->tail;
+	list_reset(other);
+}
+
+static void rcu_softirq()
+{
+	// Take all of them at once, more can finish while these run
+	interrupts_disable();
+	RcuHead* head = done.head;
+	list_reset(&done);
+	interrupts_enable();
+
+	while (head != NULL)
+	{
+		RcuHead* const next = head->next;
+		head->func(head);
+		head = next;
+	}
+}
+
+void rcu_init()
+{
+	list_reset(&pending);
+	list_reset(&waiting);
+	list_reset(&done);
+
+	softirq_register(SOFTIRQ_RCU, rcu_softirq);
+}
+
+void call_rcu(RcuHead* head, void (*func)(RcuHead* head))
+{
+	head->next = NULL;
+	head->func = func;
+
+	const uint64_t flags = interrupts_save();
+	*pending.tail = head;
+	pending.tail = &head->next;
+	interrupts_restore(flags);
+}
+
+static void synchronize_done(RcuHead* head)
+{
+	RcuWaiter* waiter = (RcuWaiter*)head;
+	waiter->finished = 1;
+	if (waiter->pcb->state == BLOCKED)
+	{
+		wake_pcb(waiter->pcb);
+	}
+}
+
+void synchronize_rcu()
+{
+	ASSERT(current_pcb != NULL);
+
+	RcuWaiter waiter;
+	waiter.pcb = current_pcb;
+	waiter.finished = 0;
+
+	// The callback can't run until we've blocked, softirqs wait for
+	// interrupts to be enabled
+	interrupts_disable();
+	call_rcu(&waiter.head, synchronize_done);
+	while (!waiter.finished)
+	{
+		current_pcb->state = BLOCKED;
+		dispatch();
+		interrupts_disable();
+	}
+	interrupts_enable();
+}
+
+void rcu_quiescent()
+{
+	++quiescent_count[smp_cpu_id()];
+}
+
+void rcu_idle_enter()
+{
+	const uint32_t cpu = smp_cpu_id();
+	++quiescent_count[cpu];
+	idle[cpu] = 1;
+	smp_mb();
+
+	// Nobody else might be around to end the grace period
+	rcu_poll();
+}
+
+void rcu_idle_exit()
+{
+	const uint32_t cpu = smp_cpu_id();
+	if (idle[cpu])
+	{
+		// Has to be seen by rcu_poll() before the handler reads
+		// anything, a plain store could pass the loads after it
+		idle[cpu] = 0;
+		smp_mb();
+	}
+}
+
+static void gp_start()
+{
+	list_append(&waiting, &pending);
+
+	// An idle processor has already passed, it can only leave idle
+	// through an interrupt that starts after this
+	const uint32_t num_cpus = smp_num_cpus();
+	smp_mb();
+	for (uint32_t i = 0; i < num_cpus; ++i)
+	{
+		gp_snapshot[i] = quiescent_count[i];
+		gp_passed[i] = idle[i];
+	}
+
+	gp_active = 1;
+	kprintf("RCU: Grace period %u started\n", gp_completed + 1);
+}
+
+static uint8_t gp_over()
+{
+	const uint32_t num_cpus = smp_num_cpus();
+	smp_mb();
+	for (uint32_t i = 0; i < num_cpus; ++i)
+	{
+		if (!gp_passed[i] && (idle[i] || quiescent_count[i] != gp_snapshot[i]))
+		{
+			gp_passed[i] = 1;
+		}
+
+		if (!gp_passed[i])
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void gp_finish()
+{
+	list_append(&done, &waiting);
+	gp_active = 0;
+	++gp_completed;
+	softirq_raise(SOFTIRQ_RCU);
+	kprintf("RCU: Grace period %u over\n", gp_completed);
+}
+
+void rcu_poll()
+{
+	ASSERT(kernel_lock_held());
+
+	const uint64_t flags = interrupts_save();
+	if (!gp_active && pending.head != NULL)
+	{
+		gp_start();
+	}
+
+	// If everyone is idle one can start and end in the same call
+	if (gp_active && gp_over())
+	{
+		gp_finish();
+		if (pending.head != NULL)
+		{
+			gp_start();
+		}
+	}
+	interrupts_restore(flags);
+}
@@ -0,0 +1,100 @@
+#ifndef __KERNEL_RCU_RCU_H__
+#define __KERNEL_RCU_RCU_H__
+
+#include "inttypes.h"
+#include "kernel/atomic/defs.h"
+#include "kernel/scheduler/scheduler.h"
+
+/* Read-copy-update, for tables that are read all the time and almost
+ * never changed. Readers take no lock and write nothing shared, they
+ * only keep the processor from switching away:
+ *
+ *    rcu_read_lock();
+ *    handler = rcu_dereference(table[i]);
+ *    handler(...);
+ *    rcu_read_unlock();
+ *
+ * A writer builds the new version on the side, publishes it with
+ * rcu_assign_pointer(), and frees the old one with call_rcu() or after
+ * synchronize_rcu(). Both wait for a grace period, until every
+ * processor has switched processes or gone idle since the update, so
+ * no reader can still be looking at the old version.
+ *
+ * Writers still have to keep out of each other's way, with the kernel
+ * lock or a lock of their own.
+ */
+
+typedef struct RcuHead
+{
+	struct RcuHead* next;
+	void (*func)(struct RcuHead* head);
+} RcuHead;
+
+/* Start a read side critical section. They can nest, and must not
+ * block or call dispatch() before rcu_read_unlock().
+ */
+static inline void rcu_read_lock()
+{
+	preempt_disable();
+}
+
+static inline void rcu_read_unlock()
+{
+	preempt_enable();
+}
+
+/* Read a pointer that a writer publishes with rcu_assign_pointer().
+ * A naturally aligned load can't tear on any processor this runs on,
+ * the volatile keeps the compiler from reloading or caching it.
+ */
+#define rcu_dereference(P) (*(volatile __typeof__(P)*)&(P))
+
+/* Publish a new version, everything written to it beforehand is
+ * visible to any reader that sees the new pointer.
+ */
+#define rcu_assign_pointer(P, V) \
+	do { \
+		smp_wmb(); \
+		*(volatile __typeof__(P)*)&(P) = (V); \
+	} while (0)
+
+/* Setup the grace period tracking. Must be called after the softirqs
+ * are usable and before anything calls call_rcu().
+ */
+void rcu_init(void);
+
+/* Call a function once every reader that could see the old version
+ * has finished. It runs from a softirq, so it must not block. Safe to
+ * call from an interrupt handler.
+ *
+ * Parameters:
+ *    head - Embedded in whatever is being freed, container_of() style
+ *    func - Given head once the grace period is over
+ */
+void call_rcu(RcuHead* head, void (*func)(RcuHead* head));
+
+/* Block the current process until a grace period has passed. Only
+ * from process context, never inside rcu_read_lock().
+ */
+void synchronize_rcu(void);
+
+/* This processor can't be in a read side critical section. Called by
+ * dispatch() on every context switch.
+ */
+void rcu_quiescent(void);
+
+/* This processor is about to halt, and stays quiescent until
+ * rcu_idle_exit(). Must be called with interrupts disabled.
+ */
+void rcu_idle_enter(void);
+
+/* Called on every interrupt, before anything the handler reads.
+ */
+void rcu_idle_exit(void);
+
+/* Check whether the current grace period is over and start the next
+ * one. Called from the timer interrupt with the kernel lock held.
+ */
+void rcu_poll(void);
+
+#endif
@@ -0,0 +1,443 @@
+#include "events.h"
+#include "waitqueue.h"
+#include "scheduler.h"
+#include "thread.h"
+
+#include "safety.h"
+#include "kernel/klib.h"
+#include "kernel/kprintf.h"
+#include "kernel/alloc/alloc.h"
+#include "kernel/keyboard/defs.h"
+#include "kernel/ipc/channel.h"
+#include "kernel/data_structures/block.h"
+
+#ifndef DEBUG_EVENTS
+#define kprintf(...)
+#endif
+
+COMPILE_ASSERT(EVENTS_PER_SET <= 32);
+
+struct EventSet;
+
+typedef struct Registration
+{
+	struct Registration* next; // On its source's list, not for timers
+	struct Registration* prev;
+	struct EventSet* set;
+	uint64_t user_data;
+	uint64_t pending;     // Times it happened since it was last reported
+	uint64_t reported;    // Of those, how many the last events_wait() returned
+	uint64_t period_ns;   // Timers only, 0 for a one shot
+	uint64_t deadline_ns; // Timers only, 0 while disarmed
+	uint32_t overrun;     // Timers only, expirations missed before the last one reported
+	uint32_t source;      // Which one for sources raised with events_raise_source()
+	EventType type;
+	uint32_t flags;
+} Registration;
+
+typedef struct EventSet
+{
+	Registration slots[EVENTS_PER_SET];
+	uint32_t used;      // One bit per slot
+	WaitQueue waiters;  // Only ever the owner
+	PCB* owner;
+} EventSet;
+
+static BlockAllocator* ba_sets = NULL;
+
+// Everyone registered for each type of event, timers aren't kept here
+static Registration* sources[NUM_EVENT_TYPES];
+
+void events_init()
+{
+	const uint64_t size_needed = sizeof(EventSet)*EVENTS_MAX_SETS + sizeof(BlockAllocator);
+	const void* address = water_mark_alloc(&kernel_WaterMark, size_needed);
+	ba_sets = block_init(address, size_needed, sizeof(EventSet));
+
+	for (uint64_t i = 0; i < NUM_EVENT_TYPES; ++i)
+	{
+		sources[i] = NULL;
+	}
+}
+
+static void source_remove(Registration* reg)
+{
+	if (reg->type == EVENT_TIMER)
+	{
+		return;
+	}
+
+	if (reg->prev == NULL) { sources[reg->type] = reg->next; }
+	else { reg->prev->next = reg->next; }
+
+	if (reg->next != NULL) { reg->next->prev = reg->prev; }
+}
+
+Status events_add(PCB* pcb, EventType type, uint64_t arg, uint32_t flags,
+		uint64_t user_data, uint32_t* id_out)
+{
+	if (type >= NUM_EVENT_TYPES)
+	{
+		return BAD_PARAM;
+	}
+
+	uint32_t source = 0;
+	if (type == EVENT_CHANNEL && channel_event_source(pcb, arg, &source) != SUCCESS)
+	{
+		return BAD_PARAM;
+	}
+
+	EventSet* set = pcb->events;
+	if (set == NULL)
+	{
+		set = (EventSet*)block_alloc(ba_sets);
+		if (set == NULL)
+		{
+			return FAILURE;
+		}
+
+		set->used = 0;
+		set->owner = pcb;
+		wait_queue_init(&set->waiters);
+		pcb->events = set;
+	}
+
+	if (set->used == (uint32_t)((1UL << EVENTS_PER_SET) - 1))
+	{
+		return FAILURE;
+	}
+
+	const uint32_t id = __builtin_ctz(~set->used);
+	set->used |= 1U << id;
+
+	Registration* reg = &set->slots[id];
+	reg->set = set;
+	reg->type = type;
+	reg->flags = flags;
+	reg->user_data = user_data;
+	reg->pending = 0;
+	reg->reported = 0;
+	reg->overrun = 0;
+	reg->source = source;
+	reg->prev = NULL;
+	reg->next = NULL;
+
+	if (type == EVENT_TIMER)
+	{
+		// Without a time it starts disarmed, for events_timer_set()
+		const uint64_t ns = arg * NS_PER_MS;
+		reg->period_ns = (flags & EVENT_PERIODIC) ? ns : 0;
+		reg->deadline_ns = ns != 0 ? timer_get_ns() + ns : 0;
+	}
+	else
+	{
+		reg->next = sources[type];
+		if (reg->next != NULL)
+		{
+			reg->next->prev = reg;
+		}
+		sources[type] = reg;
+	}
+
+	kprintf("Events: %u added %u as %u\n", pcb->pid, type, id);
+	*id_out = id;
+	return SUCCESS;
+}
+
+Status events_remove(PCB* pcb, uint32_t id)
+{
+	EventSet* set = pcb->events;
+	if (set == NULL || id >= EVENTS_PER_SET || (set->used & (1U << id)) == 0)
+	{
+		return BAD_PARAM;
+	}
+
+	source_remove(&set->slots[id]);
+	set->used &= ~(1U << id);
+
+	return SUCCESS;
+}
+
+void events_remove_source(PCB* pcb, EventType type, uint32_t source)
+{
+	EventSet* set = pcb->events;
+	if (set == NULL)
+	{
+		return;
+	}
+
+	for (uint32_t id = 0; id < EVENTS_PER_SET; ++id)
+	{
+		Registration* reg = &set->slots[id];
+		if ((set->used & (1U << id)) && reg->type == type && reg->source == source)
+		{
+			source_remove(reg);
+			set->used &= ~(1U << id);
+		}
+	}
+}
+
+static Registration* find_timer(PCB* pcb, uint32_t id)
+{
+	EventSet* set = pcb->events;
+	if (set == NULL || id >= EVENTS_PER_SET || (set->used & (1U << id)) == 0 ||
+		set->slots[id].type != EVENT_TIMER)
+	{
+		return NULL;
+	}
+
+	return &set->slots[id];
+}
+
+Status events_timer_set(PCB* pcb, uint32_t id, uint32_t flags,
+		uint64_t value_ns, uint64_t interval_ns)
+{
+	Registration* reg = find_timer(pcb, id);
+	if (reg == NULL)
+	{
+		return BAD_PARAM;
+	}
+
+	// Expirations from before don't count towards the new setting
+	reg->pending = 0;
+	reg->reported = 0;
+	reg->overrun = 0;
+	reg->period_ns = interval_ns;
+	if (value_ns == 0)
+	{
+		reg->deadline_ns = 0;
+	}
+	else if (flags & TIMER_ABSTIME)
+	{
+		reg->deadline_ns = value_ns;
+	}
+	else
+	{
+		reg->deadline_ns = timer_get_ns() + value_ns;
+	}
+
+	return SUCCESS;
+}
+
+Status events_timer_overrun(PCB* pcb, uint32_t id, uint32_t* overrun)
+{
+	Registration* reg = find_timer(pcb, id);
+	if (reg == NULL)
+	{
+		return BAD_PARAM;
+	}
+
+	*overrun = reg->overrun;
+	return SUCCESS;
+}
+
+void events_release(PCB* pcb)
+{
+	EventSet* set = pcb->events;
+	if (set == NULL)
+	{
+		return;
+	}
+
+	for (uint32_t id = 0; id < EVENTS_PER_SET; ++id)
+	{
+		if (set->used & (1U << id))
+		{
+			source_remove(&set->slots[id]);
+		}
+	}
+
+	block_free(ba_sets, set);
+	pcb->events = NULL;
+}
+
+void events_raise(EventType type, Pid target)
+{
+	ASSERT(type < NUM_EVENT_TYPES && type != EVENT_TIMER);
+
+	for (Registration* reg = sources[type]; reg != NULL; reg = reg->next)
+	{
+		if (target != EVENT_ANYONE && reg->set->owner->pid != target)
+		{
+			continue;
+		}
+
+		++reg->pending;
+		wait_queue_wake_one(&reg->set->waiters);
+	}
+}
+
+void events_raise_source(EventType type, uint32_t source)
+{
+	ASSERT(type < NUM_EVENT_TYPES && type != EVENT_TIMER);
+
+	for (Registration* reg = sources[type]; reg != NULL; reg = reg->next)
+	{
+		if (reg->source == source)
+		{
+			++reg->pending;
+			wait_queue_wake_one(&reg->set->waiters);
+		}
+	}
+}
+
+/* Count the expirations of every timer that is due.
+ *
+ * Returns:
+ *    When the next timer is due, 0 if none are armed
+ */
+static uint64_t timers_update(EventSet* set, uint64_t now)
+{
+	uint64_t next = 0;
+	for (uint32_t id = 0; id < EVENTS_PER_SET; ++id)
+	{
+		Registration* reg = &set->slots[id];
+		if ((set->used & (1U << id)) == 0 || reg->type != EVENT_TIMER ||
+			reg->deadline_ns == 0)
+		{
+			continue;
+		}
+
+		if (now >= reg->deadline_ns)
+		{
+			if (reg->period_ns != 0)
+			{
+				// Stay on the original cadence however late we are,
+				// so nothing drifts
+				const uint64_t missed = (now - reg->deadline_ns) / reg->period_ns;
+				reg->pending += missed + 1;
+				reg->deadline_ns += (missed + 1) * reg->period_ns;
+			}
+			else
+			{
+				++reg->pending;
+				reg->deadline_ns = 0;
+				continue;
+			}
+		}
+
+		if (next == 0 || reg->deadline_ns < next)
+		{
+			next = reg->deadline_ns;
+		}
+	}
+
+	return next;
+}
+
+/* Fill out with the ready events. They stay pending until
+ * events_delivered() is called.
+ */
+static uint32_t collect(EventSet* set, EventResult* out, uint32_t max)
+{
+	uint32_t found = 0;
+	for (uint32_t id = 0; id < EVENTS_PER_SET; ++id)
+	{
+		Registration* reg = &set->slots[id];
+		reg->reported = 0;
+		if ((set->used & (1U << id)) == 0 || found == max)
+		{
+			continue;
+		}
+
+		uint64_t count = reg->pending;
+
+		// Level triggered input stays ready until it has all been read
+		if ((reg->flags & EVENT_EDGE) == 0 && count == 0 &&
+			((reg->type == EVENT_KEYBOARD && keyboard_char_available()) ||
+			 (reg->type == EVENT_CHANNEL && channel_ready(reg->source))))
+		{
+			count = 1;
+		}
+
+		if (count == 0)
+		{
+			continue;
+		}
+
+		out[found].user_data = reg->user_data;
+		out[found].type = reg->type;
+		out[found].count = count > 0xFFFFFFFF ? 0xFFFFFFFF : count;
+		reg->reported = count;
+		++found;
+	}
+
+	return found;
+}
+
+void events_delivered(PCB* pcb)
+{
+	EventSet* set = pcb->events;
+	if (set == NULL)
+	{
+		return;
+	}
+
+	for (uint32_t id = 0; id < EVENTS_PER_SET; ++id)
+	{
+		Registration* reg = &set->slots[id];
+		if ((set->used & (1U << id)) == 0 || reg->reported == 0)
+		{
+			continue;
+		}
+
+		if (reg->type == EVENT_TIMER)
+		{
+			reg->overrun = (reg->reported > 0xFFFFFFFF ? 0xFFFFFFFF : reg->reported) - 1;
+		}
+
+		// Level triggered keyboard events were never pending, and
+		// anything raised since stays for next time
+		reg->pending -= reg->reported < reg->pending ? reg->reported : reg->pending;
+		reg->reported = 0;
+	}
+}
+
+uint32_t events_wait(PCB* pcb, EventResult* out, uint32_t max, time_t timeout)
+{
+	ASSERT(pcb == current_pcb);
+
+	EventSet* set = pcb->events;
+	if (set == NULL || max == 0)
+	{
+		return 0;
+	}
+
+	const uint64_t start = timer_get_ns();
+	const uint64_t give_up = timeout == EVENT_WAIT_FOREVER ? 0 :
+		start + (uint64_t)timeout * NS_PER_MS;
+
+	while (1)
+	{
+		const uint64_t now = timer_get_ns();
+		const uint64_t next_timer = timers_update(set, now);
+
+		const uint32_t found = collect(set, out, max);
+		if (found > 0 || timeout == 0 || (give_up != 0 && now >= give_up) ||
+			thread_exiting(pcb))
+		{
+			return found;
+		}
+
+		// Sleep until something is raised, the next timer, or the
+		// timeout, whichever comes first
+		uint64_t wake = give_up;
+		if (next_timer != 0 && (wake == 0 || next_timer < wake))
+		{
+			wake = next_timer;
+		}
+
+		uint64_t sleep_ms = 0;
+		if (wake != 0)
+		{
+			// Round up, waking early would just go back to sleep
+			sleep_ms = (wake - now + NS_PER_MS - 1) / NS_PER_MS;
+			if (sleep_ms >= EVENT_WAIT_FOREVER)
+			{
+				sleep_ms = EVENT_WAIT_FOREVER - 1;
+			}
+		}
+
+		wait_queue_wait(&set->waiters, (time_t)sleep_ms);
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef __SCHEDULER_EVENTS_H__
+#define __SCHEDULER_EVENTS_H__
+
+#include "pcb.h"
+#include "inttypes.h"
+#include "kernel/timer/defs.h"
+#include "kernel/syscalls/types.h"
+
+/* Waiting on several things at once. A process registers each event
+ * source it cares about with events_add(), then blocks in
+ * events_wait() until any of them are ready, and gets all of the
+ * ready ones back together.
+ *
+ * Timers are checked by the waiting process itself, it sleeps no
+ * longer than its next timer. Other sources call events_raise(), or
+ * events_raise_source() when there's more than one of them, like
+ * channel ends.
+ *
+ * Everything here must be called with interrupts disabled.
+ */
+
+#define EVENTS_PER_SET 16
+#define EVENTS_MAX_SETS 64
+
+// events_raise() target for every registration of that type
+#define EVENT_ANYONE ((Pid)-1)
+
+/* Setup the EventSet allocator. Must be called after the kernel's
+ * allocators have been setup.
+ */
+void events_init(void);
+
+/* Register interest in an event source. Takes constant time.
+ *
+ * Parameters:
+ *    pcb - Whose set to add it to, one is made on first use
+ *    type - What to wait for
+ *    arg - Milliseconds for EVENT_TIMER, 0 leaves it disarmed.
+ *          The handle for EVENT_CHANNEL. Unused otherwise
+ *    flags - EVENT_EDGE, EVENT_PERIODIC
+ *    user_data - Handed back in the EventResult
+ *    id_out - Where to put the id to give events_remove()
+ *
+ * Returns:
+ *    SUCCESS, BAD_PARAM, or FAILURE if the set is full or no more
+ *    sets can be made
+ */
+Status events_add(PCB* pcb, EventType type, uint64_t arg, uint32_t flags,
+		uint64_t user_data, uint32_t* id_out);
+
+Status events_remove(PCB* pcb, uint32_t id);
+
+/* Drop every registration pcb has for one source, when whatever it
+ * refers to goes away.
+ */
+void events_remove_source(PCB* pcb, EventType type, uint32_t source);
+
+/* Arm or disarm a timer registered with events_add(). Periodic timers
+ * are rearmed from their last deadline, not from when they were
+ * noticed, so they don't drift.
+ *
+ * Parameters:
+ *    pcb - Whose timer it is
+ *    id - The timer's id from events_add()
+ *    flags - TIMER_ABSTIME if value_ns is a timer_get_ns() time,
+ *            otherwise it's relative to now
+ *    value_ns - When it first goes off, 0 disarms it
+ *    interval_ns - The period after that, 0 for a one shot
+ *
+ * Returns:
+ *    SUCCESS, or BAD_PARAM if id isn't a timer
+ */
+Status events_timer_set(PCB* pcb, uint32_t id, uint32_t flags,
+		uint64_t value_ns, uint64_t interval_ns);
+
+/* Get how many expirations of a timer were missed before the last one
+ * that was reported, one less than the count in its EventResult.
+ */
+Status events_timer_overrun(PCB* pcb, uint32_t id, uint32_t* overrun);
+
+/* Block until at least one registered event is ready, or the timeout
+ * runs out. The events stay ready until events_delivered() is called,
+ * so they aren't lost if they can't be handed over.
+ *
+ * Parameters:
+ *    pcb - The caller, must be current_pcb
+ *    out - Where to put the ready events
+ *    max - How many fit in out
+ *    timeout - Milliseconds, 0 doesn't block, EVENT_WAIT_FOREVER
+ *              never runs out
+ *
+ * Returns:
+ *    How many events were put in out, 0 if the timeout ran out
+ */
+uint32_t events_wait(PCB* pcb, EventResult* out, uint32_t max, time_t timeout);
+
+/* The events the last events_wait() returned have reached the process,
+ * take them off what's pending.
+ */
+void events_delivered(PCB* pcb);
+
+/* Something happened, wake up whoever is waiting for it.
+ *
+ * Parameters:
+ *    type - The kind of event, not EVENT_TIMER
+ *    target - Only registrations made by this process, or EVENT_ANYONE
+ */
+void events_raise(EventType type, Pid target);
+
+/* Like events_raise(), for everyone registered for one source of a
+ * type that has several, see events_add().
+ *
+ * Parameters:
+ *    type - The kind of event, EVENT_CHANNEL
+ *    source - Which one, from channel_event_source()
+ */
+void events_raise_source(EventType type, uint32_t source);
+
+/* Drop everything a PCB registered. Called when it exits.
+ */
+void events_release(PCB* pcb);
+
+#endif
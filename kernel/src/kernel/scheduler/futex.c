@@ -0,0 +1,166 @@
+#include "futex.h"
+#include "scheduler.h"
+#include "thread.h"
+
+#include "safety.h"
+#include "kernel/kprintf.h"
+#include "kernel/virt_memory/defs.h"
+#include "kernel/syscalls/uaccess.h"
+
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/uaccess/uaccess.h"
+#endif
+
+#ifndef DEBUG_FUTEX
+#define kprintf(...)
+#endif
+
+/* Lives on the waiting process's kernel stack while it is blocked.
+ */
+typedef struct FutexWaiter
+{
+	struct FutexWaiter* next;
+	struct FutexWaiter* prev;
+	uint64_t key; // The physical address being waited on
+	PCB* pcb;
+} FutexWaiter;
+
+typedef struct
+{
+	FutexWaiter* head;
+	FutexWaiter* tail;
+} FutexBucket;
+
+static FutexBucket buckets[FUTEX_BUCKETS];
+
+void futex_init()
+{
+	for (uint64_t i = 0; i < FUTEX_BUCKETS; ++i)
+	{
+		buckets[i].head = NULL;
+		buckets[i].tail = NULL;
+	}
+}
+
+static FutexBucket* bucket_for(uint64_t key)
+{
+	// The low two bits are always 0
+	return &buckets[(key >> 2) % FUTEX_BUCKETS];
+}
+
+static void bucket_remove(FutexBucket* bucket, FutexWaiter* waiter)
+{
+	if (waiter->prev == NULL) { bucket->head = waiter->next; }
+	else { waiter->prev->next = waiter->next; }
+
+	if (waiter->next == NULL) { bucket->tail = waiter->prev; }
+	else { waiter->next->prev = waiter->prev; }
+
+	waiter->pcb = NULL;
+}
+
+/* Find the key for a user address, and read the word there. Reading
+ * it first means the lookup can't fail for an unmapped page.
+ */
+static uint8_t futex_key(PCB* pcb, uint32_t* addr, uint64_t* key, uint32_t* value)
+{
+	const uint64_t virt = (uint64_t)addr;
+	if ((virt & 0x3) != 0 || virt == 0 || virt >= USER_ADDRESS_END)
+	{
+		return 0;
+	}
+
+	if (copy_from_user(value, addr, sizeof(uint32_t)) != SUCCESS)
+	{
+		return 0;
+	}
+
+	return virt_lookup_phys(pcb->page_table, virt, key) && *key != 0;
+}
+
+Status futex_wait(PCB* pcb, uint32_t* addr, uint32_t expected, time_t timeout)
+{
+	uint64_t key;
+	uint32_t value;
+	if (!futex_key(pcb, addr, &key, &value))
+	{
+		return BAD_PARAM;
+	}
+
+	// Interrupts are disabled and the kernel lock is held, so a
+	// futex_wake() from another thread can't run until we're queued
+	if (value != expected)
+	{
+		return WOULD_BLOCK;
+	}
+
+	if (thread_exiting(pcb))
+	{
+		return TIMED_OUT;
+	}
+
+	FutexBucket* bucket = bucket_for(key);
+	FutexWaiter waiter;
+	waiter.key = key;
+	waiter.pcb = pcb;
+	waiter.next = NULL;
+	waiter.prev = bucket->tail;
+	if (bucket->tail == NULL) { bucket->head = &waiter; }
+	else { bucket->tail->next = &waiter; }
+	bucket->tail = &waiter;
+
+	kprintf("Futex: %u waiting on 0x%x\n", pcb->pid, key);
+	if (timeout != 0)
+	{
+		sleep_pcb(pcb, timeout);
+	}
+	else
+	{
+		pcb->state = BLOCKED;
+		dispatch();
+	}
+
+	// futex_wake() takes us off the list, the sleep queue doesn't
+	if (waiter.pcb != NULL)
+	{
+		bucket_remove(bucket, &waiter);
+		return TIMED_OUT;
+	}
+
+	return SUCCESS;
+}
+
+uint64_t futex_wake(PCB* pcb, uint32_t* addr, uint64_t count)
+{
+	uint64_t key;
+	uint32_t value;
+	if (!futex_key(pcb, addr, &key, &value))
+	{
+		return 0;
+	}
+
+	FutexBucket* bucket = bucket_for(key);
+	FutexWaiter* waiter = bucket->head;
+	uint64_t woken = 0;
+	while (waiter != NULL && woken < count)
+	{
+		FutexWaiter* const next = waiter->next;
+		if (waiter->key == key)
+		{
+			PCB* const other = waiter->pcb;
+			bucket_remove(bucket, waiter);
+
+			// One whose timeout just ran out is already READY, it
+			// counts as woken since it hasn't seen the time out yet
+			if (other->state == BLOCKED || other->state == SLEEPING)
+			{
+				wake_pcb(other);
+			}
+			++woken;
+		}
+		waiter = next;
+	}
+
+	kprintf("Futex: %u woke %u on 0x%x\n", pcb->pid, woken, key);
+	return woken;
+}
@@ -0,0 +1,52 @@
+#ifndef __SCHEDULER_FUTEX_H__
+#define __SCHEDULER_FUTEX_H__
+
+#include "pcb.h"
+#include "inttypes.h"
+#include "kernel/timer/defs.h"
+#include "kernel/syscalls/types.h"
+
+/* Fast user space mutexes. User code keeps its lock state in a 32 bit
+ * word and only makes a system call when it has to wait, or when
+ * somebody might be waiting on it.
+ *
+ * Waiters are kept in a hash table keyed by the word's physical
+ * address, so threads and anything else mapping the same page find
+ * each other.
+ */
+
+#define FUTEX_BUCKETS 64
+
+/* Setup the wait queues. Must be called before the first system call.
+ */
+void futex_init(void);
+
+/* Block until futex_wake() is called on addr, unless *addr no longer
+ * holds expected. The check and going to sleep can't be split by a
+ * wake up.
+ *
+ * Parameters:
+ *    pcb - The caller, must be current_pcb
+ *    addr - A 4 byte aligned word in pcb's address space
+ *    expected - What *addr held when the caller decided to wait
+ *    timeout - Milliseconds to wait for, 0 waits forever
+ *
+ * Returns:
+ *    SUCCESS once woken, WOULD_BLOCK if *addr changed, TIMED_OUT if
+ *    the timeout ran out, or BAD_PARAM for a bad address
+ */
+Status futex_wait(PCB* pcb, uint32_t* addr, uint32_t expected, time_t timeout);
+
+/* Wake up to count of the processes waiting on addr, oldest first.
+ *
+ * Parameters:
+ *    pcb - The caller, addr is in its address space
+ *    addr - The word they are waiting on
+ *    count - How many to wake at most
+ *
+ * Returns:
+ *    How many were woken
+ */
+uint64_t futex_wake(PCB* pcb, uint32_t* addr, uint64_t count);
+
+#endif
@@ -0,0 +1,52 @@
+#include "idle.h"
+#include "kthread.h"
+#include "scheduler.h"
+
+#include "safety.h"
+#include "kernel/panic.h"
+#include "kernel/rcu/rcu.h"
+#include "kernel/smp/defs.h"
+#include "kernel/interrupts/defs.h"
+#include "kernel/interrupts/softirq.h"
+
+static void idle(void* arg)
+{
+	UNUSED(arg);
+
+	while (1)
+	{
+		interrupts_disable();
+		kernel_lock();
+
+		// Nothing in here is reading anything RCU protects, and a
+		// grace period ending might wake someone up
+		rcu_idle_enter();
+		softirq_run();
+
+		if (scheduler_work_waiting())
+		{
+			rcu_idle_exit();
+			dispatch();
+			interrupts_enable();
+			continue;
+		}
+
+		// Any interrupt takes the lock back, and the sti makes
+		// sure one can't sneak in before the hlt
+		kernel_unlock();
+		interrupts_halt();
+	}
+}
+
+PCB* idle_init(uint32_t cpu)
+{
+	PCB* pcb = kthread_alloc(idle, NULL, IDLE);
+	if (pcb == NULL)
+	{
+		panic("Idle: Out of PCBs");
+	}
+
+	scheduler_set_idle(cpu, pcb);
+
+	return pcb;
+}
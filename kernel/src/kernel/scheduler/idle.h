@@ -0,0 +1,22 @@
+#ifndef __SCHEDULER_IDLE_H__
+#define __SCHEDULER_IDLE_H__
+
+#include "pcb.h"
+#include "inttypes.h"
+
+/* Every processor has an idle thread the scheduler falls back on when
+ * none of the run queues have anything for it. It lets go of the
+ * kernel lock and halts until an interrupt shows up.
+ */
+
+/* Create a processor's idle thread.
+ *
+ * Parameters:
+ *    cpu - The processor it belongs to
+ *
+ * Returns:
+ *    The idle thread's PCB
+ */
+PCB* idle_init(uint32_t cpu);
+
+#endif
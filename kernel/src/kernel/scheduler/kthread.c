@@ -0,0 +1,65 @@
+#include "kthread.h"
+#include "scheduler.h"
+#include "trace.h"
+
+#include "kernel/panic.h"
+#include "kernel/kprintf.h"
+#include "kernel/interrupts/defs.h"
+#include "kernel/virt_memory/defs.h"
+
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/interrupts/switch.h"
+#endif
+
+#ifndef DEBUG_KTHREAD
+#define kprintf(...)
+#endif
+
+static void kthread_start(kthread_fn fn, void* arg)
+{
+	fn(arg);
+
+	kprintf("KThread: %u exiting\n", current_pcb->pid);
+	interrupts_disable();
+	current_pcb->state = KILLED;
+	dispatch();
+
+	panic("KThread: Came back after exiting");
+}
+
+PCB* kthread_alloc(kthread_fn fn, void* arg, Priority priority)
+{
+	PCB* pcb = alloc_pcb();
+	if (pcb == NULL)
+	{
+		return NULL;
+	}
+
+	pcb->ppid = 0;
+	pcb->priority = priority;
+	pcb->page_table = kernel_table;
+
+#ifdef BIKESHED_X86_64
+	kernel_thread_prepare(pcb, kthread_start, fn, arg);
+#else
+#error "Kernel threads are not implemented on this architecture"
+#endif
+
+	kprintf("KThread: Created %u\n", pcb->pid);
+
+	return pcb;
+}
+
+PCB* kthread_create(kthread_fn fn, void* arg, Priority priority)
+{
+	PCB* pcb = kthread_alloc(fn, arg, priority);
+	if (pcb == NULL)
+	{
+		return NULL;
+	}
+
+	trace_wakeup(pcb);
+	schedule(pcb);
+
+	return pcb;
+}
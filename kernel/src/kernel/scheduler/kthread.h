@@ -0,0 +1,34 @@
+#ifndef __SCHEDULER_KTHREAD_H__
+#define __SCHEDULER_KTHREAD_H__
+
+#include "pcb.h"
+#include "inttypes.h"
+
+/* Kernel threads are PCBs that never leave ring 0. They use the
+ * kernel's page table and are scheduled like any other process, with
+ * interrupts enabled. Anything they share with interrupt handlers or
+ * system calls has to be touched with interrupts or preemption
+ * disabled.
+ */
+
+typedef void (*kthread_fn)(void* arg);
+
+/* Create a kernel thread and put it on the run queue. When fn returns
+ * the thread exits.
+ *
+ * Parameters:
+ *    fn - The thread's body
+ *    arg - Passed to fn
+ *    priority - Which run queue the thread uses
+ *
+ * Returns:
+ *    The thread's PCB, or NULL if there are no PCBs left
+ */
+PCB* kthread_create(kthread_fn fn, void* arg, Priority priority);
+
+/* Like kthread_create(), but the thread isn't put on a run queue.
+ * Used for threads the scheduler picks some other way.
+ */
+PCB* kthread_alloc(kthread_fn fn, void* arg, Priority priority);
+
+#endif
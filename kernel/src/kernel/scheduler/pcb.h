@@ -16,6 +16,8 @@ typedef enum
 	RUNNING,
 	SLEEPING,
 	KILLED,
+	BLOCKED, // Waiting for wake_pcb()
+	ZOMBIE,  // Exited thread waiting to be joined
 } State;
 
 typedef enum
@@ -26,12 +28,56 @@ typedef enum
 	IDLE
 } Priority;
 
+/* Resource usage of a process. All times are in cycles as returned
+ * by timer_get_cycles().
+ */
 typedef struct
+{
+	uint64_t user_cycles;
+	uint64_t kernel_cycles;
+	uint64_t wait_cycles;  // Time spent READY but not running
+	uint64_t sleep_cycles; // Time spent SLEEPING
+	uint64_t voluntary_switches;
+	uint64_t involuntary_switches;
+	uint64_t syscalls;
+	uint64_t page_faults;    // Faults on user pointers the kernel survived
+	uint64_t resident_pages; // Only filled in when queried
+} Usage;
+
+/* Shared by the threads of a process, see thread.h. Single threaded
+ * processes don't have one.
+ */
+typedef struct
+{
+	uint64_t refs;          // PCBs still using the address space
+	uint64_t live;          // Threads that haven't exited
+	uint64_t stack_slots;   // User stacks in use, one bit each
+	uint64_t stacks_mapped; // User stacks that have been mapped
+	Pid parent;             // The process's parent, threads' ppid is their creator
+	struct ChannelTable* channels; // Every thread's handles, NULL until the first channel
+	uint8_t exiting;        // exit() was called, the rest are on their way out
+} ThreadGroup;
+
+typedef struct _PCB
 {
 	// 8 byte fields
-	Context* context;
+	Context* context;      // The user mode registers, at the top of the kernel stack
+	uint64_t kernel_rsp;   // Saved by switch_to() while not running
+	uint64_t kernel_stack; // The top of this process's kernel stack
 	void* page_table;
 	time_t sleep_time;
+	uint64_t state_stamp; // When the PCB became READY or SLEEPING
+	uint64_t wake_stamp;  // When the PCB was last woken, 0 once it has run
+	uint64_t run_stamp;   // When the PCB was last given the CPU
+	Usage usage;
+	ThreadGroup* group;   // NULL unless the process has made threads
+	struct _PCB* joiner;  // Thread waiting in thread_join() for this one
+	uint64_t exit_value;  // Kept for thread_join() while a ZOMBIE
+	uint64_t* join_value; // Where thread_join() wants the exit value
+	uint64_t fs_base;     // Thread local storage
+	struct EventSet* events; // NULL until events_add() is first called
+	struct ChannelTable* channels; // NULL until it is first given a channel, or in a group
+	void* fpu;            // Saved vector registers, NULL until they are first used
 
 	// 2 byte fields
 	Pid pid;
@@ -40,19 +86,9 @@ typedef struct
 	// 1 byte fields
 	State state;
 	Priority priority;
+	uint8_t stack_slot;   // Which user stack a thread is using
+	uint8_t cpu;          // Whose run queue it is on, or where it last ran
+	uint8_t fpu_cpu;      // Where fpu was last loaded into the registers
 } PCB;
 
-typedef struct _Thread
-{
-	// 8 byte fields
-	PCB* pcb;
-	Context* context;
-	struct _Thread* next;
-	struct _Thread* prev;
-
-	// 1 byte fields
-	State state;
-	Priority priority;
-} Thread;
-
 #endif
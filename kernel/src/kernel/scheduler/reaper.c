@@ -0,0 +1,62 @@
+#include "reaper.h"
+#include "scheduler.h"
+
+#include "kernel/panic.h"
+#include "kernel/kprintf.h"
+#include "kernel/alloc/alloc.h"
+#include "kernel/data_structures/block.h"
+#include "kernel/data_structures/queue.h"
+
+#ifndef DEBUG_REAPER
+#define kprintf(...)
+#endif
+
+static BlockAllocator* ba_reaper_nodes = NULL;
+static Queue dead_queue;
+
+void reaper_init()
+{
+	// The scheduler never lets more than REAPER_MAX_PENDING PCBs pile up
+	const uint64_t size_needed = sizeof(QueueNode)*REAPER_MAX_PENDING + sizeof(BlockAllocator);
+	const void* address = water_mark_alloc(&kernel_WaterMark, size_needed);
+	ba_reaper_nodes = block_init(address, size_needed, sizeof(QueueNode));
+
+	queue_init(&dead_queue);
+}
+
+void reaper_enqueue(PCB* pcb)
+{
+	ASSERT(pcb->state == KILLED);
+
+	QueueNode* node = (QueueNode*)block_alloc(ba_reaper_nodes);
+	if (node == NULL)
+	{
+		panic("Reaper: Too many dead processes");
+	}
+
+	kprintf("Reaper: Queueing PCB 0x%x\n", pcb);
+	node->data = pcb;
+	queue_enqueue(&dead_queue, node);
+}
+
+uint64_t reaper_pending()
+{
+	return queue_size(&dead_queue);
+}
+
+uint64_t reaper_run(uint64_t max)
+{
+	uint64_t reaped = 0;
+	while (reaped < max && !queue_empty(&dead_queue))
+	{
+		QueueNode* node = queue_dequeue(&dead_queue);
+		PCB* pcb = (PCB*)node->data;
+		block_free(ba_reaper_nodes, node);
+
+		kprintf("Reaper: Cleaning PCB 0x%x\n", pcb);
+		cleanup_pcb(pcb);
+		++reaped;
+	}
+
+	return reaped;
+}
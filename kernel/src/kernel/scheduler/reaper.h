@@ -0,0 +1,57 @@
+#ifndef __SCHEDULER_REAPER_H__
+#define __SCHEDULER_REAPER_H__
+
+#include "pcb.h"
+#include "inttypes.h"
+
+/* Deferred process teardown. Instead of freeing a dead process's
+ * address space on the exit() path, the scheduler hands the PCB to
+ * the reaper and immediately runs the next process. The queued PCBs
+ * are torn down later in small batches, when the system is idle or
+ * when too many of them have piled up.
+ */
+
+/* How many dead PCBs are torn down per call to reaper_run() from
+ * the idle path.
+ */
+#define REAPER_BATCH 4
+
+/* If this many dead PCBs are waiting the scheduler reaps them even
+ * if the system is not idle, so memory doesn't run out.
+ */
+#define REAPER_MAX_PENDING 64
+
+/* Initialize the reaper. Must be called after the kernel's allocators
+ * have been setup.
+ */
+void reaper_init(void);
+
+/* Queue a dead PCB for teardown. The PCB must not be running, but its
+ * page table may still be loaded, it won't be touched until the next
+ * call to reaper_run().
+ *
+ * Parameters:
+ *    pcb - The KILLED PCB to clean up
+ */
+void reaper_enqueue(PCB* pcb);
+
+/* Get the number of PCBs waiting to be torn down.
+ *
+ * Returns:
+ *    The size of the reaper's queue
+ */
+uint64_t reaper_pending(void);
+
+/* Tear down up to max queued PCBs, freeing their address spaces and
+ * returning the PCBs to the scheduler. None of the queued page tables
+ * may be loaded when this is called.
+ *
+ * Parameters:
+ *    max - The maximum number of PCBs to clean up
+ *
+ * Returns:
+ *    The number of PCBs that were cleaned up
+ */
+uint64_t reaper_run(uint64_t max);
+
+#endif
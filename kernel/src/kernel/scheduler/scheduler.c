@@ -1,4 +1,8 @@
 #include "scheduler.h"
+#include "usage.h"
+#include "reaper.h"
+#include "thread.h"
+#include "trace.h"
 
 #include "kernel/klib.h"
 #include "kernel/panic.h"
@@ -7,6 +11,10 @@
 #include "kernel/alloc/alloc.h"
 #include "kernel/timer/defs.h"
 #include "kernel/virt_memory/defs.h"
+#include "kernel/interrupts/defs.h"
+#include "kernel/smp/defs.h"
+#include "kernel/rcu/rcu.h"
+#include "kernel/vdso/vdso.h"
 #include "kernel/data_structures/block.h"
 #include "kernel/data_structures/queue.h"
 
@@ -14,6 +22,8 @@
 #include "arch/x86_64/virt_memory/physical.h"
 #include "arch/x86_64/virt_memory/paging.h"
 #include "arch/x86_64/interrupts/tss.h"
+#include "arch/x86_64/interrupts/switch.h"
+#include "arch/x86_64/fpu/fpu.h"
 #endif
 
 #ifndef DEBUG_SCHEDULER
@@ -23,17 +33,47 @@
 static BlockAllocator* ba_pcbs = NULL;
 static BlockAllocator* ba_qnodes = NULL;
 #define NUM_QUEUES 4
-static Queue queues[NUM_QUEUES];
-static Queue sleep_queue;
 
 #define MAX_PCBS 1024
 #define MAX_QUEUE_NODES 2048
 
-PCB* current_pcb = NULL;
+/* Each processor schedules its own processes. Sleepers wake up on the
+ * processor they went to sleep on, and a processor that runs out of
+ * work takes some from the others.
+ */
+typedef struct
+{
+	Queue queues[NUM_QUEUES];
+	Queue sleep_queue;
+	PCB* idle; // Runs when nothing else can, never queued
+
+	// Used for tracking the next sleep wakening
+	time_t prev_ticks;
+	time_t quantum_left;
+
+	// Timer ticks that didn't make up a whole millisecond last time,
+	// dropping them would let the sleep queue fall behind the clock
+	time_t leftover;
+
+	// Non-zero while the scheduler's state can't be touched by a
+	// preemption point, see preempt_disable()
+	uint64_t preempt_count;
+
+	// Set by interrupts that want dispatch() to run once it's safe, and
+	// whether the current process has to give up the CPU when it does
+	uint8_t need_resched;
+	uint8_t wake_preempt;
+} RunQueue;
+
+static RunQueue run_queues[MAX_CPUS];
+
+#define THIS_RQ() (&run_queues[smp_cpu_id()])
 
-// Used for tracking the next sleep wakening
-static time_t prev_ticks = 0;
-static time_t quantum_left = 0;
+// Every allocated PCB, indexed by its slot in ba_pcbs
+static PCB* pcb_table[MAX_PCBS];
+#define PCB_SLOT(P) (((uint64_t)(P) - ba_pcbs->base) / sizeof(PCB))
+
+static Pid next_pid = 1;
 
 // Cache some values from the timer
 static time_t ten_ms;
@@ -52,11 +92,17 @@ void scheduler_init()
 	ba_qnodes = block_init(qn_address, queue_node_size_needed, sizeof(QueueNode));
 
 	// Initialize all of the queues
-	for (uint64_t i = 0; i < NUM_QUEUES; ++i)
+	for (uint64_t cpu = 0; cpu < MAX_CPUS; ++cpu)
 	{
-		queue_init(&queues[i]);
+		for (uint64_t i = 0; i < NUM_QUEUES; ++i)
+		{
+			queue_init(&run_queues[cpu].queues[i]);
+		}
+		queue_init(&run_queues[cpu].sleep_queue);
 	}
-	queue_init(&sleep_queue);
+
+	reaper_init();
+	thread_init();
 }
 
 PCB* alloc_pcb()
@@ -68,17 +114,42 @@ PCB* alloc_pcb()
 	}
 	kprintf("Allocating PCB: 0x%x\n", pcb);
 
+	memclr(pcb, sizeof(PCB));
+	pcb->pid = next_pid++;
 	pcb->state = READY;
 	pcb->priority = NORMAL;
+	pcb->cpu = smp_cpu_id();
+
+	// The user's registers are saved at the top of the kernel stack
+	pcb->kernel_stack = kernel_stack_get(PCB_SLOT(pcb));
+	pcb->context = (Context*)(pcb->kernel_stack - sizeof(Context));
+
+	pcb_table[PCB_SLOT(pcb)] = pcb;
 
 	return pcb;
 }
 
 void free_pcb(PCB* pcb)
 {
+	pcb_table[PCB_SLOT(pcb)] = NULL;
 	block_free(ba_pcbs, pcb);
 }
 
+PCB* find_pcb(uint64_t* cursor)
+{
+	for (uint64_t slot = *cursor; slot < MAX_PCBS; ++slot)
+	{
+		if (pcb_table[slot] != NULL)
+		{
+			*cursor = slot + 1;
+			return pcb_table[slot];
+		}
+	}
+
+	*cursor = MAX_PCBS;
+	return NULL;
+}
+
 void create_init_process()
 {
 	extern uint64_t __KERNEL_END;
@@ -103,29 +174,71 @@ void create_init_process()
 	}
 
 	// Setup the timer to interrupt init after a little while
+	scheduler_start();
+
+#ifdef BIKESHED_X86_64
+	tss_set_context_stack(current_pcb->kernel_stack);
+
+	// The ELF loader left init's Context at the top of its kernel stack,
+	// restoring it from there transfers control to the user process.
+	__asm__ volatile("movq %0, %%rsp; jmp isr_restore" :: "r"(current_pcb->context));
+#endif
+}
+
+void scheduler_start()
+{
+	RunQueue* rq = THIS_RQ();
+
 	one_ms = timer_one_ms();
 	ten_ms = one_ms * 10;
 	kprintf("1MS: %u - 10MS: %u\n", one_ms, ten_ms);
-	prev_ticks = quantum_left = 10;
-	timer_set_delay(quantum_left*one_ms);
+	rq->prev_ticks = rq->quantum_left = 10;
+	timer_set_delay(rq->quantum_left*one_ms);
 	timer_start();
+}
+
+void scheduler_set_idle(uint32_t cpu, PCB* idle)
+{
+	ASSERT(cpu < MAX_CPUS);
+	if (idle != NULL)
+	{
+		idle->cpu = cpu;
+	}
+	run_queues[cpu].idle = idle;
+}
+
+void scheduler_cpu_start()
+{
+	PCB* idle = THIS_RQ()->idle;
+	ASSERT(idle != NULL);
+
+	current_pcb = idle;
+	scheduler_start();
 
 #ifdef BIKESHED_X86_64
-	tss_set_context_stack(CONTEXT_STACK_LOCATION+CONTEXT_STACK_SIZE);
-#endif
+	tss_set_context_stack(idle->kernel_stack);
 
-	// The stack has been setup in such a way that calling the ISR restore
-	// function will transfer control to the user process.
-	__asm__ volatile("jmp isr_restore");
+	// Like init, the idle thread starts by restoring its Context
+	__asm__ volatile("movq %0, %%rsp; jmp isr_restore" :: "r"(idle->context));
+#endif
 }
 
 void cleanup_pcb(PCB* pcb)
 {
-	virt_switch_page_table(kernel_table);	
+	// The address space can't be in use while it's being freed
+	ASSERT(pcb != current_pcb);
 
-	virt_cleanup_table(pcb->page_table);
+	// Kernel threads borrow the kernel's page table, and user threads
+	// share their process's
+	if (pcb->page_table != kernel_table && thread_release(pcb))
+	{
+		virt_cleanup_table(pcb->page_table);
+	}
 
-	pcb->state = KILLED;
+#ifdef BIKESHED_X86_64
+	fpu_release(pcb);
+#endif
+	free_pcb(pcb);
 }
 
 int8_t sleep_insert(const void* d1, const void* d2)
@@ -148,8 +261,10 @@ int8_t sleep_insert(const void* d1, const void* d2)
 	}
 }
 
-uint8_t schedule(PCB* pcb)
+static void enqueue(PCB* pcb)
 {
+	pcb->state_stamp = timer_get_cycles();
+
 	switch (pcb->state)
 	{
 		case READY:
@@ -159,7 +274,7 @@ uint8_t schedule(PCB* pcb)
 				ASSERT(pcb->priority < NUM_QUEUES);
 
 				node->data = pcb;
-				queue_enqueue(&queues[pcb->priority], node);
+				queue_enqueue(&run_queues[pcb->cpu].queues[pcb->priority], node);
 			}
 			break;
 		case SLEEPING:
@@ -168,7 +283,9 @@ uint8_t schedule(PCB* pcb)
 				ASSERT(node != NULL);
 				node->data = pcb;
 
-				queue_enqueue_prio(&sleep_queue, node, sleep_insert);
+				// Only the processor it sleeps on counts down its time
+				pcb->cpu = smp_cpu_id();
+				queue_enqueue_prio(&run_queues[pcb->cpu].sleep_queue, node, sleep_insert);
 			}
 			break;
 		default:
@@ -177,13 +294,148 @@ uint8_t schedule(PCB* pcb)
 			}
 			break;
 	}
+}
+
+/* Wake up one idle processor if this run queue has anything it could
+ * steal.
+ */
+static void kick_idle_cpu(const RunQueue* rq)
+{
+	uint8_t waiting = 0;
+	for (uint64_t i = 0; i < IDLE; ++i)
+	{
+		waiting |= !queue_empty(&rq->queues[i]);
+	}
+
+	if (!waiting)
+	{
+		return;
+	}
+
+	const uint32_t self = smp_cpu_id();
+	for (uint32_t cpu = 0; cpu < smp_num_cpus(); ++cpu)
+	{
+		if (cpu != self && run_queues[cpu].idle != NULL &&
+			cpus[cpu].current == run_queues[cpu].idle)
+		{
+			smp_reschedule(cpu);
+			return;
+		}
+	}
+}
+
+/* Get another processor to look at a PCB that was just made READY,
+ * if it would run it sooner than its own processor will.
+ */
+static void kick_cpu(const PCB* pcb)
+{
+	const uint32_t self = smp_cpu_id();
+	if (pcb->cpu != self)
+	{
+		const PCB* running = cpus[pcb->cpu].current;
+		if (running == run_queues[pcb->cpu].idle || 
+			(running != NULL && pcb->priority < running->priority))
+		{
+			smp_reschedule(pcb->cpu);
+		}
+		return;
+	}
+
+	// It's waiting on us, an idle processor could take it right away
+	if (pcb->priority != IDLE)
+	{
+		kick_idle_cpu(&run_queues[self]);
+	}
+}
+
+uint8_t schedule(PCB* pcb)
+{
+	enqueue(pcb);
+	if (pcb->state == READY)
+	{
+		kick_cpu(pcb);
+	}
 
 	return 1;
 }
 
+uint8_t scheduler_work_waiting()
+{
+	const uint32_t self = smp_cpu_id();
+	for (uint64_t i = 0; i < NUM_QUEUES; ++i)
+	{
+		if (!queue_empty(&run_queues[self].queues[i]))
+		{
+			return 1;
+		}
+	}
+
+	// Idle priority processes aren't worth moving
+	for (uint32_t cpu = 0; cpu < smp_num_cpus(); ++cpu)
+	{
+		for (uint64_t i = 0; i < IDLE; ++i)
+		{
+			if (cpu != self && !queue_empty(&run_queues[cpu].queues[i]))
+			{
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void resched_interrupt()
+{
+	// Whoever sent this wants us to pick again right away
+	RunQueue* rq = THIS_RQ();
+	rq->wake_preempt = 1;
+	rq->need_resched = 1;
+}
+
+void schedule_tail()
+{
+	// None of the dead address spaces are loaded now, so
+	// clean a few up if there's nothing better to do.
+	if (current_pcb->priority == IDLE || 
+		reaper_pending() >= REAPER_MAX_PENDING)
+	{
+		reaper_run(REAPER_BATCH);
+	}
+
+	preempt_enable();
+}
+
+void preempt_disable()
+{
+	++THIS_RQ()->preempt_count;
+}
+
+void preempt_enable()
+{
+	RunQueue* rq = THIS_RQ();
+	ASSERT(rq->preempt_count > 0);
+	--rq->preempt_count;
+}
+
+void preempt_point()
+{
+	// Nothing to switch away from until the first process is running
+	if (THIS_RQ()->preempt_count > 0 || current_pcb == NULL || current_pcb->kernel_stack == 0)
+	{
+		return;
+	}
+
+	// Let any pending interrupts in. If the timer is one of them the
+	// scheduler may run something else on its own kernel stack and
+	// come back here later.
+	interrupts_window();
+}
+
 void sleep_pcb(PCB* pcb, time_t time)
 {
-	if (time != 0)
+	// A process that is exiting has nothing to sleep for
+	if (time != 0 && !thread_exiting(pcb))
 	{
 		kprintf("Sleeping for: %u\n", time);
 		// Add to the sleep queue
@@ -195,34 +447,104 @@ void sleep_pcb(PCB* pcb, time_t time)
 	dispatch();
 }
 
-// TODO don't go through so many function calls
+void sleep_until_ns(PCB* pcb, uint64_t deadline)
+{
+	// Keeps going in case it's woken anyway
+	uint64_t now = timer_get_ns();
+	while (now < deadline && !thread_exiting(pcb))
+	{
+		const uint64_t ms = (deadline - now + NS_PER_MS - 1) / NS_PER_MS;
+		sleep_pcb(pcb, ms > 0xFFFFFFFF ? 0xFFFFFFFF : (time_t)ms);
+		now = timer_get_ns();
+	}
+}
+
+/* Take a SLEEPING PCB off its sleep queue before its time is up.
+ */
+static void sleep_cancel(PCB* pcb)
+{
+	QueueNode* node = queue_remove(&run_queues[pcb->cpu].sleep_queue, pcb);
+	ASSERT(node != NULL);
+
+	// Each sleep time is relative to the one before it, so whoever was
+	// next has to wait out this one's time too
+	if (node->next != NULL)
+	{
+		((PCB*)node->next->data)->sleep_time += pcb->sleep_time;
+	}
+
+	pcb->sleep_time = 0;
+	block_free(ba_qnodes, node);
+}
+
+void wake_pcb(PCB* pcb)
+{
+	ASSERT(pcb->state == BLOCKED || pcb->state == SLEEPING);
+
+	if (pcb->state == SLEEPING)
+	{
+		sleep_cancel(pcb);
+	}
+
+	pcb->usage.sleep_cycles += timer_get_cycles() - pcb->state_stamp;
+	pcb->state = READY;
+	trace_wakeup(pcb);
+	schedule(pcb);
+
+	// Don't make a more important process wait for the quantum to end,
+	// schedule() took care of the other processors
+	if (current_pcb != NULL && pcb->cpu == smp_cpu_id() &&
+		pcb->priority < current_pcb->priority)
+	{
+		RunQueue* rq = THIS_RQ();
+		rq->wake_preempt = 1;
+		rq->need_resched = 1;
+	}
+}
+
 void timer_interrupt()
 {
 	kprintf("Timer expired\n");
-	dispatch();
+
+	rcu_poll();
+
+	// The scheduler runs once the interrupt is on its way out, see
+	// schedule_pending()
+	THIS_RQ()->need_resched = 1;
+}
+
+void schedule_pending()
+{
+	RunQueue* rq = THIS_RQ();
+	if (rq->need_resched && rq->preempt_count == 0 && current_pcb != NULL)
+	{
+		dispatch();
+	}
 }
 
-uint32_t get_next_sleep(const uint32_t tick_span)
+static uint32_t get_next_sleep(Queue* sleep_queue, const uint32_t tick_span)
 {
-	if (queue_empty(&sleep_queue))
+	if (queue_empty(sleep_queue))
 	{
 		return 0;
 	}
 
-	QueueNode* peek = queue_peek(&sleep_queue);
+	QueueNode* peek = queue_peek(sleep_queue);
 	PCB* pcb = (PCB*)peek->data;
 	if (pcb->sleep_time <= tick_span)
 	{
 		// Wake this PCB up
+		pcb->usage.sleep_cycles += timer_get_cycles() - pcb->state_stamp;
 		pcb->state = READY;
 		pcb->sleep_time = 0;
+		trace_wakeup(pcb);
 		schedule(pcb);
-		block_free(ba_qnodes, queue_dequeue(&sleep_queue));
+		block_free(ba_qnodes, queue_dequeue(sleep_queue));
 
 		// Check the next guy
-		if (!queue_empty(&sleep_queue))
+		if (!queue_empty(sleep_queue))
 		{
-			peek = queue_peek(&sleep_queue);
+			peek = queue_peek(sleep_queue);
 			pcb = (PCB*)peek->data;
 
 			return pcb->sleep_time;
@@ -237,95 +559,201 @@ uint32_t get_next_sleep(const uint32_t tick_span)
 	}
 }
 
+/* Take the first READY PCB off a run queue. Dead ones found along
+ * the way go to the reaper.
+ */
+static PCB* take_ready(Queue* queue)
+{
+	while (!queue_empty(queue))
+	{
+		QueueNode* node = queue_dequeue(queue);
+		ASSERT(node != NULL);
+		PCB* next = (PCB*)node->data;
+		block_free(ba_qnodes, node);
+
+		switch (next->state)
+		{
+			case KILLED:
+				reaper_enqueue(next);
+				continue;
+			case READY:
+				return next;
+			default:
+				panic("Scheduler: Unhandled case!");
+				break;
+		}
+	}
+
+	return NULL;
+}
+
+/* Pick what this processor runs next. Higher priorities always go
+ * first, even if they have to be taken from another processor.
+ */
+static PCB* pick_next(RunQueue* rq)
+{
+	const uint32_t self = smp_cpu_id();
+	for (uint64_t i = 0; i < NUM_QUEUES; ++i)
+	{
+		PCB* next = take_ready(&rq->queues[i]);
+		if (next != NULL)
+		{
+			return next;
+		}
+
+		// Idle priority processes aren't worth moving
+		for (uint32_t cpu = 0; cpu < smp_num_cpus() && i < IDLE; ++cpu)
+		{
+			if (cpu != self)
+			{
+				next = take_ready(&run_queues[cpu].queues[i]);
+				if (next != NULL)
+				{
+					kprintf("Stole 0x%x from CPU %u\n", next, cpu);
+					return next;
+				}
+			}
+		}
+	}
+
+	return rq->idle;
+}
+
 void dispatch()
 {
-	const uint32_t elapsed = (timer_get_elapsed() / one_ms);
+	RunQueue* rq = THIS_RQ();
+
+	const uint32_t ticks = timer_get_elapsed() + rq->leftover;
+	const uint32_t elapsed = ticks / one_ms;
 	const uint32_t tick_span = elapsed;
-	kprintf("ELAPSED: %u - PREV: %u\n", elapsed, prev_ticks);
+	rq->leftover = ticks % one_ms;
+	kprintf("ELAPSED: %u - PREV: %u\n", elapsed, rq->prev_ticks);
 	kprintf("Tick Span: %u\n", tick_span);
 
 	// Adjust the quantum appropriately
-	if (tick_span > quantum_left) { quantum_left = 0; }
-	else { quantum_left -= tick_span; }
-	kprintf("Quantum: %u\n", quantum_left);
+	if (tick_span > rq->quantum_left) { rq->quantum_left = 0; }
+	else { rq->quantum_left -= tick_span; }
+	kprintf("Quantum: %u\n", rq->quantum_left);
 
-	/*if (queue_empty(&sleep_queue) && queue_empty(&queues[0]))
-	{
-		prev_ticks = quantum_left;
-		return;
-	}
-	*/
+	// Preemption points can't run the scheduler while it's busy
+	preempt_disable();
+
+	// Whatever was running can't be inside rcu_read_lock()
+	rcu_quiescent();
+
+	const uint8_t preempted = rq->wake_preempt;
+	rq->need_resched = 0;
+	rq->wake_preempt = 0;
+
+	// Who was running, and whether they gave up the CPU themselves
+	PCB* const prev = current_pcb;
+	uint8_t voluntary = 1;
+	SwitchReason reason = SWITCH_PREEMPT;
 
 	// TODO do an initial subtraction from head of sleep queue?
-	if (current_pcb->state == KILLED)
+	if (prev == rq->idle)
+	{
+		// The idle thread gets picked again if there's nothing else
+		current_pcb = NULL;
+		rq->quantum_left = 10;
+	}
+	else if (prev->state == KILLED)
 	{
-		cleanup_pcb(current_pcb);
+		// Don't free the address space here, the next process would
+		// have to wait for it. The reaper cleans it up later.
+		reaper_enqueue(prev);
 		current_pcb = NULL;
-		quantum_left = 10;
+		reason = SWITCH_EXIT;
+		rq->quantum_left = 10;
 	}
-	else if (current_pcb->state == SLEEPING || quantum_left == 0)
+	else if (prev->state == BLOCKED || prev->state == ZOMBIE)
 	{
-		if (current_pcb->state == SLEEPING) { kprintf("PCB going to sleep\n"); }
-		else { kprintf("PCB quantum up\n"); }
-		schedule(current_pcb);
+		// Whoever wakes or joins it takes it from here
+		prev->state_stamp = timer_get_cycles();
 		current_pcb = NULL;
-		quantum_left = 10;
+		reason = prev->state == ZOMBIE ? SWITCH_EXIT : SWITCH_BLOCK;
+		rq->quantum_left = 10;
+	}
+	else if (prev->state == SLEEPING || rq->quantum_left == 0 || preempted)
+	{
+		if (prev->state == SLEEPING) { kprintf("PCB going to sleep\n"); reason = SWITCH_SLEEP; }
+		else { kprintf("PCB quantum up\n"); voluntary = 0; }
+		enqueue(prev);
+		current_pcb = NULL;
+		rq->quantum_left = 10;
 	}
 
-	prev_ticks = quantum_left;
+	rq->prev_ticks = rq->quantum_left;
 
 	// Check the next wakeup
-	const uint32_t next_wakeup = get_next_sleep(tick_span);
-	if (next_wakeup > 0 && next_wakeup < quantum_left)
+	const uint32_t next_wakeup = get_next_sleep(&rq->sleep_queue, tick_span);
+	if (next_wakeup > 0 && next_wakeup < rq->quantum_left)
 	{
-		prev_ticks = next_wakeup;
+		rq->prev_ticks = next_wakeup;
 	}
 
 	if (current_pcb != NULL)
 	{
 		kprintf("Not done! 0x%x\n", current_pcb);
-		ASSERT(quantum_left != 0);
-		timer_set_delay(prev_ticks*one_ms);
+		ASSERT(rq->quantum_left != 0);
+		timer_set_delay(rq->prev_ticks*one_ms);
 		timer_start();
+		preempt_enable();
 		return;
 	}
 
-	kprintf("PREV_TICKS: %u\n", prev_ticks);
-	ASSERT(prev_ticks > 0);
+	kprintf("PREV_TICKS: %u\n", rq->prev_ticks);
+	ASSERT(rq->prev_ticks > 0);
 
 	// Pick the next person to run	
-	for (uint64_t i = 0; i < NUM_QUEUES; ++i)
+	PCB* next = pick_next(rq);
+	if (next == NULL)
 	{
-		while (!queue_empty(&queues[i]))
-		{
-			QueueNode* node = queue_dequeue(&queues[i]);
-			ASSERT(node != NULL);
-			PCB* next = (PCB*)node->data;
-			block_free(ba_qnodes, node);
+		panic("Dispatch: Nothing left to run!");
+	}
 
-			switch (next->state)
-			{
-				case KILLED:
-					free_pcb(next);
-					continue;
-				case READY:
-					{
-						kprintf("Next: 0x%x - for %u\n", next, prev_ticks);
-						current_pcb = next;
-						virt_switch_page_table(current_pcb->page_table);
-//			#ifdef BIKESHED_X86_64
-//						tss_set_context_stack((uint64_t)current_pcb->context);	
-//			#endif
-						timer_set_delay(prev_ticks*one_ms);
-						timer_start();
-					}
-					return;
-				default:
-					panic("Scheduler: Unhandled case!");
-					break;
-			}
-		}
+	// Whatever is still waiting here could run somewhere idle
+	kick_idle_cpu(rq);
+
+	kprintf("Next: 0x%x - for %u\n", next, rq->prev_ticks);
+	next->usage.wait_cycles += timer_get_cycles() - next->state_stamp;
+	if (next != prev)
+	{
+		if (voluntary) { ++prev->usage.voluntary_switches; }
+		else { ++prev->usage.involuntary_switches; }
+	}
+	usage_switch(prev);
+	trace_switch(prev, next, reason);
+
+	// Threads of the same process share a page table,
+	// and keep their TLB entries if it isn't reloaded
+	current_pcb = next;
+	next->cpu = smp_cpu_id();
+	vdso_switch(next->cpu, next->pid);
+	if (next->page_table != prev->page_table)
+	{
+		virt_switch_page_table(next->page_table);
+	}
+#ifdef BIKESHED_X86_64
+	tss_set_context_stack(next->kernel_stack);
+	if (next->fs_base != prev->fs_base)
+	{
+		fs_base_set(next->fs_base);
+	}
+	if (next != prev)
+	{
+		fpu_switch(prev, next);
+	}
+#endif
+	timer_set_delay(rq->prev_ticks*one_ms);
+	timer_start();
+
+	// Carries on wherever next left off, this only returns once prev
+	// gets picked again, maybe on another processor
+	if (next != prev)
+	{
+		switch_to(prev, next);
 	}
 
-	panic("Dispatch: Nothing left to run!");
+	schedule_tail();
 }
@@ -3,8 +3,10 @@
 
 #include "pcb.h"
 #include "kernel/timer/defs.h"
+#include "kernel/smp/defs.h"
 
-extern PCB* current_pcb;
+// Each processor has its own
+#define current_pcb (cpu_self()->current)
 
 void scheduler_init(void);
 
@@ -12,14 +14,98 @@ uint8_t schedule(PCB* pcb);
 
 void create_init_process(void);
 
+/* Give current_pcb its first quantum and start the timer. Called
+ * once the first process is ready to run.
+ */
+void scheduler_start(void);
+
 void sleep_pcb(PCB* pcb, time_t time);
 
+/* Sleep until deadline on the timer_get_ns() clock. Never returns
+ * early, the sleep queue counts whole milliseconds so it's rounded up.
+ */
+void sleep_until_ns(PCB* pcb, uint64_t deadline);
+
+/* Make a BLOCKED or SLEEPING PCB runnable again, a SLEEPING one is
+ * taken off its sleep queue early. If it's more important than the
+ * current process, the current process is preempted the next time
+ * schedule_pending() runs. Interrupts must be disabled.
+ *
+ * Parameters:
+ *    pcb - The PCB to wake up
+ */
+void wake_pcb(PCB* pcb);
+
+/* Run dispatch() if an interrupt asked for it and preemption is
+ * enabled. Called on the way out of every interrupt, and by kernel
+ * threads when they re-enable preemption. Interrupts must be disabled.
+ */
+void schedule_pending(void);
+
+/* Free a dead PCB and its address space. The PCB must not be
+ * running. Normally only called by the reaper.
+ */
 void cleanup_pcb(PCB* pcb);
 
 PCB* alloc_pcb(void);
 
 void free_pcb(PCB* pcb);
 
+/* Iterate over all of the allocated PCBs. Start with cursor set to 0
+ * and keep calling until NULL is returned.
+ *
+ * Parameters:
+ *    cursor - Where to start looking, updated to continue the iteration
+ *
+ * Returns:
+ *    The next allocated PCB, or NULL if there are no more
+ */
+PCB* find_pcb(uint64_t* cursor);
+
 void dispatch(void);
 
+/* Give a processor the PCB it runs when there's nothing else to do.
+ * It never goes on a run queue.
+ *
+ * Parameters:
+ *    cpu - The processor it belongs to
+ *    idle - Its idle thread, NULL if the processor didn't start
+ */
+void scheduler_set_idle(uint32_t cpu, PCB* idle);
+
+/* Start running this processor's idle thread. Called once by every
+ * processor other than the first, with the kernel lock held. Never
+ * returns.
+ */
+void scheduler_cpu_start(void);
+
+/* Returns:
+ *    1 if this processor has something other than its idle thread to
+ *    run, 0 otherwise
+ */
+uint8_t scheduler_work_waiting(void);
+
+/* Another processor wants this one to run the scheduler. Called from
+ * the reschedule interrupt.
+ */
+void resched_interrupt(void);
+
+/* Finish a switch to current_pcb. Runs on the new process's kernel
+ * stack, either at the end of dispatch() or when a new process starts.
+ */
+void schedule_tail(void);
+
+/* Stop preemption points from running the scheduler. Calls nest, and
+ * must be matched by preempt_enable().
+ */
+void preempt_disable(void);
+
+void preempt_enable(void);
+
+/* Give the scheduler a chance to run something else in the middle of
+ * a long kernel operation. The caller must not be halfway through
+ * changing anything another process could look at.
+ */
+void preempt_point(void);
+
 #endif
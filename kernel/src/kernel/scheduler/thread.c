@@ -0,0 +1,325 @@
+#include "thread.h"
+#include "reaper.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "events.h"
+
+#include "safety.h"
+#include "kernel/klib.h"
+#include "kernel/panic.h"
+#include "kernel/kprintf.h"
+#include "kernel/alloc/alloc.h"
+#include "kernel/elf/elf.h"
+#include "kernel/ipc/channel.h"
+#include "kernel/smp/defs.h"
+#include "kernel/virt_memory/defs.h"
+#include "kernel/data_structures/block.h"
+
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/virt_memory/paging.h"
+#include "arch/x86_64/virt_memory/physical.h"
+#include "arch/x86_64/interrupts/switch.h"
+#endif
+
+#ifndef DEBUG_THREAD
+#define kprintf(...)
+#endif
+
+COMPILE_ASSERT(THREAD_MAX_STACKS <= 64);
+
+static BlockAllocator* ba_groups = NULL;
+
+void thread_init()
+{
+	const uint64_t size_needed = sizeof(ThreadGroup)*THREAD_MAX_GROUPS + sizeof(BlockAllocator);
+	const void* address = water_mark_alloc(&kernel_WaterMark, size_needed);
+	ba_groups = block_init(address, size_needed, sizeof(ThreadGroup));
+}
+
+static PCB* find_thread(ThreadGroup* group, Pid tid)
+{
+	uint64_t cursor = 0;
+	PCB* pcb = NULL;
+	while ((pcb = find_pcb(&cursor)) != NULL)
+	{
+		if (pcb->pid == tid && pcb->group == group)
+		{
+			return pcb;
+		}
+	}
+
+	return NULL;
+}
+
+static uint64_t stack_top(uint64_t slot)
+{
+	return THREAD_STACK_REGION - slot*(THREAD_STACK_SIZE + THREAD_STACK_GUARD);
+}
+
+static uint8_t map_stack(void* page_table, uint64_t slot)
+{
+	uint64_t address = stack_top(slot) - THREAD_STACK_SIZE;
+	for (; address < stack_top(slot); address += PAGE_SMALL_SIZE)
+	{
+		uint64_t memory_address;
+		if (!virt_map_page(page_table, address, 
+					PG_FLAG_RW | PG_FLAG_USER, PAGE_SMALL, 
+					&memory_address))
+		{
+			return 0;
+		}
+
+		// Most of a stack is never touched, no point caching it
+		memclr_nt(PHYS_TO_VIRT(memory_address), PAGE_SMALL_SIZE);
+	}
+
+	return 1;
+}
+
+PCB* thread_create(PCB* pcb, uint64_t entry, uint64_t arg0, uint64_t arg1)
+{
+	// The first extra thread turns the process into a group
+	if (pcb->group == NULL)
+	{
+		ThreadGroup* group = (ThreadGroup*)block_alloc(ba_groups);
+		if (group == NULL)
+		{
+			return NULL;
+		}
+
+		memclr(group, sizeof(ThreadGroup));
+		group->refs = 1;
+		group->live = 1;
+		group->parent = pcb->ppid;
+		pcb->group = group;
+		pcb->stack_slot = THREAD_MAIN_SLOT;
+	}
+
+	ThreadGroup* group = pcb->group;
+	if (~group->stack_slots == 0)
+	{
+		return NULL;
+	}
+	const uint64_t slot = __builtin_ctzl(~group->stack_slots);
+
+	if ((group->stacks_mapped & (1UL << slot)) == 0)
+	{
+		if (!map_stack(pcb->page_table, slot))
+		{
+			return NULL;
+		}
+		group->stacks_mapped |= 1UL << slot;
+	}
+
+	PCB* new_pcb = alloc_pcb();
+	if (new_pcb == NULL)
+	{
+		return NULL;
+	}
+
+	group->stack_slots |= 1UL << slot;
+	++group->refs;
+	++group->live;
+
+	new_pcb->ppid = pcb->pid;
+	new_pcb->priority = pcb->priority;
+	new_pcb->page_table = pcb->page_table;
+	new_pcb->group = group;
+	new_pcb->stack_slot = slot;
+	channel_share(pcb, new_pcb);
+
+#ifdef BIKESHED_X86_64
+	// Same segments and flags as the creator, everything else is fresh.
+	// The stack looks like entry was just called.
+	Context* context = new_pcb->context;
+	memclr(context, sizeof(Context));
+	context->IP = entry;
+	context->SP = stack_top(slot) - sizeof(uint64_t);
+	context->FLAGS = pcb->context->FLAGS;
+	context->cs = pcb->context->cs;
+	context->ss = pcb->context->ss;
+	context->rdi = arg0;
+	context->rsi = arg1;
+
+	kernel_stack_prepare(new_pcb, NULL);
+#else
+#error "Threads are not implemented on this architecture"
+#endif
+
+	kprintf("Thread: %u created %u on stack %u\n", pcb->pid, new_pcb->pid, slot);
+	trace_wakeup(new_pcb);
+	schedule(new_pcb);
+
+	return new_pcb;
+}
+
+void thread_exit(PCB* pcb, uint64_t value)
+{
+	ASSERT(pcb == current_pcb);
+
+	// Nobody is going to wait on them any more
+	events_release(pcb);
+	channel_release(pcb);
+
+	ThreadGroup* group = pcb->group;
+	if (group == NULL)
+	{
+		// Just a process
+		events_raise(EVENT_CHILD_EXIT, pcb->ppid);
+		pcb->state = KILLED;
+		dispatch();
+		return;
+	}
+
+	kprintf("Thread: %u exiting with %u\n", pcb->pid, value);
+	if (pcb->stack_slot != THREAD_MAIN_SLOT)
+	{
+		group->stack_slots &= ~(1UL << pcb->stack_slot);
+	}
+	--group->live;
+
+	// exit() already let go of any joiners, see thread_exit_group()
+	if (pcb->joiner != NULL)
+	{
+		// It points at the joiner's kernel stack, which is mapped
+		// everywhere
+		*pcb->joiner->join_value = value;
+		wake_pcb(pcb->joiner);
+		pcb->state = KILLED;
+	}
+	else if (group->live == 0)
+	{
+		// Nobody is left to join the zombies. The process is gone,
+		// whichever thread happened to go last.
+		events_raise(EVENT_CHILD_EXIT, group->parent);
+		uint64_t cursor = 0;
+		PCB* other = NULL;
+		while ((other = find_pcb(&cursor)) != NULL)
+		{
+			if (other->group == group && other->state == ZOMBIE)
+			{
+				other->state = KILLED;
+				reaper_enqueue(other);
+			}
+		}
+
+		pcb->state = KILLED;
+	}
+	else
+	{
+		pcb->exit_value = value;
+		pcb->state = ZOMBIE;
+	}
+
+	dispatch();
+}
+
+void thread_exit_group(PCB* pcb)
+{
+	ThreadGroup* group = pcb->group;
+	if (group != NULL && !group->exiting)
+	{
+		kprintf("Thread: %u ending its process\n", pcb->pid);
+		group->exiting = 1;
+
+		const uint32_t self = smp_cpu_id();
+		uint64_t cursor = 0;
+		PCB* other = NULL;
+		while ((other = find_pcb(&cursor)) != NULL)
+		{
+			if (other->group != group || other == pcb)
+			{
+				continue;
+			}
+
+			// Nobody is going to be handed a value now, and a joiner
+			// could be gone before the one it joined
+			other->joiner = NULL;
+
+			if (other->state == BLOCKED || other->state == SLEEPING)
+			{
+				wake_pcb(other);
+			}
+			else if (other->state == READY && other->cpu != self)
+			{
+				// It could be in user mode over there, don't wait for
+				// its quantum to run out
+				smp_reschedule(other->cpu);
+			}
+		}
+	}
+
+	thread_exit(pcb, 0);
+}
+
+uint8_t thread_exiting(const PCB* pcb)
+{
+	return pcb->group != NULL && pcb->group->exiting;
+}
+
+void thread_return_user()
+{
+	// Nothing is held on the way out, so this is where the rest of an
+	// exiting process goes
+	PCB* const pcb = current_pcb;
+	if (thread_exiting(pcb))
+	{
+		thread_exit(pcb, 0);
+	}
+}
+
+uint8_t thread_join(PCB* pcb, Pid tid, uint64_t* value_out)
+{
+	if (pcb->group == NULL)
+	{
+		return 0;
+	}
+
+	if (pcb->group->exiting)
+	{
+		return 0;
+	}
+
+	PCB* other = find_thread(pcb->group, tid);
+	if (other == NULL || other == pcb || other->joiner != NULL || 
+		other->state == KILLED)
+	{
+		return 0;
+	}
+
+	if (other->state == ZOMBIE)
+	{
+		*value_out = other->exit_value;
+		other->state = KILLED;
+		reaper_enqueue(other);
+		return 1;
+	}
+
+	// thread_exit() fills in the value and wakes us up
+	kprintf("Thread: %u joining %u\n", pcb->pid, tid);
+	pcb->join_value = value_out;
+	other->joiner = pcb;
+	pcb->state = BLOCKED;
+	dispatch();
+
+	// Woken by exit() rather than by the other thread
+	return !pcb->group->exiting;
+}
+
+uint8_t thread_release(PCB* pcb)
+{
+	ThreadGroup* group = pcb->group;
+	if (group == NULL)
+	{
+		return 1;
+	}
+
+	ASSERT(group->refs > 0);
+	if (--group->refs > 0)
+	{
+		return 0;
+	}
+
+	block_free(ba_groups, group);
+	return 1;
+}
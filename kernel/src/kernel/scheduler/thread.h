@@ -0,0 +1,112 @@
+#ifndef __SCHEDULER_THREAD_H__
+#define __SCHEDULER_THREAD_H__
+
+#include "pcb.h"
+#include "inttypes.h"
+
+/* User threads. A thread is a PCB that shares its page table with the
+ * rest of its process, so it gets its own kernel stack, Context and
+ * accounting like any other PCB. The ThreadGroup keeps the address
+ * space alive until the last of them has been cleaned up.
+ *
+ * Every thread but the first gets a user stack in a fixed slot below
+ * the main stack. The slots stay mapped once used and are handed out
+ * again to later threads.
+ *
+ * thread_exit() only ends the calling thread. A thread's exit value is
+ * kept until another thread joins it, or until every thread has exited.
+ * exit() ends the whole process: the other threads are woken from
+ * whatever they're waiting on and end as they head back to user mode.
+ */
+
+#define THREAD_MAX_GROUPS 128
+
+// One bit each in ThreadGroup's bitmaps
+#define THREAD_MAX_STACKS 64
+#define THREAD_MAIN_SLOT 0xFF
+
+#ifdef BIKESHED_X86_64
+#define THREAD_STACK_SIZE 0x4000
+#define THREAD_STACK_GUARD 0x1000
+#define THREAD_STACK_REGION (USER_STACK_LOCATION - USER_STACK_SIZE - THREAD_STACK_GUARD)
+#endif
+
+/* Initialize the ThreadGroup allocator. Must be called after the
+ * kernel's allocators have been setup.
+ */
+void thread_init(void);
+
+/* Start a new thread in pcb's process. It begins at entry(arg0, arg1)
+ * on a fresh user stack.
+ *
+ * Parameters:
+ *    pcb - The thread creating the new one
+ *    entry - Where the new thread starts, it must not return
+ *    arg0 - First parameter to entry
+ *    arg1 - Second parameter to entry
+ *
+ * Returns:
+ *    The new thread's PCB, or NULL if there are no PCBs or stacks left
+ */
+PCB* thread_create(PCB* pcb, uint64_t entry, uint64_t arg0, uint64_t arg1);
+
+/* End the calling thread and switch to something else. If it was the
+ * last thread in its process the whole process goes away.
+ *
+ * Parameters:
+ *    pcb - The calling thread
+ *    value - Handed to whoever joins this thread
+ */
+void thread_exit(PCB* pcb, uint64_t value);
+
+/* End every thread in the calling thread's process, then the calling
+ * thread itself. Doesn't return.
+ *
+ * Parameters:
+ *    pcb - The calling thread
+ */
+void thread_exit_group(PCB* pcb);
+
+/* Whether pcb's process is exiting. Anything that blocks checks this
+ * first, and loops that wait give up, so the thread can get back out
+ * of the kernel.
+ *
+ * Parameters:
+ *    pcb - The thread to check
+ *
+ * Returns:
+ *    1 if thread_exit_group() was called in its process
+ */
+uint8_t thread_exiting(const PCB* pcb);
+
+/* Called on every return to user mode. If the thread's process is
+ * exiting the thread ends here instead.
+ */
+void thread_return_user(void);
+
+/* Wait for another thread in the same process to exit. Fills in the
+ * caller's Context with the result, either now or when the other
+ * thread exits.
+ *
+ * Parameters:
+ *    pcb - The calling thread
+ *    tid - The pid of the thread to wait for
+ *    value_out - Where to write the exit value, in the caller's
+ *                address space
+ *
+ * Returns:
+ *    0 if there is no such thread, or someone else is joining it
+ */
+uint8_t thread_join(PCB* pcb, Pid tid, uint64_t* value_out);
+
+/* Drop a dead PCB's reference to its address space.
+ *
+ * Parameters:
+ *    pcb - The PCB being cleaned up
+ *
+ * Returns:
+ *    1 if nothing else uses the address space and it should be freed
+ */
+uint8_t thread_release(PCB* pcb);
+
+#endif
@@ -0,0 +1,109 @@
+#include "trace.h"
+
+#include "kernel/klib.h"
+#include "kernel/kprintf.h"
+#include "kernel/timer/defs.h"
+
+// One run queue per priority
+#define TRACE_PRIORITIES (IDLE+1)
+
+static Histogram wakeup_latency;
+static Histogram run_queue_delay[TRACE_PRIORITIES];
+static Histogram quantum_use;
+
+static SwitchEvent switch_ring[TRACE_RING_SIZE];
+static uint64_t switch_count = 0;
+
+static const char* reason_names[] = { "preempt", "sleep", "exit", "block" };
+
+static void histogram_add(Histogram* hist, uint64_t value)
+{
+	const uint64_t bucket = value == 0 ? 0 : 63 - __builtin_clzl(value);
+
+	++hist->count;
+	++hist->buckets[bucket];
+	if (value > hist->max)
+	{
+		hist->max = value;
+	}
+}
+
+static void histogram_dump(const char* name, const Histogram* hist)
+{
+	serial_printf("%s: %u samples, max %u cycles\n", name, hist->count, hist->max);
+	for (uint64_t i = 0; i < TRACE_BUCKETS; ++i)
+	{
+		if (hist->buckets[i] > 0)
+		{
+			serial_printf("  < 2^%u: %u\n", i+1, hist->buckets[i]);
+		}
+	}
+}
+
+void trace_wakeup(PCB* pcb)
+{
+	pcb->wake_stamp = timer_get_cycles();
+}
+
+void trace_switch(PCB* prev, PCB* next, SwitchReason reason)
+{
+	const uint64_t now = timer_get_cycles();
+
+	if (prev != NULL && prev->run_stamp != 0)
+	{
+		histogram_add(&quantum_use, now - prev->run_stamp);
+	}
+
+	if (next->priority < TRACE_PRIORITIES)
+	{
+		histogram_add(&run_queue_delay[next->priority], now - next->state_stamp);
+	}
+
+	if (next->wake_stamp != 0)
+	{
+		histogram_add(&wakeup_latency, now - next->wake_stamp);
+		next->wake_stamp = 0;
+	}
+
+	next->run_stamp = now;
+
+	if (prev != next)
+	{
+		SwitchEvent* event = &switch_ring[switch_count % TRACE_RING_SIZE];
+		event->stamp = now;
+		event->from = prev != NULL ? prev->pid : 0;
+		event->to = next->pid;
+		event->reason = reason;
+		++switch_count;
+	}
+}
+
+void trace_dump()
+{
+	serial_printf("==== Scheduler trace ====\n");
+	histogram_dump("Wakeup latency", &wakeup_latency);
+	for (uint64_t i = 0; i < TRACE_PRIORITIES; ++i)
+	{
+		serial_printf("Priority %u ", i);
+		histogram_dump("run queue delay", &run_queue_delay[i]);
+	}
+	histogram_dump("Quantum use", &quantum_use);
+
+	const uint64_t first = switch_count > TRACE_RING_SIZE ? 
+		switch_count - TRACE_RING_SIZE : 0;
+	serial_printf("Last %u of %u switches:\n", switch_count - first, switch_count);
+	for (uint64_t i = first; i < switch_count; ++i)
+	{
+		const SwitchEvent* event = &switch_ring[i % TRACE_RING_SIZE];
+		serial_printf("  %u: %u -> %u (%s)\n", event->stamp, 
+				event->from, event->to, reason_names[event->reason]);
+	}
+}
+
+void trace_reset()
+{
+	memclr(&wakeup_latency, sizeof(wakeup_latency));
+	memclr(run_queue_delay, sizeof(run_queue_delay));
+	memclr(&quantum_use, sizeof(quantum_use));
+	switch_count = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef __SCHEDULER_TRACE_H__
+#define __SCHEDULER_TRACE_H__
+
+#include "pcb.h"
+#include "inttypes.h"
+
+/* Scheduler latency tracing. Keeps log2 histograms (in cycles) of
+ * how long woken processes wait before they run, how long processes
+ * sit on each run queue, and how much of the CPU they use each time
+ * they are picked. The most recent context switches are also kept in
+ * a ring so they can be dumped over the serial port.
+ */
+
+#define TRACE_BUCKETS 64
+#define TRACE_RING_SIZE 256
+
+typedef enum
+{
+	SWITCH_PREEMPT = 0, // Quantum used up
+	SWITCH_SLEEP,       // Went to sleep
+	SWITCH_EXIT,        // Process died
+	SWITCH_BLOCK,       // Waiting for something other than time
+} SwitchReason;
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[TRACE_BUCKETS];
+} Histogram;
+
+typedef struct
+{
+	uint64_t stamp;
+	Pid from;
+	Pid to;
+	SwitchReason reason;
+} SwitchEvent;
+
+/* Record that a PCB has become runnable after sleeping (or being
+ * created). The time until it's dispatched is its wakeup latency.
+ *
+ * Parameters:
+ *    pcb - The PCB that was woken up
+ */
+void trace_wakeup(PCB* pcb);
+
+/* Record that the scheduler picked a PCB off of a run queue.
+ *
+ * Parameters:
+ *    prev - The PCB that was running before, may be NULL
+ *    next - The PCB that is about to run
+ *    reason - Why prev stopped running
+ */
+void trace_switch(PCB* prev, PCB* next, SwitchReason reason);
+
+/* Print all of the histograms and the recent switches to the
+ * serial port.
+ */
+void trace_dump(void);
+
+/* Clear all of the histograms and the switch ring.
+ */
+void trace_reset(void);
+
+#endif
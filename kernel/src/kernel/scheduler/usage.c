@@ -0,0 +1,46 @@
+#include "usage.h"
+#include "scheduler.h"
+
+#include "kernel/klib.h"
+#include "kernel/timer/defs.h"
+#include "kernel/virt_memory/defs.h"
+
+// When the last accounting boundary happened on each processor
+static uint64_t last_stamp[MAX_CPUS];
+
+static uint64_t usage_elapsed()
+{
+	uint64_t* const stamp = &last_stamp[smp_cpu_id()];
+	const uint64_t now = timer_get_cycles();
+	const uint64_t elapsed = *stamp == 0 ? 0 : now - *stamp;
+	*stamp = now;
+
+	return elapsed;
+}
+
+void usage_kernel_enter()
+{
+	const uint64_t elapsed = usage_elapsed();
+	current_pcb->usage.user_cycles += elapsed;
+}
+
+void usage_kernel_exit()
+{
+	const uint64_t elapsed = usage_elapsed();
+	current_pcb->usage.kernel_cycles += elapsed;
+}
+
+void usage_switch(PCB* prev)
+{
+	const uint64_t elapsed = usage_elapsed();
+	if (prev != NULL)
+	{
+		prev->usage.kernel_cycles += elapsed;
+	}
+}
+
+void usage_get(const PCB* pcb, Usage* out)
+{
+	memcpy(out, &pcb->usage, sizeof(Usage));
+	out->resident_pages = virt_count_pages(pcb->page_table);
+}
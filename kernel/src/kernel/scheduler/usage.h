@@ -0,0 +1,42 @@
+#ifndef __SCHEDULER_USAGE_H__
+#define __SCHEDULER_USAGE_H__
+
+#include "pcb.h"
+
+/* Per process CPU time accounting. The time between two kernel
+ * boundaries is charged to whichever process was running, as user
+ * time when coming from user land and as kernel time otherwise.
+ *
+ * The architecture's interrupt entry and exit paths call
+ * usage_kernel_enter() and usage_kernel_exit(). The scheduler calls
+ * usage_switch() whenever it changes current_pcb.
+ */
+
+/* Charge the time since the last kernel exit to the current process
+ * as user time. Called on every kernel entry.
+ */
+void usage_kernel_enter(void);
+
+/* Charge the time since the last boundary to the current process
+ * as kernel time. Called on every kernel exit.
+ */
+void usage_kernel_exit(void);
+
+/* Charge the kernel time spent so far to the process that is being
+ * switched away from.
+ *
+ * Parameters:
+ *    prev - The process that was running, may be NULL
+ */
+void usage_switch(PCB* prev);
+
+/* Copy out the usage of a process, filling in the fields that are
+ * only calculated on request.
+ *
+ * Parameters:
+ *    pcb - The process to get the usage of
+ *    out - Where to store the usage
+ */
+void usage_get(const PCB* pcb, Usage* out);
+
+#endif
@@ -0,0 +1,93 @@
+#include "waitqueue.h"
+#include "scheduler.h"
+#include "thread.h"
+
+#include "safety.h"
+
+void wait_queue_init(WaitQueue* queue)
+{
+	queue->head = NULL;
+	queue->tail = NULL;
+}
+
+static void wait_queue_remove(WaitQueue* queue, WaitEntry* entry)
+{
+	if (entry->prev == NULL) { queue->head = entry->next; }
+	else { entry->prev->next = entry->next; }
+
+	if (entry->next == NULL) { queue->tail = entry->prev; }
+	else { entry->next->prev = entry->prev; }
+
+	entry->pcb = NULL;
+}
+
+uint8_t wait_queue_wait(WaitQueue* queue, time_t timeout)
+{
+	PCB* const pcb = current_pcb;
+	ASSERT(pcb != NULL);
+
+	// Nothing would wake it again, see thread_exit_group()
+	if (thread_exiting(pcb))
+	{
+		return 0;
+	}
+
+	WaitEntry entry;
+	entry.pcb = pcb;
+	entry.next = NULL;
+	entry.prev = queue->tail;
+	if (queue->tail == NULL) { queue->head = &entry; }
+	else { queue->tail->next = &entry; }
+	queue->tail = &entry;
+
+	if (timeout != 0)
+	{
+		sleep_pcb(pcb, timeout);
+	}
+	else
+	{
+		pcb->state = BLOCKED;
+		dispatch();
+	}
+
+	// Waking takes us off the queue, running out of time doesn't
+	if (entry.pcb != NULL)
+	{
+		wait_queue_remove(queue, &entry);
+		return 0;
+	}
+
+	return 1;
+}
+
+uint8_t wait_queue_wake_one(WaitQueue* queue)
+{
+	WaitEntry* const entry = queue->head;
+	if (entry == NULL)
+	{
+		return 0;
+	}
+
+	PCB* const pcb = entry->pcb;
+	wait_queue_remove(queue, entry);
+
+	// If its timeout just ran out it's already READY, and will see
+	// that it was woken when it runs
+	if (pcb->state == BLOCKED || pcb->state == SLEEPING)
+	{
+		wake_pcb(pcb);
+	}
+
+	return 1;
+}
+
+uint64_t wait_queue_wake_all(WaitQueue* queue)
+{
+	uint64_t woken = 0;
+	while (wait_queue_wake_one(queue))
+	{
+		++woken;
+	}
+
+	return woken;
+}
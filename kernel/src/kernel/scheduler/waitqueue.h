@@ -0,0 +1,55 @@
+#ifndef __SCHEDULER_WAITQUEUE_H__
+#define __SCHEDULER_WAITQUEUE_H__
+
+#include "pcb.h"
+#include "inttypes.h"
+#include "kernel/timer/defs.h"
+
+/* Somewhere for processes to block until an event happens, instead of
+ * polling for it. Whatever causes the event wakes them back up.
+ *
+ * Entries live on the waiting process's kernel stack, so waiting never
+ * allocates. Everything here must be called with interrupts disabled.
+ */
+
+typedef struct WaitEntry
+{
+	struct WaitEntry* next;
+	struct WaitEntry* prev;
+	PCB* pcb; // NULL once it has been woken
+} WaitEntry;
+
+typedef struct
+{
+	WaitEntry* head;
+	WaitEntry* tail;
+} WaitQueue;
+
+void wait_queue_init(WaitQueue* queue);
+
+/* Block current_pcb until it's woken or the timeout runs out. The
+ * caller should check for the event before waiting, and again after,
+ * since someone else can get to it first.
+ *
+ * Parameters:
+ *    queue - The queue to wait on
+ *    timeout - Milliseconds to wait for, 0 waits forever
+ *
+ * Returns:
+ *    1 if it was woken, 0 if the timeout ran out
+ */
+uint8_t wait_queue_wait(WaitQueue* queue, time_t timeout);
+
+/* Wake the process that has been waiting the longest.
+ *
+ * Returns:
+ *    1 if a process was woken, 0 if nobody was waiting
+ */
+uint8_t wait_queue_wake_one(WaitQueue* queue);
+
+/* Returns:
+ *    How many processes were woken
+ */
+uint64_t wait_queue_wake_all(WaitQueue* queue);
+
+#endif
@@ -0,0 +1,99 @@
+#include "workqueue.h"
+#include "kthread.h"
+#include "scheduler.h"
+
+#include "safety.h"
+#include "kernel/panic.h"
+#include "kernel/kprintf.h"
+#include "kernel/alloc/alloc.h"
+#include "kernel/interrupts/defs.h"
+#include "kernel/data_structures/block.h"
+#include "kernel/data_structures/queue.h"
+
+#ifndef DEBUG_WORKQUEUE
+#define kprintf(...)
+#endif
+
+typedef struct
+{
+	QueueNode node;
+	work_fn fn;
+	void* arg;
+} Work;
+
+static BlockAllocator* ba_work = NULL;
+static Queue work_queue;
+static PCB* worker_pcb = NULL;
+
+static void worker(void* arg)
+{
+	UNUSED(arg);
+
+	while (1)
+	{
+		interrupts_disable();
+		if (queue_empty(&work_queue))
+		{
+			// queue_work() wakes us back up
+			current_pcb->state = BLOCKED;
+			dispatch();
+			interrupts_enable();
+			continue;
+		}
+
+		Work* work = (Work*)queue_dequeue(&work_queue)->data;
+		const work_fn fn = work->fn;
+		void* const fn_arg = work->arg;
+		block_free(ba_work, work);
+
+		kprintf("Work: Running 0x%x(0x%x)\n", fn, fn_arg);
+		preempt_disable();
+		interrupts_enable();
+
+		fn(fn_arg);
+
+		interrupts_disable();
+		preempt_enable();
+
+		// Let whatever the work or an interrupt woke up have the CPU
+		schedule_pending();
+		interrupts_enable();
+	}
+}
+
+void workqueue_init()
+{
+	const uint64_t size_needed = sizeof(Work)*WORK_MAX_PENDING + sizeof(BlockAllocator);
+	const void* address = water_mark_alloc(&kernel_WaterMark, size_needed);
+	ba_work = block_init(address, size_needed, sizeof(Work));
+
+	queue_init(&work_queue);
+
+	worker_pcb = kthread_create(worker, NULL, HIGH);
+	if (worker_pcb == NULL)
+	{
+		panic("Work queue: Failed to create the worker");
+	}
+}
+
+uint8_t queue_work(work_fn fn, void* arg)
+{
+	Work* work = (Work*)block_alloc(ba_work);
+	if (work == NULL)
+	{
+		kprintf("Work: Queue is full\n");
+		return 0;
+	}
+
+	work->fn = fn;
+	work->arg = arg;
+	work->node.data = work;
+	queue_enqueue(&work_queue, &work->node);
+
+	if (worker_pcb->state == BLOCKED)
+	{
+		wake_pcb(worker_pcb);
+	}
+
+	return 1;
+}
@@ -0,0 +1,35 @@
+#ifndef __SCHEDULER_WORKQUEUE_H__
+#define __SCHEDULER_WORKQUEUE_H__
+
+#include "inttypes.h"
+
+/* Work that is too slow for an interrupt handler or a softirq. Queued
+ * work is run in order by a kernel worker thread. Each item runs with
+ * interrupts enabled and preemption disabled, the worker can be
+ * preempted between items.
+ */
+
+typedef void (*work_fn)(void* arg);
+
+/* How many work items can be waiting at once.
+ */
+#define WORK_MAX_PENDING 64
+
+/* Setup the work queue and create its worker thread. Must be called
+ * after the scheduler has been initialized.
+ */
+void workqueue_init(void);
+
+/* Queue fn(arg) to run on the worker thread. Interrupts must be
+ * disabled, as they are in interrupt handlers and system calls.
+ *
+ * Parameters:
+ *    fn - The work to do
+ *    arg - Passed to fn
+ *
+ * Returns:
+ *    1 if the work was queued, 0 if too much work is already waiting
+ */
+uint8_t queue_work(work_fn fn, void* arg);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __KERNEL_SMP_DEFS_H__
+#define __KERNEL_SMP_DEFS_H__
+
+#include "inttypes.h"
+
+/* Every processor runs user code at the same time, but only one of
+ * them can be inside the kernel. Whoever holds the kernel lock owns
+ * all of the kernel's data. It is taken on every kernel entry and let
+ * go on the way back to user mode, or when a CPU goes idle.
+ */
+
+#define MAX_CPUS 16
+
+/* Find the other processors and start them. Each one gets an idle
+ * thread and waits for the kernel lock before it starts scheduling.
+ * Defined in the architecture specific files.
+ */
+extern void smp_init(void);
+
+/* Returns:
+ *    How many processors are running
+ */
+extern uint32_t smp_num_cpus(void);
+
+/* Ask another processor to run the scheduler as soon as it can.
+ *
+ * Parameters:
+ *    cpu - The processor to interrupt
+ */
+extern void smp_reschedule(uint32_t cpu);
+
+/* Make sure no other processor keeps a stale TLB entry after a
+ * mapping has been removed or changed. The caller flushes its own.
+ *
+ * Parameters:
+ *    table - The page table that was changed
+ *    virt_addr - The address whose mapping changed
+ */
+extern void tlb_shootdown(void* table, uint64_t virt_addr);
+
+/* Like tlb_shootdown(), but for every mapping in the page table.
+ *
+ * Parameters:
+ *    table - The page table that was changed
+ */
+extern void tlb_shootdown_all(void* table);
+
+/* Take the kernel lock, spinning until it is free. Does nothing if
+ * this processor already has it.
+ */
+extern void kernel_lock(void);
+
+extern void kernel_unlock(void);
+
+/* Returns:
+ *    1 if this processor holds the kernel lock, 0 otherwise
+ */
+extern uint8_t kernel_lock_held(void);
+
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/smp/cpu.h"
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+#include "ring.h"
+#include "uaccess.h"
+
+#include "safety.h"
+#include "kernel/kprintf.h"
+#include "kernel/scheduler/scheduler.h"
+#include "kernel/scheduler/futex.h"
+#include "kernel/ipc/channel.h"
+
+COMPILE_ASSERT((RING_SQ_ENTRIES & (RING_SQ_ENTRIES - 1)) == 0);
+COMPILE_ASSERT((RING_CQ_ENTRIES & (RING_CQ_ENTRIES - 1)) == 0);
+
+// How much of a RING_WRITE goes to the console at a time
+#define WRITE_CHUNK 64
+
+// The four indices at the front of a Ring
+typedef struct
+{
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+} RingIndices;
+
+static uint64_t ring_write(const char* user_buffer, uint64_t size)
+{
+	char chunk[WRITE_CHUNK + 1];
+	while (size > 0)
+	{
+		const uint64_t amount = size < WRITE_CHUNK ? size : WRITE_CHUNK;
+		if (copy_from_user(chunk, user_buffer, amount) != SUCCESS)
+		{
+			return BAD_ADDRESS;
+		}
+
+		chunk[amount] = '\0';
+		serial_printf("%s", chunk);
+
+		user_buffer += amount;
+		size -= amount;
+	}
+
+	return SUCCESS;
+}
+
+static uint64_t ring_channel(PCB* pcb, const RingSubmission* sub)
+{
+	IpcMessage* user_msg = (IpcMessage*)sub->args[1];
+	IpcMessage msg;
+	if (copy_from_user(&msg, user_msg, sizeof(msg)) != SUCCESS)
+	{
+		return BAD_ADDRESS;
+	}
+
+	if (sub->op == RING_CHANNEL_SEND)
+	{
+		return channel_send(pcb, sub->args[0], &msg);
+	}
+
+	const Status status = channel_recv(pcb, sub->args[0], &msg);
+	if (status != SUCCESS && status != TRUNCATED)
+	{
+		return status;
+	}
+
+	const Status copied = copy_to_user(user_msg, &msg, sizeof(msg));
+	return copied != SUCCESS ? copied : status;
+}
+
+static uint64_t ring_run(PCB* pcb, const RingSubmission* sub)
+{
+	switch (sub->op)
+	{
+	case RING_NOP:
+		return SUCCESS;
+
+	case RING_WRITE:
+		return ring_write((const char*)sub->args[1], sub->args[0]);
+
+	case RING_SLEEP:
+	{
+		const uint64_t deadline = (sub->flags & TIMER_ABSTIME) ?
+			sub->args[0] : timer_get_ns() + sub->args[0];
+		sleep_until_ns(pcb, deadline);
+		return SUCCESS;
+	}
+
+	case RING_FUTEX_WAKE:
+		return futex_wake(pcb, (uint32_t*)sub->args[0], sub->args[1]);
+
+	case RING_CHANNEL_SEND:
+	case RING_CHANNEL_RECV:
+		return ring_channel(pcb, sub);
+
+	default:
+		return BAD_PARAM;
+	}
+}
+
+/* Hand back a finished submission. The process may have moved cq_head
+ * while the request was asleep, so the indices are read again.
+ */
+static Status ring_complete(Ring* ring, uint64_t user_data, uint64_t result)
+{
+	RingIndices idx;
+	if (copy_from_user(&idx, ring, sizeof(idx)) != SUCCESS)
+	{
+		return BAD_ADDRESS;
+	}
+
+	if (idx.cq_tail - idx.cq_head >= RING_CQ_ENTRIES)
+	{
+		uint32_t dropped;
+		if (copy_from_user(&dropped, (void*)&ring->dropped, sizeof(dropped)) != SUCCESS)
+		{
+			return BAD_ADDRESS;
+		}
+
+		++dropped;
+		return copy_to_user((void*)&ring->dropped, &dropped, sizeof(dropped));
+	}
+
+	// The entry has to be there before the process can see the new tail
+	const RingCompletion completion = { .user_data = user_data, .result = result };
+	if (copy_to_user(&ring->cq[idx.cq_tail & (RING_CQ_ENTRIES - 1)],
+			&completion, sizeof(completion)) != SUCCESS)
+	{
+		return BAD_ADDRESS;
+	}
+
+	++idx.cq_tail;
+	return copy_to_user((void*)&ring->cq_tail, &idx.cq_tail, sizeof(idx.cq_tail));
+}
+
+uint32_t ring_enter(PCB* pcb, Ring* ring, uint32_t to_submit)
+{
+	ASSERT(pcb == current_pcb);
+
+	uint32_t taken = 0;
+	while (taken < to_submit)
+	{
+		RingIndices idx;
+		if (copy_from_user(&idx, ring, sizeof(idx)) != SUCCESS)
+		{
+			break;
+		}
+
+		// Only take what there's room to answer
+		if (idx.sq_head == idx.sq_tail ||
+			idx.cq_tail - idx.cq_head >= RING_CQ_ENTRIES)
+		{
+			break;
+		}
+
+		RingSubmission sub;
+		if (copy_from_user(&sub, &ring->sq[idx.sq_head & (RING_SQ_ENTRIES - 1)],
+				sizeof(sub)) != SUCCESS)
+		{
+			break;
+		}
+
+		++idx.sq_head;
+		if (copy_to_user((void*)&ring->sq_head, &idx.sq_head, sizeof(idx.sq_head)) != SUCCESS)
+		{
+			break;
+		}
+
+		++taken;
+		const uint64_t result = ring_run(pcb, &sub);
+		if (ring_complete(ring, sub.user_data, result) != SUCCESS)
+		{
+			break;
+		}
+	}
+
+	return taken;
+}
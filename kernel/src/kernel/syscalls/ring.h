@@ -0,0 +1,31 @@
+#ifndef __KERNEL_SYSCALLS_RING_H__
+#define __KERNEL_SYSCALLS_RING_H__
+
+#include "inttypes.h"
+#include "types.h"
+#include "kernel/scheduler/pcb.h"
+
+/* Batched system calls. A process fills in RingSubmissions in a Ring
+ * it keeps in its own memory, then hands over the whole batch with a
+ * single ring_enter(). Each one is answered with a RingCompletion
+ * carrying its user_data.
+ *
+ * Requests run in order on the caller's kernel stack. A submission is
+ * taken off the ring before it runs, so other threads entering the
+ * same ring while one is asleep never run it twice.
+ */
+
+/* Run the waiting submissions. Stops early if the completion ring is
+ * full, what's left stays queued for the next call.
+ *
+ * Parameters:
+ *    pcb - The caller, must be current_pcb
+ *    ring - The Ring in pcb's address space
+ *    to_submit - How many submissions to run at most
+ *
+ * Returns:
+ *    How many submissions were taken, stopping at the first bad address
+ */
+uint32_t ring_enter(PCB* pcb, Ring* ring, uint32_t to_submit);
+
+#endif
@@ -5,10 +5,18 @@
 #include "kernel/scheduler/pcb.h"
 #include "kernel/virt_memory/defs.h"
 #include "kernel/scheduler/scheduler.h"
+#include "kernel/scheduler/usage.h"
+#include "kernel/scheduler/trace.h"
+#include "kernel/scheduler/thread.h"
+#include "kernel/scheduler/futex.h"
+#include "kernel/scheduler/events.h"
 #include "kernel/keyboard/defs.h"
 #include "kernel/interrupts/defs.h"
 #include "kernel/kprintf.h"
 #include "kernel/klib.h"
+#include "kernel/ipc/channel.h"
+#include "uaccess.h"
+#include "ring.h"
 
 
 #ifndef DEBUG_SYSCALL
@@ -22,6 +30,9 @@
 #ifdef BIKESHED_X86_64
 #include "arch/x86_64/virt_memory/paging.h"
 #include "arch/x86_64/virt_memory/physical.h"
+#include "arch/x86_64/interrupts/switch.h"
+#include "arch/x86_64/fpu/fpu.h"
+#include "arch/x86_64/uaccess/uaccess.h"
 #endif
 
 // The system call lookup table
@@ -32,18 +43,42 @@ static void msleep(PCB*);
 static void set_priority(PCB*);
 static void key_avail(PCB*);
 static void get_key(PCB*);
+static void get_usage(PCB*);
+static void proc_info(PCB*);
+static void sched_trace(PCB*);
+static void new_thread(PCB*);
+static void end_thread(PCB*);
+static void join_thread(PCB*);
+static void set_tls(PCB*);
+static void wait_futex(PCB*);
+static void wake_futex(PCB*);
+static void read_key(PCB*);
+static void add_event(PCB*);
+static void remove_event(PCB*);
+static void wait_events(PCB*);
+static void timer_settime(PCB*);
+static void timer_getoverrun(PCB*);
+static void clock_gettime(PCB*);
+static void clock_nanosleep(PCB*);
+static void enter_ring(PCB*);
+static void make_channel(PCB*);
+static void send_message(PCB*);
+static void receive_message(PCB*);
+static void close_channel(PCB*);
 static void syscall_interrupt(uint64_t vector, uint64_t error);
 
-extern PCB* current_pcb;
 
-static void (*syscall_functions[NUM_SYSCALLS])(PCB*); /*=
+// Runs on the new process's kernel stack the first time it is scheduled
+static void fork_child_start(void)
 {
-	fork,  // 0
-	exec,  // 1
-	exit,  // 2
-	msleep // 3
-};
-*/
+	// The parent already checked the address, the mapping is a copy
+	const Pid child = 1;
+	copy_to_user((void*)current_pcb->context->rdi, &child, sizeof(Pid));
+}
+
+// Filled in by syscalls_init() before anything can make a call, and
+// never changed after
+static void (*syscall_functions[NUM_SYSCALLS])(PCB*);
 
 //============================================================================
 // Fork System Call
@@ -52,6 +87,15 @@ static void (*syscall_functions[NUM_SYSCALLS])(PCB*); /*=
 void fork(PCB* pcb)
 {
 	kprintf("====FORK====\n");
+
+	// Fill in the parent's pid first, the child can't be undone
+	const Pid parent = 0;
+	if (copy_to_user((void*)pcb->context->rdi, &parent, sizeof(Pid)) != SUCCESS)
+	{
+		pcb->context->rax = BAD_ADDRESS;
+		return;
+	}
+
 	PCB* new_pcb = alloc_pcb();	
 	if (new_pcb == NULL)
 	{
@@ -60,7 +104,33 @@ void fork(PCB* pcb)
 		return;
 	}
 
+	// The kernel stack and the context on it belong to the new PCB
+	const Pid new_pid = new_pcb->pid;
+	const uint64_t new_kernel_stack = new_pcb->kernel_stack;
+	Context* new_context = new_pcb->context;
 	memcpy(new_pcb, pcb, sizeof(PCB));
+	new_pcb->pid = new_pid;
+	new_pcb->ppid = pcb->pid;
+	new_pcb->kernel_stack = new_kernel_stack;
+	new_pcb->context = new_context;
+	memclr(&new_pcb->usage, sizeof(Usage));
+	new_pcb->run_stamp = 0;
+	trace_wakeup(new_pcb);
+
+	// Only the calling thread is copied, the child starts single threaded
+	new_pcb->group = NULL;
+	new_pcb->joiner = NULL;
+	new_pcb->stack_slot = THREAD_MAIN_SLOT;
+	new_pcb->events = NULL;
+	if (channel_fork(pcb, new_pcb) != SUCCESS)
+	{
+		free_pcb(new_pcb);
+		pcb->context->rax = FAILURE;
+		return;
+	}
+#ifdef BIKESHED_X86_64
+	fpu_fork(pcb, new_pcb);
+#endif
 
 	kprintf("PCB RDI: 0x%x\n", pcb->context->rdi);
 	kprintf("Context Location: 0x%x\n", pcb->context);
@@ -69,46 +139,21 @@ void fork(PCB* pcb)
 	void* new_page_table = virt_clone_mapping(pcb->page_table);
 	new_pcb->page_table = new_page_table;
 
-	kprintf("Context Location 2: 0x%x\n", pcb->context);
-
-	uint64_t new_context_addr = 0;
-	if (!virt_lookup_phys(new_page_table, (uint64_t)pcb->context, &new_context_addr))
-	{
-		panic("Fork: failed to lookup context location, very bad!");
-	}
-
-	kprintf("new_context_addr: 0x%x\n", new_context_addr);
-	Context* new_context = (Context*)PHYS_TO_VIRT(new_context_addr);
-	// Not necessary, happens as part of the address space cloning
-	// Kept here as a reminder in case things change again
-	//memcpy(new_context, pcb->context, sizeof(Context));
-	kprintf("New Context: 0x%x\n", new_context);
-
-	new_pcb->context = pcb->context;
+	kprintf("new page table: 0x%x\n", new_page_table);
 
-	pcb->context->rax = SUCCESS;
-	*((Pid*)pcb->context->rdi) = 0;
+	// The child returns to user space with the same registers as the
+	// parent, the pid parameter is written by the child itself once its
+	// own address space is loaded
+	memcpy(new_context, pcb->context, sizeof(Context));
 	new_context->rax = SUCCESS;
+	kernel_stack_prepare(new_pcb, fork_child_start);
 
-	kprintf("New context RDI: 0x%x\n", new_context->rdi);
-
-	kprintf("new page table: %0x\n", new_page_table);
-
-	uint64_t pid_param_location = 0;
-	if (!virt_lookup_phys(new_page_table, (uint64_t)new_context->rdi, &pid_param_location))
-	{
-		panic("Fork: failed to lookup parameter location!");
-	}
-	kprintf("new page table: 0x%x\n", new_page_table);
-	kprintf("pid location:   0x%x\n", pid_param_location);
-
-	Pid* param_pid = (Pid*)PHYS_TO_VIRT(pid_param_location);
-	*param_pid = 1;
+	pcb->context->rax = SUCCESS;
 
 	kprintf("New CONTEXT\n");
 	DEBUG(dump_context(new_context));
 
-	// Schedule the new pcb, and call dispatch because the timer may not be running
+	// Schedule the new pcb, and let the scheduler decide who runs next
 	schedule(new_pcb);
 	kprintf("====DISPATCHING!====\n");
 	dispatch();
@@ -129,9 +174,10 @@ void exec(PCB* pcb)
 //============================================================================
 void exit(PCB* pcb)
 {
-	cleanup_pcb(pcb);
-
-	dispatch();
+	// The address space is freed later by the reaper, that way the
+	// next process doesn't have to wait for it. Any other threads go
+	// too, end_thread() is the one that only ends the caller.
+	thread_exit_group(pcb);
 }
 
 //============================================================================
@@ -142,10 +188,8 @@ void msleep(PCB* pcb)
 {
 	const time_t sleep_time = pcb->context->rdi;
 
-	// NOTE: When you return from this function, the address space may have
-	//       changed and the passed in pcb CANNOT be used unless something
-	//       like the fork() system call is done, where the physical address
-	//       is looked up.
+	// NOTE: This returns once the process is woken up again, its context
+	//       is in kernel memory so the pcb can still be used afterwards.
 	sleep_pcb(pcb, sleep_time);
 }
 
@@ -173,6 +217,411 @@ void get_key(PCB* pcb)
 	//kprintf("Get Key: 0x%x\n", pcb->context->rax);
 }
 
+//============================================================================
+// Get a key, blocking until one is pressed
+//
+//============================================================================
+void read_key(PCB* pcb)
+{
+	pcb->context->rax = keyboard_read_char();
+}
+
+//============================================================================
+// Get the resource usage of the calling process
+//
+//============================================================================
+void get_usage(PCB* pcb)
+{
+	Usage usage;
+	usage_get(pcb, &usage);
+
+	pcb->context->rax = copy_to_user((void*)pcb->context->rdi, &usage, sizeof(Usage));
+}
+
+//============================================================================
+// Get information about the next process after the given cursor. Used to
+// list all of the processes.
+//
+//============================================================================
+void proc_info(PCB* pcb)
+{
+	uint64_t* user_cursor = (uint64_t*)pcb->context->rdi;
+	ProcInfo* user_info = (ProcInfo*)pcb->context->rsi;
+
+	uint64_t cursor;
+	if (copy_from_user(&cursor, user_cursor, sizeof(cursor)) != SUCCESS)
+	{
+		pcb->context->rax = BAD_ADDRESS;
+		return;
+	}
+
+	const PCB* other = find_pcb(&cursor);
+	if (copy_to_user(user_cursor, &cursor, sizeof(cursor)) != SUCCESS)
+	{
+		pcb->context->rax = BAD_ADDRESS;
+		return;
+	}
+
+	if (other == NULL)
+	{
+		pcb->context->rax = FAILURE;
+		return;
+	}
+
+	ProcInfo info;
+	info.pid = other->pid;
+	info.ppid = other->ppid;
+	info.state = other->state;
+	info.priority = other->priority;
+	usage_get(other, &info.usage);
+
+	pcb->context->rax = copy_to_user(user_info, &info, sizeof(ProcInfo));
+}
+
+//============================================================================
+// Dump the scheduler trace to the serial port, optionally clearing it
+// afterwards.
+//
+//============================================================================
+void sched_trace(PCB* pcb)
+{
+	const uint64_t reset = pcb->context->rdi;
+
+	trace_dump();
+	if (reset)
+	{
+		trace_reset();
+	}
+
+	pcb->context->rax = SUCCESS;
+}
+
+//============================================================================
+// Start a new thread in the calling process
+//
+//============================================================================
+void new_thread(PCB* pcb)
+{
+	const uint64_t entry = pcb->context->rdi;
+	const uint64_t arg0 = pcb->context->rsi;
+	const uint64_t arg1 = pcb->context->rdx;
+	Pid* tid = (Pid*)pcb->context->rcx;
+
+#ifdef BIKESHED_X86_64
+	// Anything else faults as soon as the thread is switched to
+	if (entry >= USER_ADDRESS_END)
+	{
+		pcb->context->rax = BAD_PARAM;
+		return;
+	}
+#endif
+
+	PCB* thread = thread_create(pcb, entry, arg0, arg1);
+	if (thread == NULL)
+	{
+		pcb->context->rax = FAILURE;
+		return;
+	}
+
+	// The thread runs either way
+	pcb->context->rax = copy_to_user(tid, &thread->pid, sizeof(Pid));
+}
+
+//============================================================================
+// End the calling thread
+//
+//============================================================================
+void end_thread(PCB* pcb)
+{
+	thread_exit(pcb, pcb->context->rdi);
+}
+
+//============================================================================
+// Wait for another thread in the process to end
+//
+//============================================================================
+void join_thread(PCB* pcb)
+{
+	const Pid tid = pcb->context->rdi;
+	uint64_t* user_value = (uint64_t*)pcb->context->rsi;
+
+	// Might not return until the other thread exits
+	uint64_t value;
+	if (!thread_join(pcb, tid, &value))
+	{
+		pcb->context->rax = FAILURE;
+		return;
+	}
+
+	pcb->context->rax = copy_to_user(user_value, &value, sizeof(value));
+}
+
+//============================================================================
+// Set the calling thread's thread local storage pointer
+//
+//============================================================================
+void set_tls(PCB* pcb)
+{
+	const uint64_t base = pcb->context->rdi;
+
+#ifdef BIKESHED_X86_64
+	// Must be a canonical user address or loading it faults
+	if (base >= USER_ADDRESS_END)
+	{
+		pcb->context->rax = BAD_PARAM;
+		return;
+	}
+
+	fs_base_set(base);
+#endif
+	pcb->fs_base = base;
+	pcb->context->rax = SUCCESS;
+}
+
+//============================================================================
+// Wait on a futex word until another thread wakes it
+//
+//============================================================================
+void wait_futex(PCB* pcb)
+{
+	uint32_t* addr = (uint32_t*)pcb->context->rdi;
+	const uint32_t expected = pcb->context->rsi;
+	const time_t timeout = pcb->context->rdx;
+
+	// Might not return until futex_wake() or the timeout
+	pcb->context->rax = futex_wait(pcb, addr, expected, timeout);
+}
+
+//============================================================================
+// Wake the threads waiting on a futex word
+//
+//============================================================================
+void wake_futex(PCB* pcb)
+{
+	uint32_t* addr = (uint32_t*)pcb->context->rdi;
+	const uint64_t count = pcb->context->rsi;
+
+	pcb->context->rax = futex_wake(pcb, addr, count);
+}
+
+//============================================================================
+// Register interest in an event source
+//
+//============================================================================
+void add_event(PCB* pcb)
+{
+	const EventType type = (EventType)pcb->context->rdi;
+	const uint64_t arg = pcb->context->rsi;
+	const uint32_t flags = pcb->context->rdx;
+	const uint64_t user_data = pcb->context->rcx;
+	uint32_t* user_id = (uint32_t*)pcb->context->r8;
+
+	uint32_t id;
+	const Status status = events_add(pcb, type, arg, flags, user_data, &id);
+	if (status != SUCCESS)
+	{
+		pcb->context->rax = status;
+		return;
+	}
+
+	pcb->context->rax = copy_to_user(user_id, &id, sizeof(id));
+}
+
+//============================================================================
+// Stop waiting for an event source
+//
+//============================================================================
+void remove_event(PCB* pcb)
+{
+	pcb->context->rax = events_remove(pcb, pcb->context->rdi);
+}
+
+//============================================================================
+// Block until some of the registered events are ready
+//
+//============================================================================
+void wait_events(PCB* pcb)
+{
+	EventResult* user_out = (EventResult*)pcb->context->rdi;
+	uint32_t max = pcb->context->rsi;
+	const time_t timeout = pcb->context->rdx;
+
+	// There can't be more ready than are registered
+	EventResult out[EVENTS_PER_SET];
+	if (max > EVENTS_PER_SET)
+	{
+		max = EVENTS_PER_SET;
+	}
+
+	// Might not return until an event is ready. If they can't be handed
+	// back they're left pending for the next call.
+	const uint32_t found = events_wait(pcb, out, max, timeout);
+	if (copy_to_user(user_out, out, found*sizeof(EventResult)) != SUCCESS)
+	{
+		pcb->context->rax = BAD_ADDRESS;
+		return;
+	}
+
+	events_delivered(pcb);
+	pcb->context->rax = found;
+}
+
+//============================================================================
+// Arm or disarm a timer made with event_add()
+//
+//============================================================================
+void timer_settime(PCB* pcb)
+{
+	const uint32_t id = pcb->context->rdi;
+	const uint32_t flags = pcb->context->rsi;
+	const uint64_t value = pcb->context->rdx;
+	const uint64_t interval = pcb->context->rcx;
+
+	pcb->context->rax = events_timer_set(pcb, id, flags, value, interval);
+}
+
+//============================================================================
+// How many expirations a timer missed before the last one reported
+//
+//============================================================================
+void timer_getoverrun(PCB* pcb)
+{
+	uint32_t* user_overrun = (uint32_t*)pcb->context->rsi;
+
+	uint32_t overrun;
+	const Status status = events_timer_overrun(pcb, pcb->context->rdi, &overrun);
+	if (status != SUCCESS)
+	{
+		pcb->context->rax = status;
+		return;
+	}
+
+	pcb->context->rax = copy_to_user(user_overrun, &overrun, sizeof(overrun));
+}
+
+//============================================================================
+// Nanoseconds since boot, never goes backwards
+//
+//============================================================================
+void clock_gettime(PCB* pcb)
+{
+	pcb->context->rax = timer_get_ns();
+}
+
+//============================================================================
+// Sleep until a time on the clock_gettime() clock, or for so long
+//
+//============================================================================
+void clock_nanosleep(PCB* pcb)
+{
+	const uint32_t flags = pcb->context->rdi;
+	const uint64_t value = pcb->context->rsi;
+
+	const uint64_t deadline = (flags & TIMER_ABSTIME) ? value : timer_get_ns() + value;
+	sleep_until_ns(pcb, deadline);
+
+	pcb->context->rax = SUCCESS;
+}
+
+//============================================================================
+// Run the requests waiting in a submission ring
+//
+//============================================================================
+void enter_ring(PCB* pcb)
+{
+	Ring* ring = (Ring*)pcb->context->rdi;
+	const uint32_t to_submit = pcb->context->rsi;
+
+	// Might not return until a RING_SLEEP is over
+	pcb->context->rax = ring_enter(pcb, ring, to_submit);
+}
+
+//============================================================================
+// Make a message channel, both of its ends are handed back
+//
+//============================================================================
+void make_channel(PCB* pcb)
+{
+	uint32_t* user_ends = (uint32_t*)pcb->context->rdi;
+
+	uint32_t ends[2];
+	const Status status = channel_create(pcb, ends);
+	if (status != SUCCESS)
+	{
+		pcb->context->rax = status;
+		return;
+	}
+
+	if (copy_to_user(user_ends, ends, sizeof(ends)) != SUCCESS)
+	{
+		// Nobody would ever be able to close it
+		channel_close(pcb, ends[0]);
+		channel_close(pcb, ends[1]);
+		pcb->context->rax = BAD_ADDRESS;
+		return;
+	}
+
+	pcb->context->rax = SUCCESS;
+}
+
+//============================================================================
+// Send a message on a channel
+//
+//============================================================================
+void send_message(PCB* pcb)
+{
+	const uint32_t handle = pcb->context->rdi;
+	const IpcMessage* user_msg = (const IpcMessage*)pcb->context->rsi;
+
+	IpcMessage msg;
+	if (copy_from_user(&msg, user_msg, sizeof(msg)) != SUCCESS)
+	{
+		pcb->context->rax = BAD_ADDRESS;
+		return;
+	}
+
+	// Might not return until there's room for it
+	pcb->context->rax = channel_send(pcb, handle, &msg);
+}
+
+//============================================================================
+// Receive a message from a channel
+//
+//============================================================================
+void receive_message(PCB* pcb)
+{
+	const uint32_t handle = pcb->context->rdi;
+	IpcMessage* user_msg = (IpcMessage*)pcb->context->rsi;
+
+	IpcMessage msg;
+	if (copy_from_user(&msg, user_msg, sizeof(msg)) != SUCCESS)
+	{
+		pcb->context->rax = BAD_ADDRESS;
+		return;
+	}
+
+	// Might not return until something is sent
+	const Status status = channel_recv(pcb, handle, &msg);
+	if (status != SUCCESS && status != TRUNCATED)
+	{
+		pcb->context->rax = status;
+		return;
+	}
+
+	// The sizes say how much of it was kept
+	const Status copied = copy_to_user(user_msg, &msg, sizeof(msg));
+	pcb->context->rax = copied != SUCCESS ? copied : status;
+}
+
+//============================================================================
+// Close one end of a channel
+//
+//============================================================================
+void close_channel(PCB* pcb)
+{
+	pcb->context->rax = channel_close(pcb, pcb->context->rdi);
+}
+
 void syscalls_init()
 {
 	syscall_functions[SYSCALL_FORK] = fork;
@@ -182,15 +631,50 @@ void syscalls_init()
 	syscall_functions[SYSCALL_SET_PRIO] = set_priority;
 	syscall_functions[SYSCALL_KEY_AVAIL] = key_avail;
 	syscall_functions[SYSCALL_GET_KEY] = get_key;
+	syscall_functions[SYSCALL_GET_USAGE] = get_usage;
+	syscall_functions[SYSCALL_PROC_INFO] = proc_info;
+	syscall_functions[SYSCALL_SCHED_TRACE] = sched_trace;
+	syscall_functions[SYSCALL_THREAD_CREATE] = new_thread;
+	syscall_functions[SYSCALL_THREAD_EXIT] = end_thread;
+	syscall_functions[SYSCALL_THREAD_JOIN] = join_thread;
+	syscall_functions[SYSCALL_SET_TLS] = set_tls;
+	syscall_functions[SYSCALL_FUTEX_WAIT] = wait_futex;
+	syscall_functions[SYSCALL_FUTEX_WAKE] = wake_futex;
+	syscall_functions[SYSCALL_READ_KEY] = read_key;
+	syscall_functions[SYSCALL_EVENT_ADD] = add_event;
+	syscall_functions[SYSCALL_EVENT_REMOVE] = remove_event;
+	syscall_functions[SYSCALL_WAIT_EVENTS] = wait_events;
+	syscall_functions[SYSCALL_TIMER_SETTIME] = timer_settime;
+	syscall_functions[SYSCALL_TIMER_GETOVERRUN] = timer_getoverrun;
+	syscall_functions[SYSCALL_CLOCK_GETTIME] = clock_gettime;
+	syscall_functions[SYSCALL_CLOCK_NANOSLEEP] = clock_nanosleep;
+	syscall_functions[SYSCALL_RING_ENTER] = enter_ring;
+	syscall_functions[SYSCALL_CHANNEL_CREATE] = make_channel;
+	syscall_functions[SYSCALL_CHANNEL_SEND] = send_message;
+	syscall_functions[SYSCALL_CHANNEL_RECV] = receive_message;
+	syscall_functions[SYSCALL_CHANNEL_CLOSE] = close_channel;
+
+	futex_init();
+	events_init();
+	channel_init();
 
 	interrupts_install_isr(SYSCALL_INT_VEC, syscall_interrupt);
 }
 
 void syscall_interrupt(uint64_t vector, uint64_t error)
 {
+	UNUSED(vector);
 	UNUSED(error);
-	// Stop the current processes quantum
-	timer_stop();
+
+	// Software interrupts aren't acknowledged, this is the same as
+	// coming in through the SYSCALL instruction
+	syscall_handle();
+}
+
+void syscall_handle()
+{
+	// The current process's quantum keeps running while it is in the
+	// kernel, dispatch() charges the time spent here to it
 
 	kprintf("Context Location: 0x%x\n", current_pcb->context);
 
@@ -202,6 +686,8 @@ void syscall_interrupt(uint64_t vector, uint64_t error)
 		panic("SYSCALL: Current PCB is NULL!");
 	}
 
+	++current_pcb->usage.syscalls;
+
 	// Check the syscall number and dispatch on it
 	uint64_t syscall_num = current_pcb->context->r10;
 	kprintf("=========GOT SYSCALL: %u=========\n", syscall_num);
@@ -210,20 +696,15 @@ void syscall_interrupt(uint64_t vector, uint64_t error)
 	if (syscall_num >= NUM_SYSCALLS)
 	{
 		kprintf("BAD SYSCALL\n");
-		syscall_functions[SYSCALL_EXIT](current_pcb);
-	}
-	else
-	{
-		syscall_functions[syscall_num](current_pcb);
+		syscall_num = SYSCALL_EXIT;
 	}
 
+	void (*const fn)(PCB*) = syscall_functions[syscall_num];
+	fn(current_pcb);
+
 	kprintf("=========Returned from syscall=========\n");
 #else
 #error "System calls are not implemented for this architecture"
 #endif
-
-#ifdef BIKESHED_X86_64
-	pic_acknowledge(vector);
-#endif
 }
 
@@ -1,7 +1,7 @@
 #ifndef __KERNEL_SYSCALLS_H__
 #define __KERNEL_SYSCALLS_H__
 
-#define NUM_SYSCALLS      7
+#define NUM_SYSCALLS      29
 #define SYSCALL_FORK      0
 #define SYSCALL_EXEC      1
 #define SYSCALL_EXIT      2
@@ -9,6 +9,28 @@
 #define SYSCALL_SET_PRIO  4
 #define SYSCALL_KEY_AVAIL 5
 #define SYSCALL_GET_KEY   6
+#define SYSCALL_GET_USAGE 7
+#define SYSCALL_PROC_INFO 8
+#define SYSCALL_SCHED_TRACE 9
+#define SYSCALL_THREAD_CREATE 10
+#define SYSCALL_THREAD_EXIT 11
+#define SYSCALL_THREAD_JOIN 12
+#define SYSCALL_SET_TLS   13
+#define SYSCALL_FUTEX_WAIT 14
+#define SYSCALL_FUTEX_WAKE 15
+#define SYSCALL_READ_KEY  16
+#define SYSCALL_EVENT_ADD 17
+#define SYSCALL_EVENT_REMOVE 18
+#define SYSCALL_WAIT_EVENTS 19
+#define SYSCALL_TIMER_SETTIME 20
+#define SYSCALL_TIMER_GETOVERRUN 21
+#define SYSCALL_CLOCK_GETTIME 22
+#define SYSCALL_CLOCK_NANOSLEEP 23
+#define SYSCALL_RING_ENTER 24
+#define SYSCALL_CHANNEL_CREATE 25
+#define SYSCALL_CHANNEL_SEND 26
+#define SYSCALL_CHANNEL_RECV 27
+#define SYSCALL_CHANNEL_CLOSE 28
 
 #ifdef BIKESHED_X86_64
 #define SYSCALL_INT_VEC 0x80
@@ -16,6 +38,13 @@
 #error "Syscalls not implemented for this architecture"
 #endif
 
+#ifndef __ASSEMBLER__
 void syscalls_init(void);
 
+/* Run the system call in current_pcb's Context. Called by both the
+ * SYSCALL entry and the int $SYSCALL_INT_VEC handler.
+ */
+void syscall_handle(void);
+#endif
+
 #endif
@@ -9,6 +9,128 @@ typedef enum
 	FAILURE,
 	BAD_PARAM,
 	FEATURE_UNIMPLEMENTED,
+	WOULD_BLOCK, // The futex word changed before the caller could wait
+	TIMED_OUT,
+	BAD_ADDRESS, // A pointer that isn't mapped in the caller's address space
+	TRUNCATED,   // Only part of it fit, the rest was thrown away
 } Status;
 
+/* Information about a single process, filled in by the
+ * proc_info system call.
+ */
+typedef struct
+{
+	Pid pid;
+	Pid ppid;
+	State state;
+	Priority priority;
+	Usage usage;
+} ProcInfo;
+
+/* What wait_events() can wait for.
+ */
+typedef enum
+{
+	EVENT_KEYBOARD = 0, // A key was pressed
+	EVENT_TIMER,        // arg milliseconds went by
+	EVENT_CHILD_EXIT,   // A child process exited
+	EVENT_CHANNEL,      // The channel end arg has something to receive, or its peer closed
+	NUM_EVENT_TYPES
+} EventType;
+
+// Only report the keyboard when a key is pressed, or a channel when a
+// message comes, instead of as long as there is something to read
+#define EVENT_EDGE 0x1
+// Timers go off every arg milliseconds instead of once
+#define EVENT_PERIODIC 0x2
+
+// timer_settime() and clock_nanosleep() times are on the timer_get_ns()
+// clock instead of from now
+#define TIMER_ABSTIME 0x1
+
+// wait_events() timeout that never runs out
+#define EVENT_WAIT_FOREVER 0xFFFFFFFF
+
+/* One ready event, filled in by wait_events().
+ */
+typedef struct
+{
+	uint64_t user_data; // Whatever was given to event_add()
+	EventType type;
+	uint32_t count;     // Keys, timer expirations, exits or messages since last time
+} EventResult;
+
+// Bytes copied with each channel message, anything bigger goes as pages
+#define IPC_INLINE_SIZE 64
+// Pages moved with each channel message
+#define IPC_MAX_PAGES 8
+
+/* A channel message, see channel_send() and channel_recv().
+ *
+ * Sending, data and size are the bytes to copy, and page_count pages
+ * starting at pages are unmapped from the sender and handed over.
+ *
+ * Receiving, data and size are the buffer, and page_count pages
+ * starting at pages are where the pages go, they must not be mapped.
+ * Both counts are changed to what was received.
+ */
+typedef struct
+{
+	void* data;
+	uint64_t size;
+	void* pages;         // Page aligned
+	uint64_t page_count;
+} IpcMessage;
+
+/* What a submission ring entry can ask for, see ring_enter().
+ */
+typedef enum
+{
+	RING_NOP = 0,    // Does nothing
+	RING_WRITE,      // args[0] bytes at args[1] to the serial console
+	RING_SLEEP,      // For args[0] nanoseconds, until then with TIMER_ABSTIME
+	RING_FUTEX_WAKE, // Up to args[1] waiters on the word at args[0]
+	RING_CHANNEL_SEND, // The IpcMessage at args[1] on channel end args[0]
+	RING_CHANNEL_RECV, // Into the IpcMessage at args[1] from channel end args[0]
+	NUM_RING_OPS
+} RingOp;
+
+// Both must be powers of two
+#define RING_SQ_ENTRIES 64
+#define RING_CQ_ENTRIES 64
+
+/* One request, filled in by the process.
+ */
+typedef struct
+{
+	uint64_t user_data; // Handed back in its completion
+	RingOp op;
+	uint32_t flags;     // TIMER_ABSTIME for RING_SLEEP
+	uint64_t args[3];
+} RingSubmission;
+
+/* One finished request, filled in by the kernel.
+ */
+typedef struct
+{
+	uint64_t user_data;
+	uint64_t result;    // What the matching system call would return
+} RingCompletion;
+
+/* Submission and completion rings in the process's own memory. The
+ * indices only ever go up, an entry's slot is its index modulo the
+ * ring's size.
+ */
+typedef struct
+{
+	volatile uint32_t sq_head; // Next submission the kernel takes
+	volatile uint32_t sq_tail; // Moved by the process once the entry is written
+	volatile uint32_t cq_head; // Moved by the process once it has read the entry
+	volatile uint32_t cq_tail; // Next completion the kernel writes
+	volatile uint32_t dropped; // Completions lost to a full completion ring
+	uint32_t reserved;
+	RingSubmission sq[RING_SQ_ENTRIES];
+	RingCompletion cq[RING_CQ_ENTRIES];
+} Ring;
+
 #endif
@@ -0,0 +1,30 @@
+#ifndef __KERNEL_SYSCALLS_UACCESS_H__
+#define __KERNEL_SYSCALLS_UACCESS_H__
+
+#include "inttypes.h"
+#include "types.h"
+
+/* Moving data between the kernel and the calling process. The user
+ * pointer is checked against the user half of the address space, and
+ * if it isn't mapped the fault is caught instead of taking the kernel
+ * down. The process's page table must be the one that is loaded.
+ *
+ * Defined in the architecture specific files.
+ */
+
+/* Returns:
+ *    SUCCESS, or BAD_ADDRESS if any of it isn't valid user memory, in
+ *    which case some of it may have been copied anyway
+ */
+Status copy_from_user(void* dst, const void* user_src, uint64_t size);
+Status copy_to_user(void* user_dst, const void* src, uint64_t size);
+
+/* Copy a string from user memory, including its terminator.
+ *
+ * Returns:
+ *    Its length, size if it didn't fit (and dst isn't terminated), or
+ *    -1 if it isn't valid user memory
+ */
+int64_t strncpy_from_user(char* dst, const char* user_src, uint64_t size);
+
+#endif
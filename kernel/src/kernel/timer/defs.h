@@ -19,4 +19,18 @@ void timer_start(void);
 
 void timer_stop(void);
 
+/* Get a free running cycle count. Only useful for measuring
+ * how long something took, the rate is not calibrated.
+ */
+uint64_t timer_get_cycles(void);
+
+#define NS_PER_SEC 1000000000UL
+#define NS_PER_MS  1000000UL
+
+/* Monotonic nanoseconds since the timer was calibrated at boot. The
+ * same on every processor, as long as their time stamp counters are
+ * in sync.
+ */
+uint64_t timer_get_ns(void);
+
 #endif
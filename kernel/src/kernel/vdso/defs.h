@@ -0,0 +1,50 @@
+#ifndef __KERNEL_VDSO_DEFS_H__
+#define __KERNEL_VDSO_DEFS_H__
+
+#include "inttypes.h"
+#include "kernel/smp/defs.h"
+#include "kernel/lock/seqlock.h"
+
+/* A page of kernel data every process can read, but not write, so the
+ * most common questions don't need a system call. Shared with the
+ * user programs, ulib does the reading.
+ */
+
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/interrupts/defines.h"
+
+// Just below the VGA memory, in the kernel half so it is shared by
+// every page table without being copied by fork()
+#define VDSO_ADDRESS 0xFFFFFFFFFFBFE000
+
+// Which processor this is can be read in user mode with lsl on this
+// selector, its limit is the processor's id
+#define VDSO_CPU_SELECTOR (CPU_NUMBER_SEG_64 | 3)
+#endif
+
+typedef struct
+{
+	SeqCount seq;   // Changes every time a process is switched to
+	uint32_t pid;   // Whoever is running on the processor
+} VdsoCpu;
+
+typedef struct
+{
+	// Protects the clock and the keyboard snapshot
+	SeqCount seq;
+
+	// timer_get_ns() is ((rdtsc - tsc_base) * ns_mult) >> ns_shift,
+	// ns_mult is 0 until the clock has been calibrated
+	uint32_t ns_shift;
+	uint64_t tsc_base;
+	uint64_t ns_mult;
+
+	// Characters ever put in and taken out of the keyboard buffer,
+	// there's one to read while they're different
+	uint32_t keys_in;
+	uint32_t keys_out;
+
+	VdsoCpu cpus[MAX_CPUS];
+} VdsoData;
+
+#endif
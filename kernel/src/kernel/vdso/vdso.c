@@ -0,0 +1,61 @@
+#include "vdso.h"
+
+#include "safety.h"
+#include "kernel/klib.h"
+#include "kernel/virt_memory/defs.h"
+
+#ifdef BIKESHED_X86_64
+#include "arch/x86_64/panic.h"
+#include "arch/x86_64/virt_memory/physical.h"
+#include "arch/x86_64/virt_memory/phys_alloc.h"
+#endif
+
+COMPILE_ASSERT(sizeof(VdsoData) <= PAGE_SMALL_SIZE);
+
+// Written through the kernel's own mapping, user mode only sees the
+// read only one at VDSO_ADDRESS
+static VdsoData* vdso = NULL;
+
+void vdso_init()
+{
+	void* page = phys_alloc_4KIB_safe("vdso_init: No memory");
+	vdso = (VdsoData*)PHYS_TO_VIRT(page);
+	memclr(vdso, PAGE_SMALL_SIZE);
+
+	seq_init(&vdso->seq);
+	for (uint32_t i = 0; i < MAX_CPUS; ++i)
+	{
+		seq_init(&vdso->cpus[i].seq);
+	}
+
+	if (!virt_map_phys(kernel_table, VDSO_ADDRESS, (uint64_t)page,
+			PG_FLAG_USER, PAGE_SMALL))
+	{
+		panic("vdso_init: Failed to map the page");
+	}
+}
+
+void vdso_set_clock(uint64_t tsc_base, uint64_t ns_mult, uint32_t ns_shift)
+{
+	seq_write_begin(&vdso->seq);
+	vdso->tsc_base = tsc_base;
+	vdso->ns_mult = ns_mult;
+	vdso->ns_shift = ns_shift;
+	seq_write_end(&vdso->seq);
+}
+
+void vdso_set_keys(uint32_t keys_in, uint32_t keys_out)
+{
+	seq_write_begin(&vdso->seq);
+	vdso->keys_in = keys_in;
+	vdso->keys_out = keys_out;
+	seq_write_end(&vdso->seq);
+}
+
+void vdso_switch(uint32_t cpu, uint32_t pid)
+{
+	VdsoCpu* slot = &vdso->cpus[cpu];
+	seq_write_begin(&slot->seq);
+	slot->pid = pid;
+	seq_write_end(&slot->seq);
+}
@@ -0,0 +1,29 @@
+#ifndef __KERNEL_VDSO_VDSO_H__
+#define __KERNEL_VDSO_VDSO_H__
+
+#include "defs.h"
+
+/* Publishing the data in the VdsoData page. Everything here must be
+ * called with interrupts disabled.
+ */
+
+/* Allocate the page and map it read only for user mode. Must be
+ * called after the physical allocator is setup, and before the first
+ * process is created so its page table gets the mapping.
+ */
+void vdso_init(void);
+
+/* The clock's calibration, see timer_get_ns().
+ */
+void vdso_set_clock(uint64_t tsc_base, uint64_t ns_mult, uint32_t ns_shift);
+
+/* How many characters have been put in and taken out of the keyboard
+ * buffer.
+ */
+void vdso_set_keys(uint32_t keys_in, uint32_t keys_out);
+
+/* A processor is switching to a process.
+ */
+void vdso_switch(uint32_t cpu, uint32_t pid);
+
+#endif
@@ -23,10 +23,14 @@ extern uint8_t virt_lookup_phys(void* table, uint64_t virt_addr, uint64_t* out_p
 
 extern void virt_unmap_page(void* table, uint64_t virt_addr);
 
+extern uint8_t virt_detach_page(void* table, uint64_t virt_addr, uint64_t* out_phys);
+
 extern void virt_reset_table(void* table);
 
 extern void virt_cleanup_table(void* table);
 
 extern void* virt_clone_mapping(void* table);
 
+extern uint64_t virt_count_pages(void* table);
+
 #endif
@@ -112,21 +112,211 @@ static void read_command()
 	write_string("\n");
 }
 
-static void check_command()
+static void write_number(uint64_t value, uint32_t width)
 {
-	if (streq("help", command))
+	char buf[21];
+	const uint32_t length = utoa(value, buf);
+	for (uint32_t i = length; i < width; ++i)
+	{
+		write_char(' ');
+	}
+
+	write_string(buf);
+}
+
+#define MAX_PROCS 64
+#define TOP_INTERVAL 500
+static const char* state_names[] = { "READY", "RUN", "SLEEP", "DEAD", "BLOCK", "ZOMB" };
+static ProcInfo procs_before[MAX_PROCS];
+static ProcInfo procs_after[MAX_PROCS];
+
+static uint32_t snapshot_procs(ProcInfo* procs)
+{
+	uint64_t cursor = 0;
+	uint32_t count = 0;
+	while (count < MAX_PROCS && proc_info(&cursor, &procs[count]) == SUCCESS)
+	{
+		++count;
+	}
+
+	return count;
+}
+
+static uint64_t proc_cycles(const ProcInfo* info)
+{
+	return info->usage.user_cycles + info->usage.kernel_cycles;
+}
+
+static void top()
+{
+	// Sample everyone twice so the CPU usage is for the last interval
+	// instead of since each process started
+	const uint32_t count_before = snapshot_procs(procs_before);
+	msleep(TOP_INTERVAL);
+	const uint32_t count = snapshot_procs(procs_after);
+
+	uint64_t used[MAX_PROCS];
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		used[i] = proc_cycles(&procs_after[i]);
+		for (uint32_t j = 0; j < count_before; ++j)
+		{
+			if (procs_before[j].pid == procs_after[i].pid)
+			{
+				used[i] -= proc_cycles(&procs_before[j]);
+				break;
+			}
+		}
+
+		total += used[i];
+	}
+
+	write_string("  PID PPID PRI STATE %CPU USER(Kc)  SYS(Kc)   VOL INVOL SYSCALLS PAGES\n");
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const ProcInfo* info = &procs_after[i];
+		write_number(info->pid, 5);
+		write_number(info->ppid, 5);
+		write_number(info->priority, 4);
+		write_string(" ");
+		write_string(state_names[info->state]);
+		for (uint32_t pad = strlen(state_names[info->state]); pad < 5; ++pad)
+		{
+			write_char(' ');
+		}
+		write_number(total == 0 ? 0 : used[i]*100 / total, 5);
+		write_number(info->usage.user_cycles / 1000, 9);
+		write_number(info->usage.kernel_cycles / 1000, 9);
+		write_number(info->usage.voluntary_switches, 6);
+		write_number(info->usage.involuntary_switches, 6);
+		write_number(info->usage.syscalls, 9);
+		write_number(info->usage.resident_pages, 6);
+		write_string("\n");
+	}
+}
+
+static void check_command(const char* cmd);
+
+static void time_command(const char* cmd)
+{
+	Usage before, after;
+	get_usage(&before);
+	const uint64_t start = read_cycles();
+
+	check_command(cmd);
+
+	const uint64_t real = read_cycles() - start;
+	get_usage(&after);
+
+	write_string("real   ");
+	write_number(real / 1000, 12);
+	write_string(" Kcycles\nuser   ");
+	write_number((after.user_cycles - before.user_cycles) / 1000, 12);
+	write_string(" Kcycles\nsys    ");
+	write_number((after.kernel_cycles - before.kernel_cycles) / 1000, 12);
+	write_string(" Kcycles\nwait   ");
+	write_number((after.wait_cycles - before.wait_cycles) / 1000, 12);
+	write_string(" Kcycles\nsleep  ");
+	write_number((after.sleep_cycles - before.sleep_cycles) / 1000, 12);
+	write_string(" Kcycles\nswitches ");
+	write_number(after.voluntary_switches - before.voluntary_switches, 0);
+	write_string(" voluntary, ");
+	write_number(after.involuntary_switches - before.involuntary_switches, 0);
+	write_string(" involuntary\nsyscalls ");
+	write_number(after.syscalls - before.syscalls, 0);
+	write_string("\n");
+}
+
+#define NUM_WORKERS 4
+#define WORK_PER_THREAD 2000000
+
+static uint64_t sum_range(void* arg)
+{
+	const uint64_t start = (uint64_t)arg * WORK_PER_THREAD;
+
+	uint64_t sum = 0;
+	for (uint64_t i = start; i < start + WORK_PER_THREAD; ++i)
+	{
+		sum += i;
+	}
+
+	return sum;
+}
+
+// Splits a sum across a few threads and adds up what they return
+static void threads_command()
+{
+	Pid tids[NUM_WORKERS];
+	uint32_t started = 0;
+	for (; started < NUM_WORKERS; ++started)
+	{
+		if (thread_create(sum_range, (void*)(uint64_t)started, &tids[started]) != SUCCESS)
+		{
+			write_string("Failed to start a thread\n");
+			break;
+		}
+	}
+
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < started; ++i)
+	{
+		uint64_t value = 0;
+		if (thread_join(tids[i], &value) != SUCCESS)
+		{
+			write_string("Failed to join a thread\n");
+			continue;
+		}
+
+		write_string("thread ");
+		write_number(tids[i], 0);
+		write_string(" returned ");
+		write_number(value, 0);
+		write_string("\n");
+		total += value;
+	}
+
+	write_string("total ");
+	write_number(total, 0);
+	write_string("\n");
+}
+
+static void check_command(const char* cmd)
+{
+	if (streq("help", cmd))
 	{
 		write_string("Commands:\n");
 		write_string(" help - Display this text\n");
 		write_string(" tetris - Play tetris\n");
+		write_string(" top - Show what every process is using\n");
+		write_string(" time <cmd> - Run a command and show how long it took\n");
+		write_string(" trace [reset] - Dump scheduler latencies to serial\n");
+		write_string(" threads - Add up some numbers using a few threads\n");
 	}
-	else if (streq("tetris", command))
+	else if (streq("tetris", cmd))
 	{
 		tetris();
 		clear_screen();
 		text_set_pos(0, 0);
 		text_mode_info.color = text_color;
 	}
+	else if (streq("top", cmd))
+	{
+		top();
+	}
+	else if (streq("trace", cmd) || streq("trace reset", cmd))
+	{
+		sched_trace(cmd[5] != '\0');
+		write_string("Scheduler trace written to serial\n");
+	}
+	else if (streq("threads", cmd))
+	{
+		threads_command();
+	}
+	else if (strstarts(cmd, "time "))
+	{
+		time_command(cmd + 5);
+	}
 	else
 	{
 		write_string("Unrecognized command\n");
@@ -143,6 +333,6 @@ void shell_loop()
 	while (1)
 	{
 		read_command();
-		check_command();
+		check_command(command);
 	}
 }
@@ -30,3 +30,39 @@ uint8_t streq(const char* str1, const char* str2)
 	return *str1 == 0 && *str2 == 0;
 }
 
+
+uint8_t strstarts(const char* str, const char* prefix)
+{
+	while (*prefix != 0)
+	{
+		if (*str != *prefix)
+		{
+			return 0;
+		}
+
+		++str;
+		++prefix;
+	}
+
+	return 1;
+}
+
+uint32_t utoa(uint64_t value, char* buf)
+{
+	char tmp[20];
+	uint32_t length = 0;
+	do
+	{
+		tmp[length] = '0' + (value % 10);
+		value /= 10;
+		++length;
+	} while (value > 0);
+
+	for (uint32_t i = 0; i < length; ++i)
+	{
+		buf[i] = tmp[length - i - 1];
+	}
+	buf[length] = 0;
+
+	return length;
+}
@@ -7,4 +7,11 @@ uint64_t strlen(const char* str);
 
 uint8_t streq(const char* str1, const char* str2);
 
+// Returns 1 if str starts with prefix
+uint8_t strstarts(const char* str, const char* prefix);
+
+// Converts value to a NULL terminated decimal string, buf must hold
+// at least 21 characters. Returns the length of the string.
+uint32_t utoa(uint64_t value, char* buf);
+
 #endif
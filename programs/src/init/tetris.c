@@ -574,7 +574,9 @@ static void draw_next_piece()
 			   piece_colors[next_piece]); // Color
 }
 
-static void update()
+// Keys are handled as soon as they're pressed, but the game only moves
+// on when tick is set
+static void update(uint8_t tick)
 {
 	update_keys();
 	if (quit_pressed)
@@ -638,7 +640,11 @@ static void update()
 					state = LINE_CHECK;
 				}
 
-				++ticks;
+				if (tick)
+				{
+					++ticks;
+				}
+
 				if (ticks >= ticks_per_drop)
 				{
 					ticks = 0;
@@ -676,7 +682,11 @@ static void update()
 			break;
 		case LINE_CHECK_FLASH:
 			{
-				++flash_ticks;
+				if (tick)
+				{
+					++flash_ticks;
+				}
+
 				if (flash_ticks > TICKS_PER_FLASH)
 				{
 					// Toggle
@@ -736,11 +746,35 @@ void tetris()
 		}
 	}
 
+	// The timer keeps the ticks evenly spaced however long an update
+	// takes, and key presses wake us up straight away
+	uint32_t timer_id;
+	uint32_t keys_id;
+	event_add(EVENT_TIMER, TICK_DURATION, EVENT_PERIODIC, 0, &timer_id);
+	event_add(EVENT_KEYBOARD, 0, EVENT_EDGE, 0, &keys_id);
+
 	// Enter game loop
+	EventResult events[2];
 	while (!quit)
 	{
-		update();
-
-		msleep(TICK_DURATION);
+		const uint32_t ready = wait_events(events, 2, EVENT_WAIT_FOREVER);
+		for (uint32_t i = 0; i < ready && !quit; ++i)
+		{
+			if (events[i].type == EVENT_TIMER)
+			{
+				// Catch up on any ticks that were missed
+				for (uint32_t t = 0; t < events[i].count && !quit; ++t)
+				{
+					update(1);
+				}
+			}
+			else
+			{
+				update(0);
+			}
+		}
 	}
+
+	event_remove(timer_id);
+	event_remove(keys_id);
 }
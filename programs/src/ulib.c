@@ -1,69 +1,418 @@
 #include "ulib.h"
 
 #include "safety.h"
+#include "kernel/atomic/defs.h"
 #include "kernel/syscalls/syscalls.h"
+#include "kernel/vdso/defs.h"
 
-Status fork(Pid* pid)
+// Read only, the kernel keeps it up to date
+static const volatile VdsoData* const vdso = (const volatile VdsoData*)VDSO_ADDRESS;
+
+/* Every system call goes through here. SYSCALL takes the number in rax
+ * and the arguments in rdi, rsi, rdx, r10 and r8, the result comes
+ * back in rax. It clobbers rcx and r11, and the kernel leaves the number
+ * in r10. int $SYSCALL_INT_VEC still works, it's just slower.
+ */
+static inline __attribute__((always_inline))
+uint64_t syscall5(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3,
+		uint64_t a4, uint64_t a5)
 {
-	// It's not really unused, the kernel modifies it
-	UNUSED(pid);
+	register uint64_t r10 __asm__("r10") = a4;
+	register uint64_t r8 __asm__("r8") = a5;
+	uint64_t retVal;
 
-	register Status retVal __asm__("rax");
-	
-	__asm__ volatile ("movq $" SX(SYSCALL_FORK) ", %r10");
-	__asm__ volatile ("int $" SX(SYSCALL_INT_VEC) ::: "%rax");
+	__asm__ volatile ("syscall"
+					  : "=a"(retVal), "+r"(r10), "+r"(r8)
+					  : "a"(num), "D"(a1), "S"(a2), "d"(a3)
+					  : "rcx", "r11", "memory");
 
 	return retVal;
 }
 
-void msleep(time_t ms)
+#define SYSCALL0(N) syscall5(N, 0, 0, 0, 0, 0)
+#define SYSCALL1(N, A) syscall5(N, (uint64_t)(A), 0, 0, 0, 0)
+#define SYSCALL2(N, A, B) syscall5(N, (uint64_t)(A), (uint64_t)(B), 0, 0, 0)
+#define SYSCALL3(N, A, B, C) \
+	syscall5(N, (uint64_t)(A), (uint64_t)(B), (uint64_t)(C), 0, 0)
+#define SYSCALL4(N, A, B, C, D) \
+	syscall5(N, (uint64_t)(A), (uint64_t)(B), (uint64_t)(C), (uint64_t)(D), 0)
+#define SYSCALL5(N, A, B, C, D, E) \
+	syscall5(N, (uint64_t)(A), (uint64_t)(B), (uint64_t)(C), (uint64_t)(D), (uint64_t)(E))
+
+Status fork(Pid* pid)
 {
-	UNUSED(ms);
+	// The kernel fills in pid
+	return SYSCALL1(SYSCALL_FORK, pid);
+}
 
-	__asm__ volatile ("movq $" SX(SYSCALL_MSLEEP) ", %r10");
-	__asm__ volatile ("int $" SX(SYSCALL_INT_VEC));
+void msleep(time_t ms)
+{
+	SYSCALL1(SYSCALL_MSLEEP, ms);
 }
 
 void exit()
 {
-	__asm__ volatile ("movq $" SX(SYSCALL_EXIT) ", %r10");
-	__asm__ volatile ("int $" SX(SYSCALL_INT_VEC));
+	SYSCALL0(SYSCALL_EXIT);
 }
 
 void set_priority(uint8_t priority)
 {
-	UNUSED(priority);
-
-	__asm__ volatile ("movq $" SX(SYSCALL_SET_PRIO) ", %r10");
-	__asm__ volatile ("int $" SX(SYSCALL_INT_VEC));
+	SYSCALL1(SYSCALL_SET_PRIO, priority);
 }
 
 uint8_t key_available()
 {
-	register uint8_t retVal __asm__("rax");
-
-	__asm__ volatile ("movq $" SX(SYSCALL_KEY_AVAIL) ", %r10");
-	__asm__ volatile ("int $" SX(SYSCALL_INT_VEC) ::: "%rax");
+	uint32_t seq, keys_in, keys_out;
+	do
+	{
+		seq = seq_read_begin(&vdso->seq);
+		keys_in = vdso->keys_in;
+		keys_out = vdso->keys_out;
+	} while (seq_read_retry(&vdso->seq, seq));
 
-	return retVal;
+	return keys_in != keys_out;
 }
 
 uint8_t get_key()
 {
-	register uint8_t retVal __asm__("rax");
+	return SYSCALL0(SYSCALL_GET_KEY);
+}
 
-	__asm__ volatile ("movq $" SX(SYSCALL_GET_KEY) ", %r10");
-	__asm__ volatile ("int $" SX(SYSCALL_INT_VEC) ::: "%rax");
+Status get_usage(Usage* usage)
+{
+	// The kernel fills it in
+	return SYSCALL1(SYSCALL_GET_USAGE, usage);
+}
 
-	return retVal;
+Status proc_info(uint64_t* cursor, ProcInfo* info)
+{
+	// The kernel fills them in
+	return SYSCALL2(SYSCALL_PROC_INFO, cursor, info);
+}
+
+Status sched_trace(uint8_t reset)
+{
+	return SYSCALL1(SYSCALL_SCHED_TRACE, reset);
+}
+
+uint64_t read_cycles()
+{
+	uint32_t low, high;
+	__asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
 }
 
 uint8_t read_key(void)
 {
-	while (!key_available())
+	return SYSCALL0(SYSCALL_READ_KEY);
+}
+
+static void thread_start(ThreadFn fn, void* arg)
+{
+	thread_exit(fn(arg));
+}
+
+Status thread_create(ThreadFn fn, void* arg, Pid* tid)
+{
+	// The new thread starts in thread_start(fn, arg)
+	return SYSCALL4(SYSCALL_THREAD_CREATE, thread_start, fn, arg, tid);
+}
+
+void thread_exit(uint64_t value)
+{
+	SYSCALL1(SYSCALL_THREAD_EXIT, value);
+}
+
+Status thread_join(Pid tid, uint64_t* value)
+{
+	// The kernel fills in value
+	return SYSCALL2(SYSCALL_THREAD_JOIN, tid, value);
+}
+
+Status set_tls(void* base)
+{
+	return SYSCALL1(SYSCALL_SET_TLS, base);
+}
+
+Status futex_wait(volatile uint32_t* addr, uint32_t expected, time_t timeout)
+{
+	return SYSCALL3(SYSCALL_FUTEX_WAIT, addr, expected, timeout);
+}
+
+uint64_t futex_wake(volatile uint32_t* addr, uint64_t count)
+{
+	return SYSCALL2(SYSCALL_FUTEX_WAKE, addr, count);
+}
+
+Status event_add(EventType type, uint64_t arg, uint32_t flags, uint64_t user_data, uint32_t* id)
+{
+	return SYSCALL5(SYSCALL_EVENT_ADD, type, arg, flags, user_data, id);
+}
+
+Status event_remove(uint32_t id)
+{
+	return SYSCALL1(SYSCALL_EVENT_REMOVE, id);
+}
+
+uint32_t wait_events(EventResult* events, uint32_t max, time_t timeout)
+{
+	return SYSCALL3(SYSCALL_WAIT_EVENTS, events, max, timeout);
+}
+
+Status timer_create(uint64_t user_data, uint32_t* id)
+{
+	// Timers start disarmed without a period
+	return event_add(EVENT_TIMER, 0, 0, user_data, id);
+}
+
+Status timer_settime(uint32_t id, uint32_t flags, uint64_t value_ns, uint64_t interval_ns)
+{
+	return SYSCALL4(SYSCALL_TIMER_SETTIME, id, flags, value_ns, interval_ns);
+}
+
+Status timer_getoverrun(uint32_t id, uint32_t* overrun)
+{
+	return SYSCALL2(SYSCALL_TIMER_GETOVERRUN, id, overrun);
+}
+
+uint64_t clock_gettime()
+{
+	__extension__ typedef unsigned __int128 uint128_t;
+
+	uint32_t seq, shift;
+	uint64_t base, mult, now;
+	do
+	{
+		seq = seq_read_begin(&vdso->seq);
+		base = vdso->tsc_base;
+		mult = vdso->ns_mult;
+		shift = vdso->ns_shift;
+		now = read_cycles();
+	} while (seq_read_retry(&vdso->seq, seq));
+
+	if (mult == 0)
+	{
+		return SYSCALL0(SYSCALL_CLOCK_GETTIME);
+	}
+
+	return (uint64_t)(((uint128_t)(now - base) * mult) >> shift);
+}
+
+uint32_t getcpu()
+{
+	uint32_t cpu;
+	__asm__ volatile ("lsl %1, %0" : "=r"(cpu) : "r"((uint32_t)VDSO_CPU_SELECTOR));
+	return cpu;
+}
+
+Pid getpid()
+{
+	// If the process moves while it's looking, the processor it
+	// started on changes its count or it isn't there any more
+	uint32_t cpu, seq;
+	Pid pid;
+	do
+	{
+		cpu = getcpu();
+		seq = seq_read_begin(&vdso->cpus[cpu].seq);
+		pid = vdso->cpus[cpu].pid;
+	} while (seq_read_retry(&vdso->cpus[cpu].seq, seq) || getcpu() != cpu);
+
+	return pid;
+}
+
+Status clock_nanosleep(uint32_t flags, uint64_t ns)
+{
+	return SYSCALL2(SYSCALL_CLOCK_NANOSLEEP, flags, ns);
+}
+
+Status channel_create(uint32_t ends[2])
+{
+	return SYSCALL1(SYSCALL_CHANNEL_CREATE, ends);
+}
+
+Status channel_send(uint32_t end, const IpcMessage* msg)
+{
+	return SYSCALL2(SYSCALL_CHANNEL_SEND, end, msg);
+}
+
+Status channel_recv(uint32_t end, IpcMessage* msg)
+{
+	return SYSCALL2(SYSCALL_CHANNEL_RECV, end, msg);
+}
+
+Status channel_close(uint32_t end)
+{
+	return SYSCALL1(SYSCALL_CHANNEL_CLOSE, end);
+}
+
+uint32_t ring_enter(Ring* ring, uint32_t to_submit)
+{
+	return SYSCALL2(SYSCALL_RING_ENTER, ring, to_submit);
+}
+
+uint8_t ring_submit(Ring* ring, RingOp op, uint32_t flags, uint64_t arg0,
+		uint64_t arg1, uint64_t user_data)
+{
+	const uint32_t tail = ring->sq_tail;
+	if (tail - ring->sq_head >= RING_SQ_ENTRIES)
+	{
+		return 0;
+	}
+
+	RingSubmission* sub = &ring->sq[tail & (RING_SQ_ENTRIES - 1)];
+	sub->user_data = user_data;
+	sub->op = op;
+	sub->flags = flags;
+	sub->args[0] = arg0;
+	sub->args[1] = arg1;
+	sub->args[2] = 0;
+
+	// The kernel mustn't see the new tail before the entry
+	barrier();
+	ring->sq_tail = tail + 1;
+	return 1;
+}
+
+uint8_t ring_reap(Ring* ring, RingCompletion* completion)
+{
+	const uint32_t head = ring->cq_head;
+	if (head == ring->cq_tail)
 	{
-		msleep(0);
+		return 0;
 	}
 
-	return get_key();
+	*completion = ring->cq[head & (RING_CQ_ENTRIES - 1)];
+	barrier();
+	ring->cq_head = head + 1;
+	return 1;
+}
+
+//============================================================================
+// Mutex, from Ulrich Drepper's "Futexes Are Tricky"
+//============================================================================
+
+void mutex_init(Mutex* mutex)
+{
+	mutex->state = 0;
+}
+
+void mutex_lock(Mutex* mutex)
+{
+	uint32_t state = atomic_cmpxchg(&mutex->state, 0, 1);
+	if (state == 0)
+	{
+		return;
+	}
+
+	// Mark it contended so the holder knows to wake us
+	if (state != 2)
+	{
+		state = atomic_xchg(&mutex->state, 2);
+	}
+
+	while (state != 0)
+	{
+		futex_wait(&mutex->state, 2, 0);
+		state = atomic_xchg(&mutex->state, 2);
+	}
+}
+
+uint8_t mutex_trylock(Mutex* mutex)
+{
+	return atomic_cmpxchg(&mutex->state, 0, 1) == 0;
+}
+
+void mutex_unlock(Mutex* mutex)
+{
+	if (atomic_fetch_add(&mutex->state, (uint32_t)-1) != 1)
+	{
+		mutex->state = 0;
+		futex_wake(&mutex->state, 1);
+	}
+}
+
+//============================================================================
+// Condition variable
+//============================================================================
+
+void cond_init(CondVar* cond)
+{
+	cond->seq = 0;
+	cond->waiters = 0;
+}
+
+void cond_wait(CondVar* cond, Mutex* mutex)
+{
+	// A signal after this changes seq, so the futex_wait() can't miss it
+	const uint32_t seq = cond->seq;
+	atomic_fetch_add(&cond->waiters, 1);
+	mutex_unlock(mutex);
+
+	futex_wait(&cond->seq, seq, 0);
+	atomic_fetch_add(&cond->waiters, (uint32_t)-1);
+
+	// Other waiters might have been woken with us, so take it as
+	// contended to make sure our unlock wakes the next one
+	while (atomic_xchg(&mutex->state, 2) != 0)
+	{
+		futex_wait(&mutex->state, 2, 0);
+	}
+}
+
+void cond_signal(CondVar* cond)
+{
+	atomic_fetch_add(&cond->seq, 1);
+	if (cond->waiters != 0)
+	{
+		futex_wake(&cond->seq, 1);
+	}
+}
+
+void cond_broadcast(CondVar* cond)
+{
+	atomic_fetch_add(&cond->seq, 1);
+	if (cond->waiters != 0)
+	{
+		futex_wake(&cond->seq, (uint64_t)-1);
+	}
+}
+
+//============================================================================
+// Counting semaphore
+//============================================================================
+
+void sem_init(Semaphore* sem, uint32_t count)
+{
+	sem->count = count;
+	sem->waiters = 0;
+}
+
+void sem_wait(Semaphore* sem)
+{
+	while (1)
+	{
+		const uint32_t count = sem->count;
+		if (count > 0)
+		{
+			if (atomic_cmpxchg(&sem->count, count, count - 1) == count)
+			{
+				return;
+			}
+			continue;
+		}
+
+		atomic_fetch_add(&sem->waiters, 1);
+		futex_wait(&sem->count, 0, 0);
+		atomic_fetch_add(&sem->waiters, (uint32_t)-1);
+	}
+}
+
+void sem_post(Semaphore* sem)
+{
+	atomic_fetch_add(&sem->count, 1);
+	if (sem->waiters != 0)
+	{
+		futex_wake(&sem->count, 1);
+	}
 }
@@ -9,15 +9,174 @@ Status fork(Pid* pid);
 
 void msleep(time_t ms);
 
+// Ends the process, every thread in it included
 void exit(void);
 
 void set_priority(uint8_t priority);
 
+// Read from the vdso page without a system call
 uint8_t key_available(void);
 
 uint8_t get_key(void);
 
+// Fills in the calling process's resource usage
+Status get_usage(Usage* usage);
+
+// Start with *cursor = 0, returns FAILURE when there are no more processes
+Status proc_info(uint64_t* cursor, ProcInfo* info);
+
+// Dumps the scheduler latency trace to the serial port, clearing it
+// afterwards if reset is non-zero
+Status sched_trace(uint8_t reset);
+
+// Same clock as the cycle counts in Usage
+uint64_t read_cycles(void);
+
 // Blocks
 uint8_t read_key(void);
 
+// What a thread runs, the return value is its exit value
+typedef uint64_t (*ThreadFn)(void* arg);
+
+// Starts fn(arg) in a new thread sharing this process's memory
+Status thread_create(ThreadFn fn, void* arg, Pid* tid);
+
+// Ends the calling thread, the process goes once the last one has.
+// exit() ends them all at once.
+void thread_exit(uint64_t value);
+
+// Waits for another thread of this process to end and gets its exit value
+Status thread_join(Pid tid, uint64_t* value);
+
+// Sets the calling thread's %fs base for thread local storage
+Status set_tls(void* base);
+
+// Sleeps until futex_wake() is called on addr, as long as *addr still
+// holds expected. A timeout of 0 waits forever. Returns WOULD_BLOCK if
+// *addr had already changed, and TIMED_OUT if the timeout ran out.
+Status futex_wait(volatile uint32_t* addr, uint32_t expected, time_t timeout);
+
+// Wakes up to count threads waiting on addr, returns how many woke
+uint64_t futex_wake(volatile uint32_t* addr, uint64_t count);
+
+// Registers interest in an event source for wait_events(). arg is the
+// period in milliseconds for EVENT_TIMER, and the handle for
+// EVENT_CHANNEL, which goes away when the handle is closed. flags are
+// EVENT_EDGE and EVENT_PERIODIC. user_data is handed back with every
+// EventResult.
+Status event_add(EventType type, uint64_t arg, uint32_t flags, uint64_t user_data, uint32_t* id);
+
+Status event_remove(uint32_t id);
+
+// Blocks until some of the registered events are ready and fills in up
+// to max of them, returns how many. A timeout of 0 doesn't block, and
+// EVENT_WAIT_FOREVER never runs out. If events can't be written it
+// returns BAD_ADDRESS and they stay pending for the next call.
+uint32_t wait_events(EventResult* events, uint32_t max, time_t timeout);
+
+// Makes a disarmed timer that reports through wait_events(), remove it
+// with event_remove()
+Status timer_create(uint64_t user_data, uint32_t* id);
+
+// Arms a timer to go off at value_ns, a clock_gettime() time with
+// TIMER_ABSTIME or from now otherwise, then every interval_ns if that
+// isn't 0. Periods are counted from the deadlines rather than from when
+// they were reported, so they don't drift. A value_ns of 0 disarms it.
+Status timer_settime(uint32_t id, uint32_t flags, uint64_t value_ns, uint64_t interval_ns);
+
+// How many periods were missed before the last one wait_events()
+// reported, one less than its count
+Status timer_getoverrun(uint32_t id, uint32_t* overrun);
+
+// Nanoseconds since boot, never goes backwards. Read from the vdso page
+// without a system call.
+uint64_t clock_gettime(void);
+
+// Which processor and process this is, read from the vdso page without
+// a system call. The processor can change as soon as it's returned.
+uint32_t getcpu(void);
+Pid getpid(void);
+
+// Sleeps until ns on the clock_gettime() clock with TIMER_ABSTIME, or
+// for ns otherwise. Never returns early.
+Status clock_nanosleep(uint32_t flags, uint64_t ns);
+
+// Makes a message channel, what is sent on one end is received on the
+// other. Handles only mean something to the process that has them,
+// all of its threads share them. fork() children get copies, so one
+// made before fork() connects parent and child.
+Status channel_create(uint32_t ends[2]);
+
+// Copies msg->size bytes, up to IPC_INLINE_SIZE, and moves
+// msg->page_count pages from msg->pages without copying them. The pages
+// are gone from this process afterwards. Blocks while the other end
+// has too many messages waiting.
+Status channel_send(uint32_t end, const IpcMessage* msg);
+
+// Blocks until a message comes. msg->data and msg->size are the buffer,
+// and msg->page_count unmapped pages at msg->pages are where its pages
+// can go. They're changed to what was received. Returns TRUNCATED if
+// the message didn't fit, the rest of it is thrown away. Returns
+// FAILURE once the other end is closed and everything it sent has been
+// received.
+Status channel_recv(uint32_t end, IpcMessage* msg);
+
+Status channel_close(uint32_t end);
+
+// Runs up to to_submit of the requests queued in ring with one system
+// call, returns how many were taken. Their completions are put in the
+// ring's completion queue in order. A zeroed Ring is empty.
+uint32_t ring_enter(Ring* ring, uint32_t to_submit);
+
+// Queues a request, returns 0 if the submission ring is full
+uint8_t ring_submit(Ring* ring, RingOp op, uint32_t flags, uint64_t arg0,
+		uint64_t arg1, uint64_t user_data);
+
+// Takes the oldest completion, returns 0 if there aren't any
+uint8_t ring_reap(Ring* ring, RingCompletion* completion);
+
+// Locks built on futexes. Nothing enters the kernel unless a thread
+// has to wait, or somebody is waiting. All of them start zeroed.
+typedef struct
+{
+	volatile uint32_t state; // 0 unlocked, 1 locked, 2 locked with waiters
+} Mutex;
+
+typedef struct
+{
+	volatile uint32_t seq;     // Bumped by every signal
+	volatile uint32_t waiters;
+} CondVar;
+
+typedef struct
+{
+	volatile uint32_t count;
+	volatile uint32_t waiters;
+} Semaphore;
+
+void mutex_init(Mutex* mutex);
+
+void mutex_lock(Mutex* mutex);
+
+// Returns 1 if the mutex was taken
+uint8_t mutex_trylock(Mutex* mutex);
+
+void mutex_unlock(Mutex* mutex);
+
+void cond_init(CondVar* cond);
+
+// Unlocks the mutex while waiting and takes it back before returning.
+// Can wake up without a signal, always check the condition again.
+void cond_wait(CondVar* cond, Mutex* mutex);
+
+void cond_signal(CondVar* cond);
+
+void cond_broadcast(CondVar* cond);
+
+void sem_init(Semaphore* sem, uint32_t count);
+
+void sem_wait(Semaphore* sem);
+
+void sem_post(Semaphore* sem);
+
 #endif
@@ -0,0 +1,159 @@
+#include "bench.h"
+#include "host.h"
+
+#include "inttypes.h"
+#include "kernel/klib.h"
+#include "kernel/kprintf.h"
+
+#include "arch/x86_64/virt_memory/defines.h"
+
+// How much each measurement moves, small sizes are called many times
+#define BYTES_PER_RUN (64UL*1024*1024)
+
+// Bigger than any cache, so the page runs see cold memory like a fresh
+// frame would
+#define POOL_SIZE (64UL*1024*1024)
+#define PAGE_PASSES 4
+
+typedef enum
+{
+	OP_COPY = 0,
+	OP_SET,
+	OP_CLEAR,
+	NUM_OPS,
+} Op;
+
+static const char* op_names[NUM_OPS] = { "memcpy", "memset", "memclr" };
+
+static const uint64_t sizes[] = { 8, 64, 256, 1024, 4096, 65536, PAGE_LARGE_SIZE };
+#define NUM_SIZES (sizeof(sizes)/sizeof(sizes[0]))
+
+// Offsets of the destination and the source from a page boundary
+static const uint64_t offsets[][2] = { { 0, 0 }, { 1, 0 }, { 0, 3 }, { 7, 5 } };
+#define NUM_OFFSETS (sizeof(offsets)/sizeof(offsets[0]))
+
+// MB/s, without and with klib_init()
+static uint64_t results[NUM_OPS][NUM_SIZES][NUM_OFFSETS][2];
+
+static uint64_t rate(uint64_t bytes, uint64_t ns)
+{
+	// Bytes per nanosecond is GB/s
+	return ns == 0 ? 0 : bytes*1000 / ns;
+}
+
+static uint64_t time_op(Op op, uint8_t* dst, const uint8_t* src, uint64_t size)
+{
+	const uint64_t reps = BYTES_PER_RUN / size;
+	const uint64_t start = host_ns();
+	for (uint64_t i = 0; i < reps; ++i)
+	{
+		switch (op)
+		{
+			case OP_COPY: memcpy(dst, src, size); break;
+			case OP_SET: memset(dst, 0x5A, size); break;
+			default: memclr(dst, size); break;
+		}
+	}
+
+	return rate(reps*size, host_ns() - start);
+}
+
+static void sweep(uint8_t* dst, const uint8_t* src, uint32_t column)
+{
+	for (uint32_t op = 0; op < NUM_OPS; ++op)
+	{
+		for (uint32_t s = 0; s < NUM_SIZES; ++s)
+		{
+			for (uint32_t o = 0; o < NUM_OFFSETS; ++o)
+			{
+				results[op][s][o][column] = time_op((Op)op,
+						dst + offsets[o][0], src + offsets[o][1], sizes[s]);
+			}
+		}
+	}
+}
+
+static void print_sweep()
+{
+	for (uint32_t op = 0; op < NUM_OPS; ++op)
+	{
+		kprintf("---- %s, MB/s as loops -> after klib_init() ----\n", op_names[op]);
+		kprintf("%10s", "size");
+		for (uint32_t o = 0; o < NUM_OFFSETS; ++o)
+		{
+			kprintf("    dst+%u src+%u", offsets[o][0], offsets[o][1]);
+		}
+		kprintf("\n");
+
+		for (uint32_t s = 0; s < NUM_SIZES; ++s)
+		{
+			kprintf("%10u", sizes[s]);
+			for (uint32_t o = 0; o < NUM_OFFSETS; ++o)
+			{
+				kprintf("  %6u -> %6u", results[op][s][o][0], results[op][s][o][1]);
+			}
+			kprintf("\n");
+		}
+	}
+}
+
+/* Walk a whole page at a time through memory too big to cache, the
+ * way fork and exec touch fresh frames.
+ */
+static uint64_t time_pages(uint8_t* dst, const uint8_t* src, uint64_t page_size,
+		uint8_t copy, uint8_t non_temporal)
+{
+	const uint64_t start = host_ns();
+	for (uint64_t pass = 0; pass < PAGE_PASSES; ++pass)
+	{
+		for (uint64_t offset = 0; offset < POOL_SIZE; offset += page_size)
+		{
+			if (copy && non_temporal) { memcpy_nt(dst + offset, src + offset, page_size); }
+			else if (copy) { memcpy(dst + offset, src + offset, page_size); }
+			else if (non_temporal) { memclr_nt(dst + offset, page_size); }
+			else { memclr(dst + offset, page_size); }
+		}
+	}
+
+	return rate(PAGE_PASSES*POOL_SIZE, host_ns() - start);
+}
+
+static void print_pages(uint8_t* dst, const uint8_t* src)
+{
+	const uint64_t page_sizes[] = { PAGE_SMALL_SIZE, PAGE_LARGE_SIZE };
+
+	kprintf("---- Whole pages, MB/s cached -> non-temporal ----\n");
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		const uint64_t size = page_sizes[i];
+		const uint64_t clear = time_pages(dst, src, size, 0, 0);
+		const uint64_t clear_nt = time_pages(dst, src, size, 0, 1);
+		const uint64_t copy = time_pages(dst, src, size, 1, 0);
+		const uint64_t copy_nt = time_pages(dst, src, size, 1, 1);
+
+		kprintf("%10u  clear %6u -> %6u  copy %6u -> %6u\n",
+				size, clear, clear_nt, copy, copy_nt);
+	}
+}
+
+void bench_memory()
+{
+	const uint64_t buffer_size = PAGE_LARGE_SIZE + PAGE_SMALL_SIZE;
+	uint8_t* dst = (uint8_t*)host_alloc(PAGE_SMALL_SIZE, buffer_size);
+	uint8_t* src = (uint8_t*)host_alloc(PAGE_SMALL_SIZE, buffer_size);
+
+	sweep(dst, src, 0);
+	klib_init();
+	sweep(dst, src, 1);
+	print_sweep();
+
+	host_free(dst);
+	host_free(src);
+
+	dst = (uint8_t*)host_alloc(PAGE_LARGE_SIZE, POOL_SIZE);
+	src = (uint8_t*)host_alloc(PAGE_LARGE_SIZE, POOL_SIZE);
+	print_pages(dst, src);
+
+	host_free(dst);
+	host_free(src);
+}
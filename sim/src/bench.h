@@ -0,0 +1,18 @@
+#ifndef __SIM_BENCH_H__
+#define __SIM_BENCH_H__
+
+/* Benchmarks that run kernel code on the host in real time, instead of
+ * replaying a workload in simulated time.
+ */
+
+/* Time memcpy(), memset() and memclr() across sizes and alignments,
+ * first with the plain loops they start with then with whatever
+ * klib_init() picks for this machine. Then compare the cached and
+ * non-temporal versions on whole pages.
+ *
+ * The kernel is built without optimisation and the simulator with
+ * -O2, so the loops do better here than they would in the kernel.
+ */
+void bench_memory(void);
+
+#endif
@@ -0,0 +1,44 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void host_putchar(char c)
+{
+	putchar(c);
+}
+
+void* host_alloc(unsigned long alignment, unsigned long size)
+{
+	void* ptr = NULL;
+	if (posix_memalign(&ptr, alignment, size) != 0)
+	{
+		fprintf(stderr, "sim: failed to allocate %lu bytes\n", size);
+		exit(1);
+	}
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+void host_free(void* ptr)
+{
+	free(ptr);
+}
+
+unsigned long host_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long)now.tv_sec*1000000000UL + (unsigned long)now.tv_nsec;
+}
+
+void host_abort()
+{
+	fflush(stdout);
+	abort();
+}
@@ -0,0 +1,44 @@
+#ifndef __SIM_HOST_H__
+#define __SIM_HOST_H__
+
+/* The few things the simulator needs from the C library. Everything
+ * else is compiled against the kernel's own headers, which clash with
+ * libc's, so only host.c includes libc and these functions stick to
+ * plain C types.
+ */
+
+/* Write a character to stdout.
+ */
+void host_putchar(char c);
+
+/* Allocate zeroed memory aligned to the given power of two. Exits the
+ * simulator if the allocation fails.
+ *
+ * Parameters:
+ *    alignment - The alignment in bytes
+ *    size - The number of bytes to allocate
+ *
+ * Returns:
+ *    A pointer to the memory
+ */
+void* host_alloc(unsigned long alignment, unsigned long size);
+
+/* Free memory returned by host_alloc().
+ *
+ * Parameters:
+ *    ptr - The memory to free
+ */
+void host_free(void* ptr);
+
+/* Real time, for the benchmarks. Has nothing to do with simulated time.
+ *
+ * Returns:
+ *    Nanoseconds since some fixed point in the past
+ */
+unsigned long host_ns(void);
+
+/* Stop the simulator immediately, used by panic().
+ */
+void host_abort(void) __attribute__((noreturn));
+
+#endif
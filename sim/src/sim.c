@@ -0,0 +1,440 @@
+#include "sim.h"
+#include "host.h"
+#include "bench.h"
+
+#include "inttypes.h"
+#include "kernel/klib.h"
+#include "kernel/panic.h"
+#include "kernel/kprintf.h"
+#include "kernel/alloc/alloc.h"
+#include "kernel/virt_memory/defs.h"
+#include "kernel/scheduler/pcb.h"
+#include "kernel/scheduler/trace.h"
+#include "kernel/scheduler/usage.h"
+#include "kernel/scheduler/reaper.h"
+#include "kernel/scheduler/scheduler.h"
+
+#include "arch/x86_64/virt_memory/physical.h"
+#include "arch/x86_64/virt_memory/phys_alloc.h"
+
+/* Replays synthetic workloads against the real scheduler and physical
+ * allocator in simulated time. Processes are just a SimSpace saying
+ * how long to run before making their next system call, the system
+ * calls go through the same scheduler paths the kernel's do.
+ */
+
+extern void timer_interrupt(void);
+
+#define FOREVER 0xFFFFFFFFFFFFFFFF
+
+// Leave room under MAX_PCBS for the PCBs waiting on the reaper
+#define MAX_LIVE 512
+
+// How often the allocator's fragmentation is sampled
+#define SAMPLE_TICKS (10*SIM_TICKS_PER_MS)
+
+#define DEFAULT_SECONDS 10
+
+typedef struct
+{
+	const char* name;
+	const char* description;
+	void (*setup)(void);
+} Workload;
+
+// Workload results
+static uint64_t bursts = 0;
+static uint64_t forks = 0;
+static uint64_t exits = 0;
+static uint64_t fork_throttled = 0;
+static uint64_t idle_ticks = 0;
+
+// Allocator samples
+static uint64_t samples = 0;
+static uint64_t peak_pools = 0;
+static uint64_t peak_pages = 0;
+static uint64_t worst_stranded = 0;
+static uint64_t total_stranded = 0;
+
+static uint64_t random_state = 0x2545F4914F6CDD1D;
+
+uint64_t sim_random(uint64_t max)
+{
+	// xorshift64
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+
+	return random_state % max;
+}
+
+static uint8_t streq(const char* s1, const char* s2)
+{
+	while (*s1 != '\0' && *s1 == *s2)
+	{
+		++s1;
+		++s2;
+	}
+
+	return *s1 == *s2;
+}
+
+static uint64_t parse_number(const char* str)
+{
+	uint64_t value = 0;
+	for (; *str >= '0' && *str <= '9'; ++str)
+	{
+		value = value*10 + (*str - '0');
+	}
+
+	return value;
+}
+
+//============================================================================
+// Processes
+//============================================================================
+
+static PCB* spawn(TaskKind kind, Priority priority, uint64_t burst,
+		uint64_t sleep_ms, uint64_t num_pages)
+{
+	PCB* pcb = alloc_pcb();
+	pcb->priority = priority;
+
+	SimSpace* space = sim_space_create(num_pages);
+	space->kind = kind;
+	space->burst = burst;
+	space->remaining = (kind == TASK_IDLE || kind == TASK_HOG) ? FOREVER : burst;
+	space->sleep_ms = sleep_ms;
+	pcb->page_table = space;
+
+	// The first process is the one that gets the CPU
+	if (current_pcb == NULL)
+	{
+		current_pcb = pcb;
+	}
+	else
+	{
+		schedule(pcb);
+	}
+
+	return pcb;
+}
+
+/* Mirrors the fork() system call, minus the Context juggling.
+ */
+static void sim_fork(PCB* pcb)
+{
+	PCB* new_pcb = alloc_pcb();
+
+	const Pid new_pid = new_pcb->pid;
+	const uint64_t new_kernel_stack = new_pcb->kernel_stack;
+	Context* new_context = new_pcb->context;
+	memcpy(new_pcb, pcb, sizeof(PCB));
+	new_pcb->pid = new_pid;
+	new_pcb->ppid = pcb->pid;
+	new_pcb->kernel_stack = new_kernel_stack;
+	new_pcb->context = new_context;
+	memcpy(new_context, pcb->context, sizeof(Context));
+	memclr(&new_pcb->usage, sizeof(Usage));
+	new_pcb->run_stamp = 0;
+	trace_wakeup(new_pcb);
+
+	SimSpace* child = (SimSpace*)virt_clone_mapping(pcb->page_table);
+	child->kind = TASK_CHILD;
+	child->burst = child->remaining = 100 + sim_random(2000);
+	child->rounds = 0;
+	sim_space_grow(child, sim_random(64));
+	new_pcb->page_table = child;
+	++forks;
+
+	schedule(new_pcb);
+	dispatch();
+}
+
+static void system_call(PCB* pcb, SimSpace* space)
+{
+	++bursts;
+	++space->rounds;
+	space->remaining = space->burst;
+
+	switch (space->kind)
+	{
+		case TASK_SLEEPER:
+			sleep_pcb(pcb, 1 + sim_random(space->sleep_ms));
+			break;
+		case TASK_FORKER:
+			if (sim_live_spaces < MAX_LIVE)
+			{
+				sim_fork(pcb);
+			}
+			else
+			{
+				++fork_throttled;
+				sleep_pcb(pcb, 1);
+			}
+			break;
+		case TASK_CHILD:
+			++exits;
+			pcb->state = KILLED;
+			dispatch();
+			break;
+		default:
+			panic("Sim: Unexpected system call");
+			break;
+	}
+}
+
+//============================================================================
+// Workloads
+//============================================================================
+
+static void setup_sleepers()
+{
+	// Lots of interactive processes that barely use the CPU
+	for (uint64_t i = 0; i < 128; ++i)
+	{
+		spawn(TASK_SLEEPER, NORMAL, 50 + sim_random(200), 20, 8);
+	}
+}
+
+static void setup_forkstorm()
+{
+	for (uint64_t i = 0; i < 8; ++i)
+	{
+		spawn(TASK_FORKER, NORMAL, 200, 0, 16);
+	}
+}
+
+static void setup_hogs()
+{
+	// Some interactive processes trying to get a word in
+	for (uint64_t i = 0; i < 4; ++i)
+	{
+		spawn(TASK_SLEEPER, HIGH, 100, 10, 8);
+	}
+
+	for (uint64_t i = 0; i < 8; ++i)
+	{
+		spawn(TASK_HOG, i < 4 ? NORMAL : LOW, 0, 0, 256);
+	}
+}
+
+static void setup_mixed()
+{
+	setup_hogs();
+	setup_sleepers();
+	for (uint64_t i = 0; i < 2; ++i)
+	{
+		spawn(TASK_FORKER, HIGH, 1000, 0, 16);
+	}
+}
+
+static const Workload workloads[] =
+{
+	{ "sleepers", "128 processes sleeping 1-20ms between short bursts", setup_sleepers },
+	{ "forkstorm", "8 processes forking short lived children", setup_forkstorm },
+	{ "hogs", "8 CPU hogs with 4 high priority sleepers", setup_hogs },
+	{ "mixed", "hogs, sleepers and forkers together", setup_mixed },
+};
+
+#define NUM_WORKLOADS (sizeof(workloads)/sizeof(workloads[0]))
+
+//============================================================================
+// Simulation
+//============================================================================
+
+static void sample_allocator()
+{
+	PhysAllocStats stats;
+	phys_alloc_get_stats(&stats);
+
+	++samples;
+	total_stranded += stats.free_4KIB;
+	if (stats.free_4KIB > worst_stranded) { worst_stranded = stats.free_4KIB; }
+	if (stats.pools > peak_pools) { peak_pools = stats.pools; }
+	if (sim_pages_in_use > peak_pages) { peak_pages = sim_pages_in_use; }
+}
+
+/* Let the current process run for a while in user mode.
+ */
+static void run_user(uint64_t ticks)
+{
+	SimSpace* space = (SimSpace*)current_pcb->page_table;
+	if (space->remaining != FOREVER)
+	{
+		space->remaining -= ticks;
+	}
+
+	if (space->kind == TASK_IDLE)
+	{
+		idle_ticks += ticks;
+	}
+
+	sim_advance(ticks);
+}
+
+static void simulate(uint64_t end)
+{
+	uint64_t next_sample = 0;
+
+	while (sim_now < end)
+	{
+		if (sim_now >= next_sample)
+		{
+			sample_allocator();
+			next_sample = sim_now + SAMPLE_TICKS;
+		}
+
+		PCB* pcb = current_pcb;
+		SimSpace* space = (SimSpace*)pcb->page_table;
+
+		uint64_t deadline = FOREVER;
+		const uint8_t armed = sim_timer_deadline(&deadline);
+		const uint64_t action = space->remaining == FOREVER ?
+			FOREVER : sim_now + space->remaining;
+
+		if (armed && deadline <= action)
+		{
+			run_user(deadline > sim_now ? deadline - sim_now : 0);
+			sim_timer_fired();
+
+			usage_kernel_enter();
+			sim_advance(SIM_KERNEL_TICKS);
+			timer_interrupt();
+			schedule_pending();
+			usage_kernel_exit();
+		}
+		else if (action == FOREVER)
+		{
+			panic("Sim: The timer isn't running and nothing will yield");
+		}
+		else
+		{
+			run_user(space->remaining);
+
+			usage_kernel_enter();
+			sim_advance(SIM_KERNEL_TICKS);
+			++pcb->usage.syscalls;
+			system_call(pcb, space);
+			usage_kernel_exit();
+		}
+	}
+}
+
+static void print_percent(const char* label, uint64_t part, uint64_t whole)
+{
+	const uint64_t tenths = whole == 0 ? 0 : (part*1000) / whole;
+	kprintf("%-24s %u.%u%%\n", label, tenths / 10, tenths % 10);
+}
+
+static void report(const Workload* workload, uint64_t seconds)
+{
+	kprintf("==== %s: %s ====\n", workload->name, workload->description);
+	kprintf("%-24s %u s\n", "Simulated time", seconds);
+	kprintf("%-24s %u (%u/s)\n", "System calls", bursts, bursts / seconds);
+	kprintf("%-24s %u (%u/s)\n", "Forks", forks, forks / seconds);
+	kprintf("%-24s %u\n", "Exits", exits);
+	kprintf("%-24s %u\n", "Forks throttled", fork_throttled);
+	kprintf("%-24s %u (%u/s)\n", "Page table switches",
+			sim_page_table_switches, sim_page_table_switches / seconds);
+	print_percent("Idle", idle_ticks, sim_now);
+
+	uint64_t cursor = 0;
+	uint64_t live = 0;
+	uint64_t kernel_cycles = 0;
+	for (PCB* pcb = find_pcb(&cursor); pcb != NULL; pcb = find_pcb(&cursor))
+	{
+		++live;
+		kernel_cycles += pcb->usage.kernel_cycles;
+	}
+	kprintf("%-24s %u (%u waiting on the reaper)\n", "Processes left",
+			live, reaper_pending());
+	print_percent("Kernel (live processes)", kernel_cycles, sim_now);
+
+	PhysAllocStats stats;
+	phys_alloc_get_stats(&stats);
+	kprintf("---- Physical allocator ----\n");
+	kprintf("%-24s %u\n", "Free 2MiB chunks", stats.free_2MIB);
+	kprintf("%-24s %u (peak %u)\n", "4KiB pools", stats.pools, peak_pools);
+	kprintf("%-24s %u (peak %u)\n", "Pages in use", sim_pages_in_use, peak_pages);
+	kprintf("%-24s %u in %u pools (worst %u, average %u)\n", "Stranded free pages",
+			stats.free_4KIB, stats.partial_pools, worst_stranded,
+			samples == 0 ? 0 : total_stranded / samples);
+	print_percent("Pool fragmentation", stats.free_4KIB, stats.pools*511);
+
+	kprintf("---- Latencies (1 cycle = 1us) ----\n");
+	trace_dump();
+}
+
+static void usage()
+{
+	kprintf("Usage: sim <workload> [seconds]\n");
+	kprintf("       sim memory\n");
+	for (uint64_t i = 0; i < NUM_WORKLOADS; ++i)
+	{
+		kprintf("  %-10s %s\n", workloads[i].name, workloads[i].description);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		usage();
+		return 1;
+	}
+
+	// Not a workload, it runs in real time
+	if (streq(argv[1], "memory"))
+	{
+		bench_memory();
+		return 0;
+	}
+
+	const Workload* workload = NULL;
+	for (uint64_t i = 0; i < NUM_WORKLOADS; ++i)
+	{
+		if (streq(argv[1], workloads[i].name))
+		{
+			workload = &workloads[i];
+		}
+	}
+
+	if (workload == NULL)
+	{
+		usage();
+		return 1;
+	}
+
+	const uint64_t seconds = argc > 2 ? parse_number(argv[2]) : DEFAULT_SECONDS;
+	if (seconds == 0)
+	{
+		usage();
+		return 1;
+	}
+
+	// Same setup order as kmain()
+	klib_init();
+
+	const uint64_t watermark_size = 0x400000;
+	uint8_t* watermark = (uint8_t*)host_alloc(PAGE_LARGE_SIZE, watermark_size);
+	water_mark_init(&kernel_WaterMark, watermark + watermark_size, watermark_size);
+
+	// There's no BIOS memory map, physical addresses are whatever maps
+	// back to the host's memory
+	void* memory = host_alloc(PAGE_LARGE_SIZE, SIM_MEMORY_SIZE);
+	phys_alloc_add_region((uint64_t)VIRT_TO_PHYS(memory), SIM_MEMORY_SIZE);
+
+	scheduler_init();
+
+	workload->setup();
+
+	// Something always has to be runnable
+	spawn(TASK_IDLE, IDLE, 0, 0, 1);
+	scheduler_start();
+
+	simulate(seconds*1000*SIM_TICKS_PER_MS);
+	report(workload, seconds);
+
+	return 0;
+}
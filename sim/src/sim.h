@@ -0,0 +1,104 @@
+#ifndef __SIM_SIM_H__
+#define __SIM_SIM_H__
+
+#include "inttypes.h"
+
+/* Shared state between the simulated hardware (stubs.c) and the
+ * workload driver (sim.c).
+ */
+
+/* Simulated time is counted in ticks. The timer, the cycle counter
+ * and the workloads all use the same clock, one tick is a microsecond.
+ */
+#define SIM_TICKS_PER_MS 1000
+
+/* Cost of every trip into the kernel (interrupt or system call).
+ */
+#define SIM_KERNEL_TICKS 2
+
+#define SIM_MEMORY_SIZE (256*1024*1024)
+
+typedef enum
+{
+	TASK_IDLE = 0, // Spins at the idle priority
+	TASK_HOG,      // Never gives up the CPU on its own
+	TASK_SLEEPER,  // Runs for a bit then sleeps
+	TASK_FORKER,   // Keeps forking short lived children
+	TASK_CHILD,    // Runs for a bit then exits
+} TaskKind;
+
+/* A simulated address space. The scheduler only ever sees it as the
+ * PCB's page_table, so this is also where the simulated process keeps
+ * what it is doing, fork() copies it just like memory.
+ */
+typedef struct
+{
+	TaskKind kind;
+	uint64_t remaining; // Ticks until the next system call
+	uint64_t burst;     // Ticks of CPU used between system calls
+	uint64_t sleep_ms;  // How long a sleeper sleeps for
+	uint64_t rounds;    // How many bursts have finished
+
+	uint64_t num_pages;
+	void** pages;       // 4KiB physical pages owned by this space
+} SimSpace;
+
+// The current simulated time
+extern uint64_t sim_now;
+
+// Bookkeeping done by the stubs
+extern uint64_t sim_page_table_switches;
+extern uint64_t sim_live_spaces;
+extern uint64_t sim_pages_in_use;
+
+/* Advance the simulated clock.
+ *
+ * Parameters:
+ *    ticks - How far to move the clock forward
+ */
+void sim_advance(uint64_t ticks);
+
+/* Check when the timer will fire.
+ *
+ * Parameters:
+ *    out_when - Set to the time of the next timer interrupt
+ *
+ * Returns:
+ *    1 if the timer is running, 0 otherwise
+ */
+uint8_t sim_timer_deadline(uint64_t* out_when);
+
+/* Called when the timer's deadline has been reached, stops the timer
+ * just like the one-shot APIC timer does.
+ */
+void sim_timer_fired(void);
+
+/* Create an address space with the given number of 4KiB pages.
+ *
+ * Parameters:
+ *    num_pages - How many pages to allocate from the physical allocator
+ *
+ * Returns:
+ *    The new address space
+ */
+SimSpace* sim_space_create(uint64_t num_pages);
+
+/* Give an address space more 4KiB pages.
+ *
+ * Parameters:
+ *    space - The address space to grow
+ *    count - How many pages to add
+ */
+void sim_space_grow(SimSpace* space, uint64_t count);
+
+/* Pseudo random numbers, so every run of a workload is the same.
+ *
+ * Parameters:
+ *    max - One more than the largest value wanted
+ *
+ * Returns:
+ *    A value in the range [0, max)
+ */
+uint64_t sim_random(uint64_t max);
+
+#endif
@@ -0,0 +1,423 @@
+#include "sim.h"
+#include "host.h"
+
+#include "inttypes.h"
+#include "kernel/klib.h"
+#include "kernel/panic.h"
+#include "kernel/elf/elf.h"
+#include "kernel/kprintf.h"
+#include "kernel/alloc/alloc.h"
+#include "kernel/timer/defs.h"
+#include "kernel/virt_memory/defs.h"
+#include "kernel/scheduler/pcb.h"
+#include "kernel/smp/defs.h"
+#include "kernel/rcu/rcu.h"
+#include "kernel/scheduler/events.h"
+#include "kernel/ipc/channel.h"
+#include "kernel/vdso/vdso.h"
+
+#include "arch/x86_64/serial.h"
+#include "arch/x86_64/textmode.h"
+#include "arch/x86_64/interrupts/tss.h"
+#include "arch/x86_64/interrupts/switch.h"
+#include "arch/x86_64/fpu/fpu.h"
+#include "arch/x86_64/interrupts/interrupts.h"
+#include "arch/x86_64/virt_memory/paging.h"
+#include "arch/x86_64/virt_memory/physical.h"
+#include "arch/x86_64/virt_memory/phys_alloc.h"
+
+/* Stand-ins for the hardware and for the parts of the kernel that
+ * can't run as a normal program.
+ */
+
+uint64_t sim_now = 0;
+uint64_t sim_page_table_switches = 0;
+uint64_t sim_live_spaces = 0;
+uint64_t sim_pages_in_use = 0;
+
+WaterMarkAllocator kernel_WaterMark;
+void* kernel_table = NULL;
+uint64_t __KERNEL_END;
+
+//============================================================================
+// Console
+//============================================================================
+
+void serial_char(char c)
+{
+	host_putchar(c);
+}
+
+void text_mode_char(char c)
+{
+	host_putchar(c);
+}
+
+void panic(const char* message)
+{
+	kprintf("%s - PANIC  \n", message);
+	host_abort();
+}
+
+//============================================================================
+// Timer
+//
+// Behaves like the one-shot local APIC timer. Once the count reaches zero,
+// or the timer is stopped, the current count reads as 0.
+//============================================================================
+
+static uint32_t timer_delay = 0;
+static uint32_t timer_initial = 0;
+static uint64_t timer_started = 0;
+static uint8_t timer_running = 0;
+
+void sim_advance(uint64_t ticks)
+{
+	sim_now += ticks;
+}
+
+uint8_t sim_timer_deadline(uint64_t* out_when)
+{
+	*out_when = timer_started + timer_initial;
+	return timer_running;
+}
+
+void sim_timer_fired()
+{
+	timer_running = 0;
+}
+
+time_t timer_one_ms()
+{
+	return SIM_TICKS_PER_MS;
+}
+
+void timer_set_delay(uint32_t delay)
+{
+	timer_delay = delay;
+}
+
+time_t timer_get_count()
+{
+	if (!timer_running)
+	{
+		return 0;
+	}
+
+	const uint64_t passed = sim_now - timer_started;
+	return passed >= timer_initial ? 0 : timer_initial - passed;
+}
+
+time_t timer_get_elapsed()
+{
+	const uint32_t count = timer_get_count();
+	ASSERT(timer_delay >= count);
+	return timer_delay - count;
+}
+
+void timer_start()
+{
+	timer_initial = timer_delay;
+	timer_started = sim_now;
+	timer_running = timer_initial > 0;
+}
+
+void timer_resume()
+{
+	timer_initial = timer_get_count();
+	timer_started = sim_now;
+	timer_running = timer_initial > 0;
+}
+
+void timer_stop()
+{
+	timer_running = 0;
+}
+
+uint64_t timer_get_cycles()
+{
+	return sim_now;
+}
+
+uint64_t timer_get_ns()
+{
+	return sim_now * NS_PER_MS / SIM_TICKS_PER_MS;
+}
+
+//============================================================================
+// Paging
+//
+// A page table is really a SimSpace. Its pages come from the real physical
+// allocator so fork and exit put the same pressure on it as they do in the
+// kernel.
+//============================================================================
+
+void sim_space_grow(SimSpace* space, uint64_t count)
+{
+	void** pages = (void**)host_alloc(8, sizeof(void*)*(space->num_pages + count));
+	if (space->pages != NULL)
+	{
+		memcpy(pages, space->pages, sizeof(void*)*space->num_pages);
+		host_free(space->pages);
+	}
+	space->pages = pages;
+
+	for (uint64_t i = 0; i < count; ++i)
+	{
+		void* page = phys_alloc_4KIB_safe("Sim: Out of physical memory");
+
+		// Tag the page so a page handed out twice gets noticed
+		*(SimSpace**)PHYS_TO_VIRT(page) = space;
+		space->pages[space->num_pages++] = page;
+	}
+	sim_pages_in_use += count;
+}
+
+SimSpace* sim_space_create(uint64_t num_pages)
+{
+	SimSpace* space = (SimSpace*)host_alloc(8, sizeof(SimSpace));
+	sim_space_grow(space, num_pages);
+	++sim_live_spaces;
+
+	return space;
+}
+
+void virt_switch_page_table(void* page_table)
+{
+	UNUSED(page_table);
+	++sim_page_table_switches;
+}
+
+void* virt_clone_mapping(void* table)
+{
+	const SimSpace* other = (const SimSpace*)table;
+	SimSpace* space = sim_space_create(other->num_pages);
+
+	void** pages = space->pages;
+	memcpy(space, other, sizeof(SimSpace));
+	space->pages = pages;
+
+	for (uint64_t i = 0; i < space->num_pages; ++i)
+	{
+		*(SimSpace**)PHYS_TO_VIRT(pages[i]) = space;
+	}
+
+	return space;
+}
+
+void virt_cleanup_table(void* table)
+{
+	SimSpace* space = (SimSpace*)table;
+	for (uint64_t i = 0; i < space->num_pages; ++i)
+	{
+		if (*(SimSpace**)PHYS_TO_VIRT(space->pages[i]) != space)
+		{
+			panic("Sim: Page was given to two address spaces");
+		}
+
+		phys_free_4KIB(space->pages[i]);
+	}
+
+	sim_pages_in_use -= space->num_pages;
+	host_free(space->pages);
+	host_free(space);
+	--sim_live_spaces;
+}
+
+uint64_t virt_count_pages(void* table)
+{
+	return ((const SimSpace*)table)->num_pages;
+}
+
+uint8_t virt_map_page(void* table, const uint64_t virt_addr, 
+				const uint64_t flags, const uint64_t page_size, 
+				uint64_t* phys_addr)
+{
+	// Only used by the watermark allocator, whose memory is already there
+	UNUSED(table);
+	UNUSED(virt_addr);
+	UNUSED(flags);
+	UNUSED(page_size);
+	UNUSED(phys_addr);
+
+	return 1;
+}
+
+//============================================================================
+// Kernel stacks
+//
+// The simulator runs every process on the host's stack, so switching is
+// a no-op. Each PCB slot still gets some memory for its Context.
+//============================================================================
+
+#define SIM_MAX_STACKS 1024
+
+static void* kernel_stacks[SIM_MAX_STACKS];
+
+uint64_t kernel_stack_get(uint64_t slot)
+{
+	ASSERT(slot < SIM_MAX_STACKS);
+	if (kernel_stacks[slot] == NULL)
+	{
+		kernel_stacks[slot] = host_alloc(16, KERNEL_STACK_SIZE);
+	}
+
+	return (uint64_t)kernel_stacks[slot] + KERNEL_STACK_SIZE;
+}
+
+void kernel_stack_prepare(PCB* pcb, void (*entry)(void))
+{
+	UNUSED(pcb);
+	UNUSED(entry);
+}
+
+void switch_to(PCB* prev, PCB* next)
+{
+	UNUSED(prev);
+	UNUSED(next);
+}
+
+void fs_base_set(uint64_t base)
+{
+	UNUSED(base);
+}
+
+void fpu_switch(PCB* prev, PCB* next)
+{
+	UNUSED(prev);
+	UNUSED(next);
+}
+
+void fpu_release(PCB* pcb)
+{
+	UNUSED(pcb);
+}
+
+void interrupts_enable()
+{
+}
+
+void interrupts_disable()
+{
+}
+
+void interrupts_window()
+{
+}
+
+uint64_t interrupts_save()
+{
+	return 0;
+}
+
+void interrupts_restore(uint64_t flags)
+{
+	UNUSED(flags);
+}
+
+//============================================================================
+// Processors
+//
+// The simulator only has the one, and it always holds the kernel lock.
+//============================================================================
+
+Cpu cpus[MAX_CPUS];
+
+Cpu* cpu_self()
+{
+	return &cpus[0];
+}
+
+uint32_t smp_num_cpus()
+{
+	return 1;
+}
+
+void smp_reschedule(uint32_t cpu)
+{
+	UNUSED(cpu);
+}
+
+//============================================================================
+// RCU
+//
+// Nothing in the simulator frees anything through call_rcu().
+//============================================================================
+
+void rcu_quiescent()
+{
+}
+
+void rcu_poll()
+{
+}
+
+//============================================================================
+// Events
+//
+// Nothing in the simulator registers any.
+//============================================================================
+
+void events_release(PCB* pcb)
+{
+	UNUSED(pcb);
+}
+
+void events_raise(EventType type, Pid target)
+{
+	UNUSED(type);
+	UNUSED(target);
+}
+
+//============================================================================
+// Channels
+//
+// Nothing in the simulator makes any.
+//============================================================================
+
+void channel_share(PCB* pcb, PCB* thread)
+{
+	UNUSED(pcb);
+	thread->channels = NULL;
+}
+
+void channel_release(PCB* pcb)
+{
+	UNUSED(pcb);
+}
+
+//============================================================================
+// The vdso page
+//
+// There are no user programs to read it.
+//============================================================================
+
+void vdso_switch(uint32_t cpu, uint32_t pid)
+{
+	UNUSED(cpu);
+	UNUSED(pid);
+}
+
+//============================================================================
+// Things only create_init_process() uses, which the simulator never calls
+//============================================================================
+
+ELF_Error elf_create_process(PCB* pcb, void* elf_file, void* page_table)
+{
+	UNUSED(pcb);
+	UNUSED(elf_file);
+	UNUSED(page_table);
+
+	panic("Sim: elf_create_process not simulated");
+	return 0;
+}
+
+void tss_set_context_stack(const uint64_t location)
+{
+	UNUSED(location);
+}
+
+void isr_restore()
+{
+	panic("Sim: isr_restore not simulated");
+}